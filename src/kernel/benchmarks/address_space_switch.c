@@ -0,0 +1,146 @@
+// Cost of switching between threads in different address spaces. Two threads
+// ping-pong through semaphores and read every page of their own user region
+// each turn, so the TLB entries a switch throws away have to be refilled.
+// Compared with the same threads sharing the kernel address space, and with
+// PCIDs on and off. The pages hold the id of their address space, which also
+// checks that each thread only ever sees its own.
+
+#include <kernel/benchmarks/benchmark.h>
+#include <kernel/util.h>
+
+#include <kernel/drivers/text_output.h>
+#include <kernel/memory/address_space.h>
+#include <kernel/memory/virtual_memory.h>
+#include <kernel/threading/mutex/semaphore.h>
+#include <kernel/threading/thread.h>
+
+#define NUM_PAGES 64
+#define NUM_ROUNDS 20000
+#define THREAD_PRIORITY 20
+
+typedef struct {
+  Semaphore turn;
+  Semaphore *other_turn;
+  AddressSpace *space;
+  uint64_t id;
+  uint64_t *frames;  // NUM_PAGES pages, mapped at ADDRESS_SPACE_USER_START
+} Player;
+
+static struct {
+  Player players[2];
+  uint64_t cycles;
+  volatile bool isolated;
+} switch_data;
+
+// Reads the first word of every page. The user region when the player has an
+// address space, its frames directly otherwise.
+static void touch_pages(Player *player) {
+  const bool mapped = player->space != NULL;
+  for (uint32_t i = 0; i < NUM_PAGES; ++i) {
+    const uint64_t address =
+        mapped ? ADDRESS_SPACE_USER_START + i * VM_PAGE_SIZE
+               : (uint64_t)player->frames + i * VM_PAGE_SIZE;
+    if (*(volatile uint64_t *)address != player->id) {
+      switch_data.isolated = false;
+    }
+  }
+}
+
+static void *player_main(void *parameter) {
+  Player *player = parameter;
+  const bool first = player == &switch_data.players[0];
+
+  const uint64_t start = read_tsc();
+  for (uint32_t i = 0; i < NUM_ROUNDS; ++i) {
+    semaphore_down(&player->turn, 1, -1);
+    touch_pages(player);
+    semaphore_up(player->other_turn, 1);
+  }
+  if (first) switch_data.cycles = read_tsc() - start;
+
+  return NULL;
+}
+
+// Returns the cycles per switch, with or without address spaces
+static uint64_t run(bool address_spaces) {
+  switch_data.isolated = true;
+
+  KernelThread *threads[2];
+  for (uint32_t i = 0; i < 2; ++i) {
+    Player *player = &switch_data.players[i];
+    semaphore_init(&player->turn, i == 0);
+    player->other_turn = &switch_data.players[1 - i].turn;
+
+    player->space = NULL;
+    if (address_spaces) {
+      player->space = address_space_create();
+      assert(player->space);
+      for (uint32_t j = 0; j < NUM_PAGES; ++j) {
+        const bool mapped = address_space_map(
+            player->space, ADDRESS_SPACE_USER_START + j * VM_PAGE_SIZE,
+            (uint64_t)player->frames + j * VM_PAGE_SIZE,
+            ADDRESS_SPACE_WRITABLE);
+        assert(mapped);
+      }
+    }
+
+    threads[i] = thread_create(player_main, player, THREAD_PRIORITY, 2);
+    assert(threads[i]);
+    thread_set_joinable(threads[i]);
+    if (player->space) thread_set_address_space(threads[i], player->space);
+  }
+
+  thread_start(threads[0]);
+  thread_start(threads[1]);
+  for (uint32_t i = 0; i < 2; ++i) {
+    const bool joined = thread_join(threads[i], NULL, 10000);
+    assert(joined);
+  }
+
+  for (uint32_t i = 0; i < 2; ++i) {
+    Player *player = &switch_data.players[i];
+    if (!player->space) continue;
+
+    for (uint32_t j = 0; j < NUM_PAGES; ++j) {
+      address_space_unmap(player->space,
+                          ADDRESS_SPACE_USER_START + j * VM_PAGE_SIZE);
+    }
+    address_space_destroy(player->space);
+    player->space = NULL;
+  }
+
+  assert(switch_data.isolated);
+  return switch_data.cycles / (2 * NUM_ROUNDS);
+}
+
+void benchmark_address_space_switch() {
+  for (uint32_t i = 0; i < 2; ++i) {
+    Player *player = &switch_data.players[i];
+    player->id = i + 1;
+    player->frames = vm_palloc(NUM_PAGES);
+    assert(player->frames);
+    for (uint32_t j = 0; j < NUM_PAGES; ++j) {
+      player->frames[j * VM_PAGE_SIZE / sizeof(uint64_t)] = player->id;
+    }
+  }
+
+  const uint64_t shared = run(false);
+  if (address_space_pcid_supported()) {
+    const uint64_t with_pcid = run(true);
+    address_space_set_pcid_enabled(false);
+    const uint64_t without_pcid = run(true);
+    address_space_set_pcid_enabled(true);
+
+    text_output_printf("  %u pages per turn: %lu cycles/switch in one "
+                       "address space, %lu across with PCIDs, %lu without\n",
+                       NUM_PAGES, shared, with_pcid, without_pcid);
+  } else {
+    text_output_printf("  %u pages per turn: %lu cycles/switch in one "
+                       "address space, %lu across (no PCID support)\n",
+                       NUM_PAGES, shared, run(true));
+  }
+
+  for (uint32_t i = 0; i < 2; ++i) {
+    vm_pfree(switch_data.players[i].frames, NUM_PAGES);
+  }
+}
@@ -0,0 +1,75 @@
+// Keeps thousands of requests in flight as async tasks, each of which would
+// otherwise need a thread and at least a page of stack. Every request waits
+// for its own completion once per stage, like an I/O going through the stages
+// of a device, then sleeps once on the timer wheel. Every request must finish.
+
+#include <kernel/benchmarks/benchmark.h>
+#include <kernel/util.h>
+
+#include <kernel/drivers/text_output.h>
+#include <kernel/memory/kmalloc.h>
+#include <kernel/memory/virtual_memory.h>
+#include <kernel/threading/task.h>
+
+#define NUM_REQUESTS 4096
+#define NUM_STAGES 4
+#define SLEEP_MS 1
+
+typedef struct {
+  Task task;
+  Completion stage_done;
+  uint32_t stage;
+} AsyncRequest;
+
+static volatile uint64_t num_resumes;
+
+static TaskStatus request_run(Task *task) {
+  AsyncRequest *request = container_of(task, AsyncRequest, task);
+  num_resumes++;
+
+  TASK_BEGIN(task);
+  for (request->stage = 0; request->stage < NUM_STAGES; ++request->stage) {
+    TASK_AWAIT_COMPLETION(task, &request->stage_done, -1);
+  }
+  TASK_SLEEP(task, SLEEP_MS);
+  TASK_END(task);
+}
+
+void benchmark_async_tasks() {
+  AsyncRequest *requests = kmalloc(NUM_REQUESTS * sizeof(AsyncRequest));
+  assert(requests);
+
+  num_resumes = 0;
+
+  uint64_t start = read_tsc();
+  for (uint32_t i = 0; i < NUM_REQUESTS; ++i) {
+    completion_init(&requests[i].stage_done);
+    task_init(&requests[i].task, request_run);
+    task_spawn(&requests[i].task);
+  }
+  const uint64_t spawn_cycles = (read_tsc() - start) / NUM_REQUESTS;
+
+  // The executor runs at a lower priority than we do, so each stage is
+  // completed for every request before any of them runs again
+  start = read_tsc();
+  for (uint32_t stage = 0; stage < NUM_STAGES; ++stage) {
+    for (uint32_t i = 0; i < NUM_REQUESTS; ++i) {
+      completion_complete(&requests[i].stage_done);
+    }
+  }
+
+  uint32_t num_finished = 0;
+  for (uint32_t i = 0; i < NUM_REQUESTS; ++i) {
+    if (task_join(&requests[i].task, 1000)) num_finished++;
+  }
+  const uint64_t total_cycles = read_tsc() - start;
+
+  kfree(requests);
+
+  text_output_printf(
+      "  %u requests (%u bytes each, a thread needs at least %u): spawn %lu "
+      "cycles, %lu resumes in %lu cycles (incl. %u ms sleep), %u finished\n",
+      NUM_REQUESTS, (uint32_t)sizeof(AsyncRequest), VM_PAGE_SIZE,
+      spawn_cycles, num_resumes, total_cycles, SLEEP_MS, num_finished);
+  assert(num_finished == NUM_REQUESTS);
+}
@@ -0,0 +1,51 @@
+#include <kernel/benchmarks/benchmark.h>
+#include <kernel/util.h>
+
+#include <kernel/drivers/text_output.h>
+#include <kernel/drivers/timer.h>
+
+static const struct {
+  const char *name;
+  void (*run)();
+} benchmarks[] = {
+    {"priority_inversion", benchmark_priority_inversion},
+    {"spinlock_cost", benchmark_spinlock_cost},
+    {"timer_wheel", benchmark_timer_wheel},
+    {"spsc_ring", benchmark_spsc_ring},
+    {"interrupt_latency", benchmark_interrupt_latency},
+    {"async_tasks", benchmark_async_tasks},
+    {"channel_pipeline", benchmark_channel_pipeline},
+    {"fork_join", benchmark_fork_join},
+    {"null_syscall", benchmark_null_syscall},
+    {"address_space_switch", benchmark_address_space_switch},
+    {"thread_create", benchmark_thread_create},
+    {"completion_wait", benchmark_completion_wait},
+};
+
+void benchmark_run_all() {
+  const size_t num_benchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+  for (size_t i = 0; i < num_benchmarks; ++i) {
+    text_output_printf("Running benchmark %s\n", benchmarks[i].name);
+    benchmarks[i].run();
+  }
+}
+
+void benchmark_spin_ms(uint64_t milliseconds) {
+  const uint64_t end = timer_ticks() + milliseconds * TIMER_FREQUENCY / 1000;
+  while (timer_ticks() < end) __asm__ volatile("pause");
+}
+
+void benchmark_sort_samples(uint64_t *samples, uint32_t count) {
+  // Shell sort, a few thousand samples don't need anything better
+  for (uint32_t gap = count / 2; gap > 0; gap /= 2) {
+    for (uint32_t i = gap; i < count; ++i) {
+      const uint64_t value = samples[i];
+      uint32_t j = i;
+      for (; j >= gap && samples[j - gap] > value; j -= gap) {
+        samples[j] = samples[j - gap];
+      }
+      samples[j] = value;
+    }
+  }
+}
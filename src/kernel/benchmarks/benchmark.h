@@ -0,0 +1,36 @@
+#include <kernel/kernel_common.h>
+
+#ifndef _BENCHMARK_H
+#define _BENCHMARK_H
+
+// In-kernel benchmarks and stress tests. They print their results and are
+// only run when the kernel is built with -DKERNEL_BENCHMARKS (see
+// kernel_main_thread()), which is the default. CONFIG_KERNEL_BENCHMARKS=n in
+// tup.config turns them off (see src/kernel/Tuprules.tup). They need a
+// threaded context with every driver initialized.
+
+void benchmark_run_all();
+
+// Busy waits for `milliseconds` without giving up the CPU
+void benchmark_spin_ms(uint64_t milliseconds);
+
+// Sorts latency samples in place, for percentiles
+void benchmark_sort_samples(uint64_t *samples, uint32_t count);
+
+// Individual benchmarks. benchmark_priority_inversion() is the regression
+// test for priority inheritance in lock.c, it panics if the lock holder
+// wasn't boosted.
+void benchmark_priority_inversion();
+void benchmark_spinlock_cost();
+void benchmark_timer_wheel();
+void benchmark_spsc_ring();
+void benchmark_interrupt_latency();
+void benchmark_async_tasks();
+void benchmark_channel_pipeline();
+void benchmark_fork_join();
+void benchmark_null_syscall();
+void benchmark_address_space_switch();
+void benchmark_thread_create();
+void benchmark_completion_wait();
+
+#endif
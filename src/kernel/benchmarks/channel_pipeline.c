@@ -0,0 +1,230 @@
+// Pushes buffers through a three-stage pipeline of threads connected by
+// channels, the way an I/O completion would go through a filesystem to its
+// consumer: the device stage fills a buffer, the filesystem stage checksums
+// it and the consumer checks it and hands it back to the device stage. Only
+// pointers go through the channels, there is a fixed pool of buffers.
+// Measures the throughput and the latency from the device stage to the
+// consumer, with one message at a time, in batches, and with the consumer
+// selecting between separate data and metadata channels.
+
+#include <kernel/benchmarks/benchmark.h>
+#include <kernel/util.h>
+
+#include <common/mem_util.h>
+#include <kernel/drivers/text_output.h>
+#include <kernel/drivers/time.h>
+#include <kernel/memory/kmalloc.h>
+#include <kernel/threading/channel.h>
+#include <kernel/threading/mutex/semaphore.h>
+#include <kernel/threading/thread.h>
+
+#define NUM_MESSAGES 20000
+#define NUM_BUFFERS 64
+#define CHANNEL_CAPACITY 16
+#define BATCH 16
+#define PAYLOAD_SIZE 512
+
+#define STAGE_PRIORITY 20
+
+typedef enum {
+  PIPELINE_SINGLE,
+  PIPELINE_BATCHED,
+  PIPELINE_SELECT,  // Odd sequence numbers go through a second channel
+} PipelineMode;
+
+typedef struct {
+  uint64_t sequence;
+  uint64_t sent_tsc;
+  uint64_t checksum;
+  uint8_t payload[PAYLOAD_SIZE];
+} PipelineBuffer;
+
+DECLARE_TYPED_CHANNEL(buffer_channel, PipelineBuffer)
+
+static struct {
+  PipelineMode mode;
+  Channel *free_buffers;  // Consumer to device
+  Channel *completed;     // Device to filesystem
+  Channel *processed[2];  // Filesystem to consumer, data and metadata
+
+  uint64_t *latency;  // In TSC cycles, by sequence number
+  volatile bool in_order;
+  Semaphore done;
+} pipeline_data;
+
+static uint64_t payload_checksum(PipelineBuffer *buffer) {
+  uint64_t checksum = 0;
+  for (uint32_t i = 0; i < PAYLOAD_SIZE; ++i) {
+    checksum = checksum * 31 + buffer->payload[i];
+  }
+  return checksum;
+}
+
+// send_batch() can take fewer than `count`
+static void send_all(Channel *channel, PipelineBuffer **buffers,
+                     uint32_t count) {
+  for (uint32_t sent = 0; sent < count;) {
+    const uint32_t num_sent =
+        channel_send_batch(channel, (void **)buffers + sent, count - sent, -1);
+    assert(num_sent > 0);
+    sent += num_sent;
+  }
+}
+
+static void *device_main(void *parameter UNUSED) {
+  const uint32_t batch = pipeline_data.mode == PIPELINE_BATCHED ? BATCH : 1;
+  PipelineBuffer *buffers[BATCH];
+
+  for (uint64_t sequence = 0; sequence < NUM_MESSAGES;) {
+    uint32_t count = batch;
+    if (count > NUM_MESSAGES - sequence) count = NUM_MESSAGES - sequence;
+    count = channel_receive_batch(pipeline_data.free_buffers,
+                                  (void **)buffers, count, -1);
+    assert(count > 0);
+
+    for (uint32_t i = 0; i < count; ++i) {
+      memset(buffers[i]->payload, sequence, PAYLOAD_SIZE);
+      buffers[i]->sequence = sequence++;
+      buffers[i]->sent_tsc = read_tsc();
+    }
+    send_all(pipeline_data.completed, buffers, count);
+  }
+
+  channel_close(pipeline_data.completed);
+  return NULL;
+}
+
+static void *filesystem_main(void *parameter UNUSED) {
+  const uint32_t batch = pipeline_data.mode == PIPELINE_BATCHED ? BATCH : 1;
+  PipelineBuffer *buffers[BATCH];
+
+  uint32_t count;
+  while ((count = channel_receive_batch(pipeline_data.completed,
+                                        (void **)buffers, batch, -1)) > 0) {
+    for (uint32_t i = 0; i < count; ++i) {
+      buffers[i]->checksum = payload_checksum(buffers[i]);
+    }
+
+    if (pipeline_data.mode == PIPELINE_SELECT) {
+      for (uint32_t i = 0; i < count; ++i) {
+        Channel *channel = pipeline_data.processed[buffers[i]->sequence & 1];
+        bool sent = buffer_channel_send(channel, buffers[i], -1);
+        assert(sent);
+      }
+    } else {
+      send_all(pipeline_data.processed[0], buffers, count);
+    }
+  }
+
+  channel_close(pipeline_data.processed[0]);
+  channel_close(pipeline_data.processed[1]);
+  return NULL;
+}
+
+static void *consumer_main(void *parameter UNUSED) {
+  // Each channel is in order on its own
+  uint64_t expected[2] = {0, 1};
+  const uint64_t step = pipeline_data.mode == PIPELINE_SELECT ? 2 : 1;
+
+  while (true) {
+    PipelineBuffer *buffer;
+    int index = 0;
+    if (pipeline_data.mode == PIPELINE_SELECT) {
+      ChannelCase cases[2] = {
+          {pipeline_data.processed[0], CHANNEL_RECEIVE, NULL},
+          {pipeline_data.processed[1], CHANNEL_RECEIVE, NULL},
+      };
+      index = channel_select(cases, 2, -1);
+      if (index < 0) break;
+      buffer = cases[index].message;
+    } else if (!buffer_channel_receive(pipeline_data.processed[0], &buffer,
+                                       -1)) {
+      break;
+    }
+
+    const uint64_t now = read_tsc();
+    if (buffer->sequence != expected[index] ||
+        buffer->checksum != payload_checksum(buffer)) {
+      pipeline_data.in_order = false;
+    } else {
+      pipeline_data.latency[buffer->sequence] = now - buffer->sent_tsc;
+    }
+    expected[index] += step;
+
+    bool sent = buffer_channel_send(pipeline_data.free_buffers, buffer, -1);
+    assert(sent);
+  }
+
+  semaphore_up(&pipeline_data.done, 1);
+  return NULL;
+}
+
+static void run_pipeline(const char *name, PipelineMode mode) {
+  pipeline_data.mode = mode;
+  pipeline_data.in_order = true;
+  semaphore_init(&pipeline_data.done, 0);
+
+  pipeline_data.free_buffers = channel_alloc(NUM_BUFFERS);
+  pipeline_data.completed = channel_alloc(CHANNEL_CAPACITY);
+  pipeline_data.processed[0] = channel_alloc(CHANNEL_CAPACITY);
+  pipeline_data.processed[1] = channel_alloc(CHANNEL_CAPACITY);
+  assert(pipeline_data.free_buffers && pipeline_data.completed &&
+         pipeline_data.processed[0] && pipeline_data.processed[1]);
+
+  PipelineBuffer *buffers = kmalloc(NUM_BUFFERS * sizeof(PipelineBuffer));
+  assert(buffers);
+  for (uint32_t i = 0; i < NUM_BUFFERS; ++i) {
+    bool sent =
+        buffer_channel_send(pipeline_data.free_buffers, &buffers[i], 0);
+    assert(sent);
+  }
+
+  KernelThread *device = thread_create(device_main, NULL, STAGE_PRIORITY, 1);
+  KernelThread *filesystem =
+      thread_create(filesystem_main, NULL, STAGE_PRIORITY, 1);
+  KernelThread *consumer =
+      thread_create(consumer_main, NULL, STAGE_PRIORITY, 1);
+  assert(device && filesystem && consumer);
+
+  const uint64_t start = read_tsc();
+  thread_start(consumer);
+  thread_start(filesystem);
+  thread_start(device);
+  semaphore_down(&pipeline_data.done, 1, -1);
+  const uint64_t cycles = read_tsc() - start;
+
+  // Every buffer is back in the pool
+  assert(channel_count(pipeline_data.free_buffers) == NUM_BUFFERS);
+
+  benchmark_sort_samples(pipeline_data.latency, NUM_MESSAGES);
+#define PERCENTILE(p) \
+  time_cycles_to_ns(pipeline_data.latency[(NUM_MESSAGES - 1) * (p) / 100])
+  text_output_printf(
+      "  %s: %lu cycles/message, latency (ns) p50 %lu, p99 %lu, max %lu, "
+      "%s\n",
+      name, cycles / NUM_MESSAGES, PERCENTILE(50), PERCENTILE(99),
+      PERCENTILE(100), pipeline_data.in_order ? "in order" : "OUT OF ORDER");
+#undef PERCENTILE
+  assert(pipeline_data.in_order);
+
+  kfree(buffers);
+  channel_free(pipeline_data.free_buffers);
+  channel_free(pipeline_data.completed);
+  channel_free(pipeline_data.processed[0]);
+  channel_free(pipeline_data.processed[1]);
+}
+
+void benchmark_channel_pipeline() {
+  pipeline_data.latency = kmalloc(NUM_MESSAGES * sizeof(uint64_t));
+  assert(pipeline_data.latency);
+
+  text_output_printf("  %u messages of %u bytes, %u buffers, %u slots per "
+                     "channel:\n",
+                     NUM_MESSAGES, (uint32_t)sizeof(PipelineBuffer),
+                     NUM_BUFFERS, CHANNEL_CAPACITY);
+  run_pipeline("single", PIPELINE_SINGLE);
+  run_pipeline("batched", PIPELINE_BATCHED);
+  run_pipeline("select", PIPELINE_SELECT);
+
+  kfree(pipeline_data.latency);
+}
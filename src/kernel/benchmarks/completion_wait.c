@@ -0,0 +1,170 @@
+// One service thread multiplexing several devices with completion_wait_any(),
+// the way a driver thread would serve many controllers. A producer thread
+// completes the devices in a known order, sometimes two at once, and the
+// service thread checks that each wait returns the index of the device that
+// completed first. Measures the latency from completion_complete() to the
+// service thread running. Then checks the timeout paths of wait_any and
+// wait_all, and that a timed out wait_all gives back what it had taken.
+
+#include <kernel/benchmarks/benchmark.h>
+#include <kernel/util.h>
+
+#include <kernel/drivers/text_output.h>
+#include <kernel/drivers/time.h>
+#include <kernel/threading/completion.h>
+#include <kernel/threading/mutex/semaphore.h>
+#include <kernel/threading/scheduler.h>
+#include <kernel/threading/thread.h>
+
+#define NUM_DEVICES 8
+#define NUM_EVENTS 10000
+#define PAIR_EVERY 8  // Complete two devices at once every this many events
+#define TIMEOUT_MS 10
+
+// The service thread preempts the producer as soon as a device completes
+#define PRODUCER_PRIORITY 20
+#define SERVICE_PRIORITY 21
+
+static struct {
+  Completion devices[NUM_DEVICES];
+  Completion *device_pointers[NUM_DEVICES];
+
+  uint8_t order[NUM_EVENTS];  // Device completed by each event
+  Semaphore handled;          // Service to producer, one per event
+  volatile uint64_t sent_tsc;
+
+  uint64_t total_latency, max_latency;
+  volatile bool in_order;
+} completion_data;
+
+static void *service_main(void *parameter UNUSED) {
+  for (uint32_t i = 0; i < NUM_EVENTS; ++i) {
+    const int index = completion_wait_any(completion_data.device_pointers,
+                                          NUM_DEVICES, 1000);
+    const uint64_t latency = read_tsc() - completion_data.sent_tsc;
+
+    if (index != completion_data.order[i]) completion_data.in_order = false;
+    completion_data.total_latency += latency;
+    if (latency > completion_data.max_latency) {
+      completion_data.max_latency = latency;
+    }
+
+    semaphore_up(&completion_data.handled, 1);
+  }
+
+  return NULL;
+}
+
+static void *producer_main(void *parameter UNUSED) {
+  for (uint32_t i = 0; i < NUM_EVENTS; ++i) {
+    const bool pair = i % PAIR_EVERY == 0 && i + 1 < NUM_EVENTS;
+
+    // With two at once, the first wakes the service thread and the second is
+    // only counted, so it has to be found by the next wait without sleeping
+    if (pair) preempt_disable();
+    completion_data.sent_tsc = read_tsc();
+    completion_complete(&completion_data.devices[completion_data.order[i]]);
+    if (pair) {
+      completion_complete(
+          &completion_data.devices[completion_data.order[i + 1]]);
+      preempt_enable();
+    }
+
+    const bool handled =
+        semaphore_down(&completion_data.handled, pair ? 2 : 1, 1000);
+    assert(handled);
+    if (pair) i++;
+  }
+
+  return NULL;
+}
+
+// Waits that can't be satisfied must time out, and not return early
+static void check_timeouts() {
+  Completion **devices = completion_data.device_pointers;
+
+  int index = completion_wait_any(devices, NUM_DEVICES, 0);
+  assert(index == -1);
+
+  uint64_t start = time_now_ns();
+  index = completion_wait_any(devices, NUM_DEVICES, TIMEOUT_MS);
+  const uint64_t any_ns = time_now_ns() - start;
+  assert(index == -1);
+
+  // Half of them completed: the timed out wait_all takes them and has to
+  // give them back
+  for (uint32_t i = 0; i < NUM_DEVICES; i += 2) {
+    completion_complete(devices[i]);
+  }
+  start = time_now_ns();
+  bool all = completion_wait_all(devices, NUM_DEVICES, TIMEOUT_MS);
+  const uint64_t all_ns = time_now_ns() - start;
+  assert(!all);
+  for (uint32_t i = 0; i < NUM_DEVICES; ++i) {
+    assert(completion_done(devices[i]) == (i % 2 == 0));
+  }
+
+  // Once the rest complete it succeeds and consumes every one of them
+  for (uint32_t i = 1; i < NUM_DEVICES; i += 2) {
+    completion_complete(devices[i]);
+  }
+  all = completion_wait_all(devices, NUM_DEVICES, 0);
+  assert(all);
+  for (uint32_t i = 0; i < NUM_DEVICES; ++i) {
+    assert(!completion_done(devices[i]));
+  }
+
+  text_output_printf("  %u ms timeouts: wait_any %lu us, wait_all %lu us\n",
+                     TIMEOUT_MS, any_ns / NS_PER_US, all_ns / NS_PER_US);
+  assert(any_ns >= TIMEOUT_MS * NS_PER_MS * 9 / 10);
+  assert(all_ns >= TIMEOUT_MS * NS_PER_MS * 9 / 10);
+}
+
+void benchmark_completion_wait() {
+  for (uint32_t i = 0; i < NUM_DEVICES; ++i) {
+    completion_init(&completion_data.devices[i]);
+    completion_data.device_pointers[i] = &completion_data.devices[i];
+  }
+
+  // Any order works, as long as pairs aren't in index order, or a wait that
+  // always returned the lowest index would pass
+  uint32_t random = 4321;
+  for (uint32_t i = 0; i < NUM_EVENTS; ++i) {
+    random = random * 1103515245 + 12345;
+    completion_data.order[i] = (random >> 8) % NUM_DEVICES;
+    if (i % PAIR_EVERY == 1 &&
+        completion_data.order[i] >= completion_data.order[i - 1]) {
+      completion_data.order[i - 1] = NUM_DEVICES - 1;
+      completion_data.order[i] = (random >> 8) % (NUM_DEVICES - 1);
+    }
+  }
+
+  semaphore_init(&completion_data.handled, 0);
+  completion_data.total_latency = 0;
+  completion_data.max_latency = 0;
+  completion_data.in_order = true;
+
+  KernelThread *service =
+      thread_create(service_main, NULL, SERVICE_PRIORITY, 2);
+  KernelThread *producer =
+      thread_create(producer_main, NULL, PRODUCER_PRIORITY, 2);
+  assert(service && producer);
+  thread_set_joinable(service);
+  thread_set_joinable(producer);
+  thread_start(service);
+  thread_start(producer);
+
+  bool joined = thread_join(producer, NULL, 10000);
+  joined = thread_join(service, NULL, 10000) && joined;
+  assert(joined);
+
+  text_output_printf("  %u devices, %u events: wake latency avg %lu cycles, "
+                     "max %lu, %s\n",
+                     NUM_DEVICES, NUM_EVENTS,
+                     completion_data.total_latency / NUM_EVENTS,
+                     completion_data.max_latency,
+                     completion_data.in_order ? "in order" : "OUT OF ORDER");
+  assert(completion_data.in_order);
+
+  check_timeouts();
+}
@@ -0,0 +1,103 @@
+// Joins threads and checks their return values, then measures the fork-join
+// pool: the cost of a spawn and join from outside the pool, and a checksum of
+// a large buffer with parallel_for() against a plain loop. There is only one
+// CPU, so parallel_for() can only show its overhead, not a speedup.
+
+#include <kernel/benchmarks/benchmark.h>
+#include <kernel/util.h>
+
+#include <kernel/drivers/text_output.h>
+#include <kernel/memory/virtual_memory.h>
+#include <kernel/threading/fork_join.h>
+#include <kernel/threading/thread.h>
+
+#define NUM_THREADS 8
+#define NUM_TASKS 1024
+#define BUFFER_PAGES 1024
+#define GRAIN 4096  // In 64-bit words
+
+#define THREAD_PRIORITY 20
+
+static void *double_main(void *parameter) {
+  return (void *)((uint64_t)parameter * 2);
+}
+
+static void *empty_task(void *argument) { return argument; }
+
+typedef struct {
+  const uint64_t *words;
+  uint64_t sum;
+} Checksum;
+
+static void checksum_range(uint64_t begin, uint64_t end, void *context) {
+  Checksum *checksum = (Checksum *)context;
+
+  uint64_t sum = 0;
+  for (uint64_t i = begin; i < end; ++i) sum += checksum->words[i] ^ i;
+  __sync_fetch_and_add(&checksum->sum, sum);
+}
+
+static uint32_t join_threads() {
+  KernelThread *threads[NUM_THREADS];
+  for (uint64_t i = 0; i < NUM_THREADS; ++i) {
+    threads[i] =
+        thread_create(double_main, (void *)(i + 1), THREAD_PRIORITY, 1);
+    assert(threads[i]);
+    thread_set_joinable(threads[i]);
+    thread_start(threads[i]);
+  }
+
+  uint32_t num_correct = 0;
+  for (uint64_t i = 0; i < NUM_THREADS; ++i) {
+    void *result;
+    if (thread_join(threads[i], &result, 1000) &&
+        (uint64_t)result == (i + 1) * 2) {
+      num_correct++;
+    }
+  }
+  return num_correct;
+}
+
+void benchmark_fork_join() {
+  const uint32_t num_correct = join_threads();
+  text_output_printf("  thread_join: %u/%u threads returned their value\n",
+                     num_correct, NUM_THREADS);
+  assert(num_correct == NUM_THREADS);
+
+  static ForkJoinTask tasks[NUM_TASKS];
+  uint64_t start = read_tsc();
+  for (uint64_t i = 0; i < NUM_TASKS; ++i) {
+    fork_join_spawn(&tasks[i], empty_task, (void *)i);
+  }
+  bool results_correct = true;
+  for (uint64_t i = 0; i < NUM_TASKS; ++i) {
+    if ((uint64_t)fork_join_join(&tasks[i]) != i) results_correct = false;
+  }
+  const uint64_t task_cycles = (read_tsc() - start) / NUM_TASKS;
+  assert(results_correct);
+
+  uint64_t *words = vm_palloc(BUFFER_PAGES);
+  assert(words);
+  const uint64_t num_words = BUFFER_PAGES * VM_PAGE_SIZE / sizeof(uint64_t);
+  for (uint64_t i = 0; i < num_words; ++i) words[i] = i * 0x9E3779B97F4A7C15;
+
+  start = read_tsc();
+  uint64_t expected = 0;
+  for (uint64_t i = 0; i < num_words; ++i) expected += words[i] ^ i;
+  const uint64_t serial_cycles = read_tsc() - start;
+
+  Checksum checksum = {.words = words, .sum = 0};
+  start = read_tsc();
+  parallel_for(0, num_words, GRAIN, checksum_range, &checksum);
+  const uint64_t parallel_cycles = read_tsc() - start;
+
+  vm_pfree(words, BUFFER_PAGES);
+
+  text_output_printf(
+      "  spawn+join %lu cycles/task, checksum of %u KiB: loop %lu cycles, "
+      "parallel_for %lu cycles (%s)\n",
+      task_cycles, (uint32_t)(BUFFER_PAGES * VM_PAGE_SIZE / 1024),
+      serial_cycles, parallel_cycles,
+      checksum.sum == expected ? "matches" : "MISMATCH");
+  assert(checksum.sum == expected);
+}
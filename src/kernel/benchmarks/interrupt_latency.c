@@ -0,0 +1,186 @@
+// Measures how quickly the kernel reacts to an interrupt, with the local APIC
+// timer as the interrupt source and the TSC as the clock:
+// - IRQ entry: from when a one-shot timer is due until its handler runs
+// - Wakeup: from the handler until the thread it woke up is running
+// - Jitter: how far the time between two periodic interrupts is from the
+//   period
+// Time slices are off while the APIC timer is borrowed. The timer tick and
+// every other interrupt still run, and show up in the tail.
+// The entry latency includes the error of the TSC and APIC timer calibration,
+// which is the same for every sample.
+
+#include <kernel/benchmarks/benchmark.h>
+#include <kernel/util.h>
+
+#include <kernel/drivers/apic.h>
+#include <kernel/drivers/interrupt.h>
+#include <kernel/drivers/serial_port.h>
+#include <kernel/drivers/text_output.h>
+#include <kernel/drivers/time.h>
+#include <kernel/memory/kmalloc.h>
+#include <kernel/threading/mutex/semaphore.h>
+#include <kernel/threading/scheduler.h>
+#include <kernel/threading/scheduler_statistics.h>
+#include <kernel/threading/thread.h>
+
+#define NUM_SAMPLES 2000
+#define ONE_SHOT_US 100
+#define PERIOD_US 500
+
+#define HANDLER_PRIORITY 30  // 31 is the timer bottom half's
+
+static struct {
+  int vector;  // Of the local APIC timer while we have it
+  KernelThread *thread;  // Woken up by the interrupt handler
+  volatile bool running;
+  volatile bool periodic;
+  volatile bool fired;
+  volatile uint64_t irq_tsc;  // When the handler last ran
+
+  uint64_t period_cycles;
+  volatile uint32_t num_periods;
+
+  uint64_t *entry_latency, *wake_latency, *jitter;  // In TSC cycles
+  Semaphore done;
+} latency_data;
+
+static void latency_timer_isr() {
+  const uint64_t now = read_tsc();
+  if (!latency_data.running) return;
+
+  if (latency_data.periodic) {
+    const uint64_t previous = latency_data.irq_tsc;
+    latency_data.irq_tsc = now;
+    if (previous == 0) return;
+
+    const uint64_t interval = now - previous;
+    const uint64_t period = latency_data.period_cycles;
+    latency_data.jitter[latency_data.num_periods++] =
+        interval > period ? interval - period : period - interval;
+    if (latency_data.num_periods < NUM_SAMPLES) return;
+
+    apic_set_local_timer_masked(true);
+  } else {
+    latency_data.irq_tsc = now;
+  }
+
+  latency_data.fired = true;
+  thread_wake(latency_data.thread);
+}
+
+// Sleeps until the handler sets `fired`, returns when the thread ran again.
+// Interrupts must be disabled.
+static uint64_t latency_wait() {
+  while (!latency_data.fired) thread_sleep(latency_data.thread);
+  return read_tsc();
+}
+
+static void *latency_thread_main(void *parameter UNUSED) {
+  const uint64_t apic_frequency = time_apic_timer_frequency();
+  const uint64_t tsc_frequency = time_tsc_frequency();
+
+  // One-shots, the timer starts counting when the count is written
+  const uint32_t one_shot_count = apic_frequency * ONE_SHOT_US / 1000000;
+  const uint64_t one_shot_cycles =
+      (uint64_t)one_shot_count * tsc_frequency / apic_frequency;
+
+  apic_setup_local_timer(APIC_DIV_1, latency_data.vector, APIC_TIMER_ONE_SHOT,
+                         0);
+  apic_set_local_timer_masked(false);
+
+  for (uint32_t i = 0; i < NUM_SAMPLES; ++i) {
+    cli();
+    latency_data.fired = false;
+
+    const uint64_t due = read_tsc() + one_shot_cycles;
+    apic_restart_local_timer(one_shot_count);
+    const uint64_t woken = latency_wait();
+
+    const uint64_t irq_tsc = latency_data.irq_tsc;
+    latency_data.entry_latency[i] = irq_tsc > due ? irq_tsc - due : 0;
+    latency_data.wake_latency[i] = woken - irq_tsc;
+    sti();
+  }
+
+  // Periodic, the handler masks the timer once it has every sample
+  const uint32_t period_count = apic_frequency * PERIOD_US / 1000000;
+  latency_data.period_cycles =
+      (uint64_t)period_count * tsc_frequency / apic_frequency;
+  latency_data.num_periods = 0;
+  latency_data.irq_tsc = 0;
+
+  cli();
+  latency_data.fired = false;
+  latency_data.periodic = true;
+  apic_setup_local_timer(APIC_DIV_1, latency_data.vector, APIC_TIMER_PERIODIC,
+                         period_count);
+  apic_set_local_timer_masked(false);
+  latency_wait();
+  latency_data.periodic = false;
+  sti();
+
+  semaphore_up(&latency_data.done, 1);
+  return NULL;
+}
+
+// Prints percentiles in nanoseconds, and a log2 histogram in cycles to the
+// serial port only
+static void print_distribution(const char *name, uint64_t *samples) {
+  benchmark_sort_samples(samples, NUM_SAMPLES);
+
+  SchedulerHistogram histogram = {.count = 0};
+  for (uint32_t i = 0; i < NUM_SAMPLES; ++i) {
+    scheduler_histogram_record(&histogram, samples[i]);
+  }
+
+#define PERMILLE(p) time_cycles_to_ns(samples[(NUM_SAMPLES - 1) * (p) / 1000])
+  text_output_printf(
+      "  %s (ns): p50 %lu, p90 %lu, p99 %lu, p99.9 %lu, max %lu\n", name,
+      PERMILLE(500), PERMILLE(900), PERMILLE(990), PERMILLE(999),
+      time_cycles_to_ns(samples[NUM_SAMPLES - 1]));
+#undef PERMILLE
+
+  serial_port_printf("  %s (cycles), %u samples:\n", name, NUM_SAMPLES);
+  for (uint32_t i = 0; i < SCHEDULER_HISTOGRAM_BUCKETS; ++i) {
+    if (histogram.buckets[i] == 0) continue;
+    serial_port_printf("    [2^%u, 2^%u): %lu\n", i, i + 1,
+                       histogram.buckets[i]);
+  }
+}
+
+void benchmark_interrupt_latency() {
+  latency_data.entry_latency = kmalloc(NUM_SAMPLES * sizeof(uint64_t));
+  latency_data.wake_latency = kmalloc(NUM_SAMPLES * sizeof(uint64_t));
+  latency_data.jitter = kmalloc(NUM_SAMPLES * sizeof(uint64_t));
+  assert(latency_data.entry_latency && latency_data.wake_latency &&
+         latency_data.jitter);
+
+  semaphore_init(&latency_data.done, 0);
+  latency_data.periodic = false;
+  latency_data.thread =
+      thread_create(latency_thread_main, NULL, HANDLER_PRIORITY, 1);
+  assert(latency_data.thread);
+
+  latency_data.vector =
+      irq_alloc_vector(latency_timer_isr, NULL, INTERRUPT_EOI);
+  assert(latency_data.vector >= 0);
+  latency_data.running = true;
+  scheduler_stop_timer();
+
+  thread_start(latency_data.thread);
+  semaphore_down(&latency_data.done, 1, -1);
+
+  latency_data.running = false;
+  scheduler_start_timer();
+  irq_free_vector(latency_data.vector);
+
+  text_output_printf("  One-shot %u us, period %u us:\n", ONE_SHOT_US,
+                     PERIOD_US);
+  print_distribution("IRQ entry", latency_data.entry_latency);
+  print_distribution("Wakeup", latency_data.wake_latency);
+  print_distribution("Jitter", latency_data.jitter);
+
+  kfree(latency_data.entry_latency);
+  kfree(latency_data.wake_latency);
+  kfree(latency_data.jitter);
+}
@@ -0,0 +1,72 @@
+// Round trip of a system call that does nothing, from a ring 3 thread: SYSCALL,
+// the switch to the thread's kernel stack, the dispatch table and SYSRET.
+// Calling the dispatcher directly from the kernel shows how much of that is
+// the mode switch.
+
+#include <kernel/benchmarks/benchmark.h>
+#include <kernel/util.h>
+
+#include <kernel/drivers/syscall.h>
+#include <kernel/drivers/text_output.h>
+#include <kernel/memory/virtual_memory.h>
+#include <kernel/threading/thread.h>
+
+#define NUM_CALLS 100000
+#define THREAD_PRIORITY 20
+
+// Written from ring 3, so it gets pages of its own
+static struct {
+  uint64_t total_cycles, min_cycles;
+} __attribute__((aligned(VM_PAGE_SIZE))) user_data;
+
+// Runs in ring 3, it may only touch its stack and `user_data`, and must not
+// call anything that isn't inlined. It starts a page, so granting access to
+// VM_PAGE_SIZE bytes from it covers that one page.
+static void *__attribute__((aligned(VM_PAGE_SIZE)))
+null_syscall_user_main(void *parameter UNUSED) {
+  uint64_t min_cycles = UINT64_MAX;
+
+  const uint64_t start = __builtin_ia32_rdtsc();
+  for (uint32_t i = 0; i < NUM_CALLS; ++i) {
+    const uint64_t call_start = __builtin_ia32_rdtsc();
+    syscall0(SYSCALL_NULL);
+    const uint64_t cycles = __builtin_ia32_rdtsc() - call_start;
+    if (cycles < min_cycles) min_cycles = cycles;
+  }
+  user_data.total_cycles = __builtin_ia32_rdtsc() - start;
+  user_data.min_cycles = min_cycles;
+
+  return (void *)syscall0(SYSCALL_THREAD_ID);
+}
+
+void benchmark_null_syscall() {
+  // The pages hold kernel code and data around them too, so the access is
+  // taken back as soon as the thread is done
+  vm_set_user_accessible((void *)null_syscall_user_main, VM_PAGE_SIZE);
+  vm_set_user_accessible(&user_data, sizeof(user_data));
+
+  KernelThread *thread =
+      thread_create_user(null_syscall_user_main, NULL, THREAD_PRIORITY, 1);
+  assert(thread);
+  thread_set_joinable(thread);
+  const uint32_t tid = thread_id(thread);
+  thread_start(thread);
+
+  void *result;
+  const bool joined = thread_join(thread, &result, 10000);
+  assert(joined && (uint64_t)result == tid);
+
+  vm_clear_user_accessible((void *)null_syscall_user_main, VM_PAGE_SIZE);
+  vm_clear_user_accessible(&user_data, sizeof(user_data));
+
+  uint64_t start = read_tsc();
+  for (uint32_t i = 0; i < NUM_CALLS; ++i) {
+    syscall_dispatch(0, 0, 0, 0, 0, SYSCALL_NULL);
+  }
+  const uint64_t dispatch_cycles = (read_tsc() - start) / NUM_CALLS;
+
+  text_output_printf("  SYSCALL/SYSRET round trip: avg %lu cycles, min %lu "
+                     "(dispatch alone %lu), %u calls\n",
+                     user_data.total_cycles / NUM_CALLS, user_data.min_cycles,
+                     dispatch_cycles, NUM_CALLS);
+}
@@ -0,0 +1,97 @@
+// Classic priority inversion: a low priority thread holds a Lock that a high
+// priority thread needs, while a medium priority thread hogs the CPU. Without
+// priority inheritance the high priority thread waits for the medium one to
+// finish; with it, it only waits for the low priority thread to finish its
+// critical section. The lock holder not being boosted is a bug, so this
+// panics rather than just printing the numbers.
+
+#include <kernel/benchmarks/benchmark.h>
+#include <kernel/util.h>
+
+#include <kernel/drivers/text_output.h>
+#include <kernel/drivers/timer.h>
+#include <kernel/threading/mutex/lock.h>
+#include <kernel/threading/mutex/semaphore.h>
+#include <kernel/threading/scheduler.h>
+#include <kernel/threading/thread.h>
+
+#define LOW_PRIORITY 2
+#define MEDIUM_PRIORITY 16
+#define HIGH_PRIORITY 30
+
+#define HOLD_MS 20   // How long the low priority thread holds the lock
+#define HOG_MS 200   // How long the medium priority thread runs for
+#define SLACK_MS 10  // One time slice
+
+static struct {
+  Lock lock;
+  Semaphore done;
+
+  volatile uint8_t boosted_priority;  // Low thread's priority while holding
+  volatile uint64_t wait_ticks, wait_cycles;
+} inversion_data;
+
+static void *low_main(void *parameter UNUSED) {
+  lock_acquire(&inversion_data.lock, -1);
+  benchmark_spin_ms(HOLD_MS);
+  inversion_data.boosted_priority = thread_priority(scheduler_current_thread());
+  lock_release(&inversion_data.lock);
+
+  semaphore_up(&inversion_data.done, 1);
+  return NULL;
+}
+
+static void *medium_main(void *parameter UNUSED) {
+  benchmark_spin_ms(HOG_MS);
+
+  semaphore_up(&inversion_data.done, 1);
+  return NULL;
+}
+
+static void *high_main(void *parameter UNUSED) {
+  const uint64_t start_ticks = timer_ticks();
+  const uint64_t start_cycles = read_tsc();
+
+  lock_acquire(&inversion_data.lock, -1);
+  inversion_data.wait_cycles = read_tsc() - start_cycles;
+  inversion_data.wait_ticks = timer_ticks() - start_ticks;
+  lock_release(&inversion_data.lock);
+
+  semaphore_up(&inversion_data.done, 1);
+  return NULL;
+}
+
+void benchmark_priority_inversion() {
+  lock_init(&inversion_data.lock);
+  semaphore_init(&inversion_data.done, 0);
+
+  KernelThread *low = thread_create(low_main, NULL, LOW_PRIORITY, 1);
+  KernelThread *medium = thread_create(medium_main, NULL, MEDIUM_PRIORITY, 1);
+  KernelThread *high = thread_create(high_main, NULL, HIGH_PRIORITY, 1);
+  assert(low && medium && high);
+
+  // Let the low priority thread take the lock
+  thread_start(low);
+  timer_thread_sleep(1);
+  assert(lock_owner(&inversion_data.lock) == low);
+
+  thread_start(medium);
+  thread_start(high);
+  semaphore_down(&inversion_data.done, 3, -1);
+
+  const uint64_t wait_ms = inversion_data.wait_ticks * 1000 / TIMER_FREQUENCY;
+  const bool bounded = wait_ms <= HOLD_MS + SLACK_MS;
+  text_output_printf(
+      "  High priority thread waited %lu ms (%lu cycles) for a lock held for "
+      "%u ms, with a %u ms CPU hog: %s\n",
+      wait_ms, inversion_data.wait_cycles, HOLD_MS, HOG_MS,
+      bounded ? "bounded" : "UNBOUNDED");
+  text_output_printf("  Lock holder ran at priority %u (base %u)\n",
+                     inversion_data.boosted_priority, LOW_PRIORITY);
+
+  // The wait depends on timing, the boost doesn't
+  if (inversion_data.boosted_priority != HIGH_PRIORITY) {
+    panic("Priority inheritance didn't boost the lock holder to %u\n",
+          HIGH_PRIORITY);
+  }
+}
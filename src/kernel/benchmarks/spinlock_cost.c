@@ -0,0 +1,79 @@
+// Cost of an uncontended acquire/release pair for each spinlock flavour, with
+// interrupts disabled as they would be in the kernel. There is only one CPU,
+// so a spinlock can't be contended without its holder being preempted, which
+// only measures the time slice. This doesn't say anything about how the locks
+// scale with the number of cores.
+
+#include <kernel/benchmarks/benchmark.h>
+#include <kernel/util.h>
+
+#include <kernel/drivers/text_output.h>
+#include <kernel/threading/mutex/spinlock.h>
+
+#define ITERATIONS 10000  // Interrupts stay off for all of them
+
+typedef enum {
+  LOCK_TEST_AND_SET,
+  LOCK_TICKET,
+  LOCK_MCS,
+  NUM_LOCK_TYPES
+} LockType;
+
+static const char *const lock_names[NUM_LOCK_TYPES] = {"test-and-set",
+                                                       "ticket", "mcs"};
+
+static struct {
+  SpinLock spinlock;
+  TicketLock ticket_lock;
+  McsLock mcs_lock;
+
+  volatile uint64_t counter;
+} spinlock_cost_data;
+
+static void lock_and_increment(LockType type) {
+  McsNode node;
+  switch (type) {
+    case LOCK_TEST_AND_SET:
+      spinlock_acquire(&spinlock_cost_data.spinlock);
+      spinlock_cost_data.counter++;
+      spinlock_release(&spinlock_cost_data.spinlock);
+      break;
+    case LOCK_TICKET:
+      ticket_lock_acquire(&spinlock_cost_data.ticket_lock);
+      spinlock_cost_data.counter++;
+      ticket_lock_release(&spinlock_cost_data.ticket_lock);
+      break;
+    case LOCK_MCS:
+      mcs_lock_acquire(&spinlock_cost_data.mcs_lock, &node);
+      spinlock_cost_data.counter++;
+      mcs_lock_release(&spinlock_cost_data.mcs_lock, &node);
+      break;
+    default:
+      assert(false);
+  }
+}
+
+void benchmark_spinlock_cost() {
+  spinlock_init(&spinlock_cost_data.spinlock);
+  ticket_lock_init(&spinlock_cost_data.ticket_lock);
+  mcs_lock_init(&spinlock_cost_data.mcs_lock);
+
+  text_output_printf("  uncontended acquire/release:");
+  for (LockType type = 0; type < NUM_LOCK_TYPES; ++type) {
+    spinlock_cost_data.counter = 0;
+
+    bool interrupts_enabled = interrupts_status();
+    cli();
+
+    const uint64_t start = read_tsc();
+    for (uint32_t i = 0; i < ITERATIONS; ++i) lock_and_increment(type);
+    const uint64_t cycles = (read_tsc() - start) / ITERATIONS;
+
+    // Only re-enable interrupts if they were enabled before
+    if (interrupts_enabled) sti();
+
+    assert(spinlock_cost_data.counter == ITERATIONS);
+    text_output_printf(" %s %lu cycles%s", lock_names[type], cycles,
+                       type + 1 < NUM_LOCK_TYPES ? "," : "\n");
+  }
+}
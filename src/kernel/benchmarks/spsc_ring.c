@@ -0,0 +1,141 @@
+// Throughput of the SPSC ring against the old Queue, moving elements through
+// in bursts the way an interrupt handler and its reader would. Then a producer
+// and a consumer thread push a sequence through a small ring while being
+// preempted, to check nothing is lost or reordered.
+
+#include <kernel/benchmarks/benchmark.h>
+#include <kernel/util.h>
+
+#include <kernel/datastructures/queue.h>
+#include <kernel/datastructures/spsc_ring.h>
+#include <kernel/drivers/text_output.h>
+#include <kernel/memory/kmalloc.h>
+#include <kernel/threading/mutex/semaphore.h>
+#include <kernel/threading/scheduler.h>
+#include <kernel/threading/thread.h>
+
+#define CAPACITY 1024
+#define BURST 64
+#define ELEMENTS (1 << 20)
+
+#define THREADED_CAPACITY 16
+#define THREADED_ELEMENTS 100000
+#define THREAD_PRIORITY 20
+
+static struct {
+  SpscRing *ring;
+  Semaphore done;
+  volatile bool in_order;
+} spsc_data;
+
+static uint64_t run_queue() {
+  Queue *queue = queue_alloc(CAPACITY);
+  assert(queue);
+
+  uint64_t sum = 0;
+  const uint64_t start = read_tsc();
+  for (uint64_t i = 0; i < ELEMENTS; i += BURST) {
+    for (uint64_t j = 0; j < BURST; ++j) {
+      QueueValue v = {.u = i + j};
+      queue_enqueue(queue, v, false);
+    }
+    for (uint64_t j = 0; j < BURST; ++j) sum += queue_dequeue(queue).u;
+  }
+  const uint64_t cycles = read_tsc() - start;
+
+  assert(sum == (uint64_t)ELEMENTS * (ELEMENTS - 1) / 2);
+  kfree(queue);
+  return cycles / ELEMENTS;
+}
+
+static uint64_t run_ring(bool batched) {
+  SpscRing *ring = spsc_ring_alloc(CAPACITY);
+  assert(ring);
+
+  QueueValue burst[BURST];
+  uint64_t sum = 0;
+  const uint64_t start = read_tsc();
+  for (uint64_t i = 0; i < ELEMENTS; i += BURST) {
+    if (batched) {
+      for (uint64_t j = 0; j < BURST; ++j) burst[j].u = i + j;
+      spsc_ring_enqueue_batch(ring, burst, BURST);
+      spsc_ring_dequeue_batch(ring, burst, BURST);
+      for (uint64_t j = 0; j < BURST; ++j) sum += burst[j].u;
+    } else {
+      for (uint64_t j = 0; j < BURST; ++j) {
+        QueueValue v = {.u = i + j};
+        spsc_ring_enqueue(ring, v);
+      }
+      for (uint64_t j = 0; j < BURST; ++j) {
+        QueueValue v;
+        spsc_ring_dequeue(ring, &v);
+        sum += v.u;
+      }
+    }
+  }
+  const uint64_t cycles = read_tsc() - start;
+
+  assert(sum == (uint64_t)ELEMENTS * (ELEMENTS - 1) / 2);
+  kfree(ring);
+  return cycles / ELEMENTS;
+}
+
+static void *producer_main(void *parameter UNUSED) {
+  for (uint64_t i = 0; i < THREADED_ELEMENTS;) {
+    QueueValue v = {.u = i};
+    if (spsc_ring_enqueue(spsc_data.ring, v)) {
+      i++;
+    } else {
+      scheduler_yield();
+    }
+  }
+
+  semaphore_up(&spsc_data.done, 1);
+  return NULL;
+}
+
+static void *consumer_main(void *parameter UNUSED) {
+  for (uint64_t expected = 0; expected < THREADED_ELEMENTS;) {
+    QueueValue v;
+    if (spsc_ring_dequeue(spsc_data.ring, &v)) {
+      if (v.u != expected) spsc_data.in_order = false;
+      expected++;
+    } else {
+      scheduler_yield();
+    }
+  }
+
+  semaphore_up(&spsc_data.done, 1);
+  return NULL;
+}
+
+void benchmark_spsc_ring() {
+  text_output_printf("  burst of %u: Queue %lu cycles/element, ring %lu, ring "
+                     "batched %lu\n",
+                     BURST, run_queue(), run_ring(false), run_ring(true));
+
+  spsc_data.ring = spsc_ring_alloc(THREADED_CAPACITY);
+  assert(spsc_data.ring);
+  spsc_data.in_order = true;
+  semaphore_init(&spsc_data.done, 0);
+
+  KernelThread *producer =
+      thread_create(producer_main, NULL, THREAD_PRIORITY, 1);
+  KernelThread *consumer =
+      thread_create(consumer_main, NULL, THREAD_PRIORITY, 1);
+  assert(producer && consumer);
+
+  const uint64_t start = read_tsc();
+  thread_start(consumer);
+  thread_start(producer);
+  semaphore_down(&spsc_data.done, 2, -1);
+  const uint64_t cycles = read_tsc() - start;
+
+  text_output_printf("  threaded: %u elements through %u slots, %lu "
+                     "cycles/element, %s\n",
+                     THREADED_ELEMENTS, THREADED_CAPACITY,
+                     cycles / THREADED_ELEMENTS,
+                     spsc_data.in_order ? "in order" : "OUT OF ORDER");
+  assert(spsc_data.in_order);
+  kfree(spsc_data.ring);
+}
@@ -0,0 +1,62 @@
+// Cost of thread_create() when the stack comes from the cache of exited
+// threads against when it has to come from the page allocator. Threads with
+// stacks of THREAD_CACHE_MAX_PAGES (8) pages are cached, one page more never
+// is. Each thread runs at a higher priority than the benchmark, so it runs
+// and switches away for good as soon as it's started. By the time the next
+// thread is created its stack is on the exited list, and thread_create()
+// reaps it into the cache before looking there. The first thread has no
+// predecessor and isn't counted.
+
+#include <kernel/benchmarks/benchmark.h>
+#include <kernel/util.h>
+
+#include <kernel/drivers/text_output.h>
+#include <kernel/threading/thread.h>
+
+#define NUM_THREADS 500
+#define CACHED_STACK_PAGES 8
+#define UNCACHED_STACK_PAGES 9
+
+#define WARMUP_THREADS 1
+
+// Above kernel_main_thread(), which runs the benchmarks
+#define THREAD_PRIORITY 31
+
+static void *empty_main(void *parameter) { return parameter; }
+
+// Returns the average cycles of thread_create(), `min` gets the fastest one
+static uint64_t create_threads(uint64_t stack_pages, uint64_t *min) {
+  uint64_t total = 0;
+  *min = UINT64_MAX;
+
+  for (uint32_t i = 0; i < WARMUP_THREADS + NUM_THREADS; ++i) {
+    const uint64_t start = read_tsc();
+    KernelThread *thread =
+        thread_create(empty_main, NULL, THREAD_PRIORITY, stack_pages);
+    const uint64_t cycles = read_tsc() - start;
+    assert(thread);
+
+    if (i >= WARMUP_THREADS) {
+      total += cycles;
+      if (cycles < *min) *min = cycles;
+    }
+
+    thread_set_joinable(thread);
+    thread_start(thread);
+    const bool joined = thread_join(thread, NULL, 1000);
+    assert(joined);
+  }
+
+  return total / NUM_THREADS;
+}
+
+void benchmark_thread_create() {
+  uint64_t cached_min, uncached_min;
+  const uint64_t cached = create_threads(CACHED_STACK_PAGES, &cached_min);
+  const uint64_t uncached =
+      create_threads(UNCACHED_STACK_PAGES, &uncached_min);
+
+  text_output_printf("  thread_create: cached stack avg %lu cycles (min %lu), "
+                     "allocated avg %lu (min %lu)\n",
+                     cached, cached_min, uncached, uncached_min);
+}
@@ -0,0 +1,131 @@
+// Arms a large number of timers spread over a couple of seconds, as if that
+// many threads were sleeping at once, and measures the cost of adding and
+// cancelling them. Cancelled timers must never fire, and every other one must
+// fire once.
+//
+// While they are armed, the wheel's per-tick cost is taken from the timer
+// statistics and compared with the list the wheel replaced: one unsorted list
+// that the bottom half walked in full whenever its earliest entry was due.
+// The list is replayed here over the same expiry times, one tick at a time.
+
+#include <kernel/benchmarks/benchmark.h>
+#include <kernel/util.h>
+
+#include <kernel/datastructures/list.h>
+#include <kernel/drivers/text_output.h>
+#include <kernel/drivers/timer.h>
+#include <kernel/memory/kmalloc.h>
+
+#define NUM_TIMERS 10000
+#define MAX_TIMEOUT_MS 2000
+#define CANCEL_EVERY 4  // Cancel one timer out of this many
+
+// An entry of the old list, wake_time is in ticks
+struct list_timer {
+  ListEntry entry;
+  uint64_t wake_time;
+};
+
+static volatile uint64_t num_fired;
+
+static void count_expiry(TimerNode *node UNUSED) { num_fired++; }
+
+// Runs the old list over `num_ticks` ticks, returns the average cycles per
+// tick
+static uint64_t list_cycles_per_tick(List *list, uint64_t num_ticks) {
+  uint64_t next_wake_time = 0;
+  uint64_t total = 0;
+
+  for (uint64_t tick = 0; tick <= num_ticks; ++tick) {
+    // What the old ISR checked before deferring to the bottom half
+    if (tick < next_wake_time) continue;
+
+    const uint64_t start = read_tsc();
+
+    next_wake_time = UINT64_MAX;
+    ListEntry *current = list_head(list);
+    while (current) {
+      struct list_timer *timer =
+          container_of(current, struct list_timer, entry);
+      ListEntry *next = list_next(current);
+
+      if (tick >= timer->wake_time) {
+        list_remove(list, current);
+      } else if (timer->wake_time < next_wake_time) {
+        next_wake_time = timer->wake_time;
+      }
+
+      current = next;
+    }
+
+    total += read_tsc() - start;
+  }
+
+  return total / (num_ticks + 1);
+}
+
+void benchmark_timer_wheel() {
+  TimerNode *nodes = kmalloc(NUM_TIMERS * sizeof(TimerNode));
+  struct list_timer *list_timers =
+      kmalloc(NUM_TIMERS * sizeof(struct list_timer));
+  assert(nodes && list_timers);
+
+  num_fired = 0;
+
+  // Spread the expiries over the whole range without any pattern the wheel
+  // could benefit from
+  uint32_t random = 12345;
+  uint64_t start = read_tsc();
+  for (uint32_t i = 0; i < NUM_TIMERS; ++i) {
+    random = random * 1103515245 + 12345;
+    const uint64_t timeout = 1 + (random >> 8) % MAX_TIMEOUT_MS;
+    timer_node_init(&nodes[i], count_expiry);
+    timer_add(&nodes[i], timeout);
+    list_timers[i].wake_time = timeout * TIMER_FREQUENCY / 1000;
+  }
+  const uint64_t add_cycles = (read_tsc() - start) / NUM_TIMERS;
+
+  uint32_t num_cancelled = 0;
+  start = read_tsc();
+  for (uint32_t i = 0; i < NUM_TIMERS; i += CANCEL_EVERY) {
+    if (timer_cancel(&nodes[i])) num_cancelled++;
+  }
+  const uint64_t cancel_cycles =
+      (read_tsc() - start) / (NUM_TIMERS / CANCEL_EVERY);
+
+  TimerStatistics before, after;
+  timer_get_statistics(&before);
+  timer_thread_sleep(MAX_TIMEOUT_MS + 100);
+  timer_get_statistics(&after);
+
+  for (uint32_t i = 0; i < NUM_TIMERS; ++i) assert(!timer_pending(&nodes[i]));
+  kfree(nodes);
+
+  const uint64_t num_ticks =
+      after.num_ticks_processed - before.num_ticks_processed;
+  const uint64_t wheel_cycles =
+      num_ticks ? (after.total_expiry_cycles - before.total_expiry_cycles) /
+                      num_ticks
+                : 0;
+
+  // Same timers, same cancellations, same number of ticks
+  List list;
+  list_init(&list);
+  for (uint32_t i = 0; i < NUM_TIMERS; ++i) {
+    if (i % CANCEL_EVERY) list_push_back(&list, &list_timers[i].entry);
+  }
+  const uint64_t list_cycles = list_cycles_per_tick(&list, num_ticks);
+  kfree(list_timers);
+
+  text_output_printf(
+      "  %u timers: add %lu cycles, cancel %lu cycles, %u cancelled, %lu "
+      "fired (expected %u)\n",
+      NUM_TIMERS, add_cycles, cancel_cycles, num_cancelled, num_fired,
+      NUM_TIMERS - num_cancelled);
+  text_output_printf("  per tick over %lu ticks: wheel %lu cycles, old list "
+                     "%lu cycles\n",
+                     num_ticks, wheel_cycles, list_cycles);
+  assert(num_fired == NUM_TIMERS - num_cancelled);
+
+  timer_print_statistics();
+}
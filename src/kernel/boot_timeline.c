@@ -0,0 +1,42 @@
+#include <kernel/boot_timeline.h>
+
+#include <kernel/drivers/text_output.h>
+#include <kernel/drivers/time.h>
+#include <kernel/util.h>
+
+#define kMaxBootStages 32
+
+static struct {
+  size_t num_stages;
+  struct {
+    const char *name;
+    uint64_t tsc;
+  } stages[kMaxBootStages];
+} boot_timeline_data;
+
+void boot_timeline_mark(const char *stage) {
+  assert(boot_timeline_data.num_stages < kMaxBootStages);
+
+  const size_t index = boot_timeline_data.num_stages++;
+  boot_timeline_data.stages[index].name = stage;
+  boot_timeline_data.stages[index].tsc = read_tsc();
+}
+
+void boot_timeline_print() {
+  if (boot_timeline_data.num_stages == 0) return;
+
+  text_output_printf("Boot timeline:\n");
+
+  const uint64_t start = boot_timeline_data.stages[0].tsc;
+  uint64_t previous = start;
+  for (size_t i = 0; i < boot_timeline_data.num_stages; ++i) {
+    const uint64_t tsc = boot_timeline_data.stages[i].tsc;
+    text_output_printf("  %-16s %8lu us (at %lu us)\n",
+                       boot_timeline_data.stages[i].name,
+                       time_cycles_to_ns(tsc - previous) / NS_PER_US,
+                       time_cycles_to_ns(tsc - start) / NS_PER_US);
+    previous = tsc;
+  }
+
+  time_print_calibration();
+}
@@ -0,0 +1,14 @@
+#ifndef _BOOT_TIMELINE_H
+#define _BOOT_TIMELINE_H
+
+#include <kernel/kernel_common.h>
+
+// Records how long each boot stage takes. Marks only read the TSC, so they
+// can be taken before anything is initialized; they are converted to time
+// when printed, which needs the time module.
+
+// Records that `stage` (a string literal) just finished
+void boot_timeline_mark(const char *stage);
+void boot_timeline_print();
+
+#endif
@@ -0,0 +1,102 @@
+#include <kernel/datastructures/spsc_ring.h>
+
+#include <kernel/memory/kmalloc.h>
+#include <kernel/util.h>
+
+#define CACHE_LINE_SIZE 64
+
+// The indices increase forever and are masked on access, so full and empty
+// can be told apart without a flag. The producer only writes `tail` and the
+// consumer only writes `head`, which are padded (kmalloc() doesn't align to
+// cache lines) so they don't share one. Each side publishes its index with
+// release ordering after touching the slots, and reads the other side's with
+// acquire ordering before touching them.
+struct _SpscRing {
+  size_t head;
+  size_t cached_tail;  // Consumer's last view of `tail`
+  uint8_t padding1[CACHE_LINE_SIZE - 2 * sizeof(size_t)];
+
+  size_t tail;
+  size_t cached_head;  // Producer's last view of `head`
+  uint8_t padding2[CACHE_LINE_SIZE - 2 * sizeof(size_t)];
+
+  size_t mask;
+  QueueValue buffer[0];
+};
+
+SpscRing *spsc_ring_alloc(size_t capacity) {
+  assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+
+  SpscRing *ring = kmalloc(sizeof(SpscRing) + capacity * sizeof(QueueValue));
+  if (!ring) return NULL;
+
+  ring->head = ring->cached_tail = 0;
+  ring->tail = ring->cached_head = 0;
+  ring->mask = capacity - 1;
+
+  return ring;
+}
+
+// Free slots, from the producer's point of view. Only reloads `head` when the
+// cached value says the ring is too full.
+static size_t spsc_ring_free(SpscRing *ring, size_t tail, size_t wanted) {
+  size_t free = ring->mask + 1 - (tail - ring->cached_head);
+  if (free < wanted) {
+    ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    free = ring->mask + 1 - (tail - ring->cached_head);
+  }
+  return free;
+}
+
+// Same for the consumer
+static size_t spsc_ring_available(SpscRing *ring, size_t head, size_t wanted) {
+  size_t available = ring->cached_tail - head;
+  if (available < wanted) {
+    ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    available = ring->cached_tail - head;
+  }
+  return available;
+}
+
+bool spsc_ring_enqueue(SpscRing *ring, QueueValue element) {
+  return spsc_ring_enqueue_batch(ring, &element, 1) == 1;
+}
+
+size_t spsc_ring_enqueue_batch(SpscRing *ring, const QueueValue *elements,
+                               size_t count) {
+  const size_t tail = ring->tail;  // Only we write it
+  const size_t free = spsc_ring_free(ring, tail, count);
+  if (count > free) count = free;
+
+  for (size_t i = 0; i < count; ++i) {
+    ring->buffer[(tail + i) & ring->mask] = elements[i];
+  }
+
+  __atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+  return count;
+}
+
+bool spsc_ring_dequeue(SpscRing *ring, QueueValue *element) {
+  return spsc_ring_dequeue_batch(ring, element, 1) == 1;
+}
+
+size_t spsc_ring_dequeue_batch(SpscRing *ring, QueueValue *elements,
+                               size_t count) {
+  const size_t head = ring->head;  // Only we write it
+  const size_t available = spsc_ring_available(ring, head, count);
+  if (count > available) count = available;
+
+  for (size_t i = 0; i < count; ++i) {
+    elements[i] = ring->buffer[(head + i) & ring->mask];
+  }
+
+  __atomic_store_n(&ring->head, head + count, __ATOMIC_RELEASE);
+  return count;
+}
+
+size_t spsc_ring_count(SpscRing *ring) {
+  const size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - head;
+}
+
+size_t spsc_ring_capacity(SpscRing *ring) { return ring->mask + 1; }
@@ -0,0 +1,31 @@
+#include <kernel/kernel_common.h>
+#include <kernel/datastructures/queue.h>
+
+// Lock-free ring buffer for exactly one producer and one consumer, e.g. an
+// interrupt handler handing data to a thread. Neither side ever blocks or
+// disables interrupts. The capacity must be a power of two.
+
+#ifndef _SPSC_RING_H
+#define _SPSC_RING_H
+
+typedef struct _SpscRing SpscRing;
+
+SpscRing *spsc_ring_alloc(size_t capacity);
+
+// Producer side. Return false/the number of elements actually enqueued if the
+// ring is full.
+bool spsc_ring_enqueue(SpscRing *ring, QueueValue element);
+size_t spsc_ring_enqueue_batch(SpscRing *ring, const QueueValue *elements,
+                               size_t count);
+
+// Consumer side. Return false/the number of elements actually dequeued if the
+// ring is empty.
+bool spsc_ring_dequeue(SpscRing *ring, QueueValue *element);
+size_t spsc_ring_dequeue_batch(SpscRing *ring, QueueValue *elements,
+                               size_t count);
+
+// Exact for the consumer, a lower bound for anyone else
+size_t spsc_ring_count(SpscRing *ring);
+size_t spsc_ring_capacity(SpscRing *ring);
+
+#endif
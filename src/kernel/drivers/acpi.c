@@ -87,8 +87,11 @@ static bool acpica_enable() {
 ACPISDTHeader * acpi_locate_table(char *name) {
   ACPI_TABLE_HEADER *header;
   ACPI_STATUS status = AcpiGetTable(name, 1, &header);
-  if (status != AE_OK) text_output_printf("AcpiGetTable status: %d\n", status);
-  assert(status == AE_OK);
+  if (status == AE_NOT_FOUND) return NULL;  // Optional tables, e.g. HPET
+  if (status != AE_OK) {
+    text_output_printf("AcpiGetTable status: %d\n", status);
+    return NULL;
+  }
 
   return (ACPISDTHeader *)header;
 }
@@ -17,7 +17,7 @@ typedef struct {
 
 void acpi_init(void *xdsp_address);
 void acpi_enable_acpica();
-ACPISDTHeader * acpi_locate_table(char *name);
+ACPISDTHeader * acpi_locate_table(char *name);  // NULL if not present
 uint64_t acpi_xdsp_address();
 
 #endif
\ No newline at end of file
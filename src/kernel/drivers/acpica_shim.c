@@ -6,7 +6,7 @@
 
 #include <kernel/drivers/acpi.h>
 #include <kernel/drivers/interrupt.h>
-#include <kernel/drivers/timer.h>
+#include <kernel/drivers/time.h>
 #include <kernel/drivers/timer.h>
 #include <kernel/memory/kmalloc.h>
 #include <kernel/memory/virtual_memory.h>
@@ -60,15 +60,14 @@ ACPI_STATUS AcpiOsCreateLock(ACPI_SPINLOCK *out_handle) {
 
 void AcpiOsDeleteLock(ACPI_SPINLOCK handle) { kfree(handle); }
 
+// ACPICA takes these locks from its SCI handler too, so hold them with
+// interrupts disabled. The flags are whether interrupts were enabled.
 ACPI_CPU_FLAGS AcpiOsAcquireLock(ACPI_SPINLOCK handle) {
-  spinlock_acquire(handle);
-
-  return 0;
+  return spinlock_acquire_irqsave(handle);
 }
 
 void AcpiOsReleaseLock(ACPI_SPINLOCK handle, ACPI_CPU_FLAGS flags) {
-  (void)flags;
-  spinlock_release(handle);
+  spinlock_release_irqrestore(handle, flags != 0);
 }
 
 ACPI_STATUS AcpiOsCreateSemaphore(UINT32 max_units UNUSED, UINT32 initial_units,
@@ -91,7 +90,8 @@ ACPI_STATUS AcpiOsDeleteSemaphore(ACPI_SEMAPHORE handle) {
 
 ACPI_STATUS AcpiOsWaitSemaphore(ACPI_SEMAPHORE handle, UINT32 units,
                                 UINT16 timeout) {
-  if (semaphore_down(handle, units, timeout)) {
+  const int64_t timeout_ms = timeout == ACPI_WAIT_FOREVER ? -1 : timeout;
+  if (semaphore_down(handle, units, timeout_ms)) {
     return AE_OK;
   } else {
     return AE_TIME;
@@ -119,6 +119,9 @@ ACPI_STATUS AcpiOsExecute(ACPI_EXECUTE_TYPE type UNUSED,
   KernelThread *thread =
       thread_create((KernelThreadMain)function, context, 16, 2);
   if (!thread) return AE_BAD_PARAMETER;
+
+  // Deferred ACPI events (GPEs, notifies) are background work
+  thread_set_scheduling_class(thread, THREAD_CLASS_FAIR);
   thread_start(thread);
 
   text_output_printf("Started thread for function: 0x%x\n", function);
@@ -132,7 +135,7 @@ ACPI_THREAD_ID AcpiOsGetThreadId(void) {
 
 void AcpiOsSleep(UINT64 milliseconds) { timer_thread_sleep(milliseconds); }
 
-void AcpiOsStall(UINT32 microseconds) { timer_thread_stall(microseconds); }
+void AcpiOsStall(UINT32 microseconds) { time_delay_us(microseconds); }
 
 void *AcpiOsMapMemory(ACPI_PHYSICAL_ADDRESS where, ACPI_SIZE length UNUSED) {
   return (void *)where;
@@ -213,7 +216,7 @@ void AcpiOsWaitEventsComplete(void) { panic("AcpiOsWaitEventsComplete"); }
 
 UINT64 AcpiOsGetTimer(void) {
   // Return system time in 100-nanosecond units
-  return timer_ticks() * 10000000 / TIMER_FREQUENCY;
+  return time_now_ns() / 100;
 }
 
 ACPI_STATUS AcpiOsReadPciConfiguration(ACPI_PCI_ID *pci_id, UINT32 reg,
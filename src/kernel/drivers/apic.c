@@ -135,6 +135,18 @@ void apic_setup_local_timer(APICTimerDivider divider, uint8_t interrupt_vector,
   apic_write(APIC_TIMER_CCR_IDX, 0);
 }
 
+void apic_restart_local_timer(uint32_t initial_count) {
+  apic_write(APIC_TIMER_ICR_IDX, initial_count);
+}
+
+uint32_t apic_local_timer_count() { return apic_read(APIC_TIMER_CCR_IDX); }
+
+uint32_t apic_timer_divider_value(APICTimerDivider divider) {
+  // Bits 0, 1 and 3 hold log2(divider) - 1, wrapping around for 1
+  const uint32_t encoded = (divider & 0b11) | ((divider & 0b1000) >> 1);
+  return (1 << ((encoded + 1) & 0b111));
+}
+
 void apic_set_local_timer_masked(bool masked) {
   LVT lvt;
   lvt.ivalue = apic_read(APIC_TIMER_LVT_IDX);
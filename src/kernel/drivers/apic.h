@@ -25,6 +25,9 @@ void apic_send_eoi_if_necessary(uint8_t interrupt_vector);
 void apic_send_eoi();
 void apic_setup_local_timer(APICTimerDivider divider, uint8_t interrupt_vector, APICTimerMode mode, uint32_t initial_count);
 void apic_set_local_timer_masked(bool masked);
+void apic_restart_local_timer(uint32_t initial_count);  // Keeps the settings
+uint32_t apic_local_timer_count();  // Current count, counts down
+uint32_t apic_timer_divider_value(APICTimerDivider divider);
 void ioapic_map(uint8_t irq_index, uint8_t idt_index, bool level_triggered, bool active_low);
 
 #endif
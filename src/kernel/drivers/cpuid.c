@@ -7,9 +7,20 @@ static struct {
   char vendor_id[13];
   uint32_t max_calling_param;
   uint32_t signature;
+  uint32_t max_extended_param;
   uint64_t capabilities, extended_capabilities;
+  bool invariant_tsc;
+  uint64_t tsc_frequency;  // 0 if the CPU doesn't report it
+  uint64_t crystal_frequency;  // Same
 } cpuid_data;
 
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t registers[4]) {
+  __asm__("cpuid"
+          : "=a"(registers[0]), "=b"(registers[1]), "=c"(registers[2]),
+            "=d"(registers[3])
+          : "a"(leaf), "c"(subleaf));
+}
+
 void read_vendor_id() {
   uint32_t id[3] = {0};
   __asm__("cpuid"
@@ -39,19 +50,60 @@ void read_extended_capabilities() {
       ((uint64_t)capabilities2 << 32) | capabilities1;
 }
 
+void read_tsc_information() {
+  uint32_t registers[4];
+
+  cpuid(0x80000000, 0, registers);
+  cpuid_data.max_extended_param = registers[0];
+
+  // Invariant TSC: runs at a constant rate in every P-, C- and T-state
+  cpuid_data.invariant_tsc = false;
+  if (cpuid_data.max_extended_param >= 0x80000007) {
+    cpuid(0x80000007, 0, registers);
+    cpuid_data.invariant_tsc = (registers[3] & (1 << 8)) != 0;
+  }
+
+  // Leaf 0x15 gives the TSC/crystal clock ratio (EBX/EAX) and, on some CPUs,
+  // the crystal frequency (ECX). Without the latter, the TSC runs at the base
+  // frequency from leaf 0x16.
+  cpuid_data.tsc_frequency = 0;
+  cpuid_data.crystal_frequency = 0;
+  if (cpuid_data.max_calling_param < 0x15) return;
+
+  cpuid(0x15, 0, registers);
+  const uint32_t denominator = registers[0], numerator = registers[1];
+  if (denominator == 0 || numerator == 0) return;
+
+  cpuid_data.crystal_frequency = registers[2];
+  if (cpuid_data.crystal_frequency != 0) {
+    cpuid_data.tsc_frequency =
+        cpuid_data.crystal_frequency * numerator / denominator;
+  } else if (cpuid_data.max_calling_param >= 0x16) {
+    cpuid(0x16, 0, registers);
+    cpuid_data.tsc_frequency = (uint64_t)(registers[0] & 0xffff) * 1000000;
+  }
+}
+
 bool cpuid_has_capability(const enum CPUCapability capability) {
-  return (cpuid_data.capabilities & (1ULL << capability)) != 0;
+  return (cpuid_data.capabilities & capability) != 0;
 }
 
 bool cpuid_has_extended_capability(
     const enum CPUExtendedCapability capability) {
-  return (cpuid_data.extended_capabilities & (1ULL << capability)) != 0;
+  return (cpuid_data.extended_capabilities & capability) != 0;
 }
 
+bool cpuid_has_invariant_tsc() { return cpuid_data.invariant_tsc; }
+
+uint64_t cpuid_tsc_frequency() { return cpuid_data.tsc_frequency; }
+
+uint64_t cpuid_crystal_frequency() { return cpuid_data.crystal_frequency; }
+
 void cpuid_init() {
   read_vendor_id();
   read_capabilities();
   read_extended_capabilities();
+  read_tsc_information();
 
   REGISTER_MODULE("cpuid");
 }
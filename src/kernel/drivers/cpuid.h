@@ -7,6 +7,7 @@ enum CPUCapability {
   CPUID_CAP_TSC = 1ULL << 4,
   CPUID_CAP_APIC = 1ULL << 9,
   CPUID_CAP_SYSENTER = 1ULL << 11,
+  CPUID_CAP_PCID = 1ULL << (32 + 17),
   CPUID_CAP_XSAVE = 1ULL << (32 + 26),
   CPUID_CAP_RDRAND = 1ULL << (32 + 30),
 };
@@ -19,4 +20,11 @@ void cpuid_init();
 bool cpuid_has_capability(enum CPUCapability capability);
 bool cpuid_has_extended_capability(enum CPUExtendedCapability capability);
 
+bool cpuid_has_invariant_tsc();
+// TSC frequency in Hz as enumerated by leaves 0x15/0x16, 0 if not available
+uint64_t cpuid_tsc_frequency();
+// Core crystal clock frequency in Hz (leaf 0x15), 0 if not available. On CPUs
+// that report it, it also drives the local APIC timer.
+uint64_t cpuid_crystal_frequency();
+
 #endif
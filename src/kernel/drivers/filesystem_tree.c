@@ -1,34 +1,84 @@
 #include <kernel/drivers/filesystem_tree.h>
 #include <kernel/drivers/filesystems/mfs.h>
 #include <kernel/drivers/text_output.h>
+#include <kernel/memory/kmalloc.h>
+#include <kernel/threading/mutex/lock.h>
+#include <kernel/threading/rcu.h>
 
 #define MAX_FILESYSTEMS 10
 
+// What readers see. Updates replace the whole table and free the old one
+// after an RCU grace period.
+typedef struct {
+  RcuHead rcu;
+  size_t size;
+  Filesystem *filesystems[MAX_FILESYSTEMS];
+} FilesystemTable;
+
 static struct FilesystemTreeData {
+  // Storage for the filesystems, entries never move once allocated
   Filesystem filesystems[MAX_FILESYSTEMS];
-  size_t num_filesystems;
+  size_t num_allocated;
+
+  FilesystemTable *table;  // RCU protected, NULL while empty
+  Lock update_lock;        // Serializes writers
 } fs_tree_data;
 
-static FilesystemError add_filesystem(const char *const filesystem_id,
+static void free_table(RcuHead *head) {
+  kfree(container_of(head, FilesystemTable, rcu));
+}
+
+// Makes `filesystem` visible to readers. Must hold update_lock.
+static void publish_filesystem(Filesystem *filesystem) {
+  FilesystemTable *old_table = fs_tree_data.table;
+
+  FilesystemTable *new_table = kmalloc(sizeof(FilesystemTable));
+  assert(new_table);
+  new_table->size = 0;
+  if (old_table) {
+    for (size_t i = 0; i < old_table->size; ++i) {
+      new_table->filesystems[i] = old_table->filesystems[i];
+    }
+    new_table->size = old_table->size;
+  }
+  new_table->filesystems[new_table->size++] = filesystem;
+
+  rcu_assign_pointer(fs_tree_data.table, new_table);
+  if (old_table) call_rcu(&old_table->rcu, free_table);
+}
+
+static FilesystemError add_filesystem(Filesystem *new_filesystem,
+                                      const char *const filesystem_id,
                                       const void *initialization_data) {
-  assert(fs_tree_data.num_filesystems < MAX_FILESYSTEMS);
-  Filesystem *new_filesystem =
-      &fs_tree_data.filesystems[fs_tree_data.num_filesystems++];
   if (!filesystem_create(filesystem_id, new_filesystem)) {
     return FS_ERROR_NOT_FOUND;
   }
 
+  FilesystemError error =
+      new_filesystem->init(new_filesystem, initialization_data);
+  if (error != FS_ERROR_NONE) return error;
+
+  publish_filesystem(new_filesystem);
   text_output_printf("Adding filesystem to tree: %s at index %i\n",
-                     filesystem_id, fs_tree_data.num_filesystems - 1);
+                     filesystem_id, fs_tree_data.table->size - 1);
 
-  return new_filesystem->init(new_filesystem, initialization_data);
+  return FS_ERROR_NONE;
+}
+
+// Must hold update_lock
+static Filesystem *allocate_filesystem() {
+  assert(fs_tree_data.num_allocated < MAX_FILESYSTEMS);
+  return &fs_tree_data.filesystems[fs_tree_data.num_allocated++];
 }
 
 void filesystem_tree_init() {
   REQUIRE_MODULE("ahci");
   REQUIRE_MODULE("pci");
+  REQUIRE_MODULE("rcu");
 
-  fs_tree_data.num_filesystems = 0;
+  fs_tree_data.num_allocated = 0;
+  fs_tree_data.table = NULL;
+  lock_init(&fs_tree_data.update_lock);
 
   PCIDevice *device = pci_find_device(0x01, 0x06, 0x01);
   if (device == NULL || !device->has_driver) {
@@ -55,7 +105,9 @@ void filesystem_tree_init() {
                                                    .device_id = i};
       // TODO: Discover what type of FS is on the device and load that driver,
       // instead of always loading MFS_S.
-      add_filesystem("MFS_S", &initialization_data);
+      lock_acquire(&fs_tree_data.update_lock, -1);
+      add_filesystem(allocate_filesystem(), "MFS_S", &initialization_data);
+      lock_release(&fs_tree_data.update_lock);
     }
   }
 }
@@ -63,16 +115,31 @@ void filesystem_tree_init() {
 FilesystemError filesystem_tree_add(const char *const identifier,
                                     const void *initialization_data,
                                     Filesystem **filesystem) {
-  *filesystem = &fs_tree_data.filesystems[fs_tree_data.num_filesystems];
-  return add_filesystem(identifier, initialization_data);
+  lock_acquire(&fs_tree_data.update_lock, -1);
+  *filesystem = allocate_filesystem();
+  FilesystemError error =
+      add_filesystem(*filesystem, identifier, initialization_data);
+  lock_release(&fs_tree_data.update_lock);
+
+  return error;
 }
 
 Filesystem *filesystem_tree_get(size_t index) {
-  if (index >= fs_tree_data.num_filesystems) {
-    return NULL;
-  }
+  Filesystem *filesystem = NULL;
+
+  rcu_read_lock();
+  FilesystemTable *table = rcu_dereference(fs_tree_data.table);
+  if (table && index < table->size) filesystem = table->filesystems[index];
+  rcu_read_unlock();
 
-  return &fs_tree_data.filesystems[index];
+  return filesystem;
 }
 
-size_t filesystem_tree_size() { return fs_tree_data.num_filesystems; }
+size_t filesystem_tree_size() {
+  rcu_read_lock();
+  FilesystemTable *table = rcu_dereference(fs_tree_data.table);
+  const size_t size = table ? table->size : 0;
+  rcu_read_unlock();
+
+  return size;
+}
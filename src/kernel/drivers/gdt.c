@@ -20,7 +20,7 @@ static struct GDTEntry {
   uint8_t  is_32_bit:1;
   uint8_t  granularity:1; // If 1, limit is in pages, else in bytes
   uint8_t  base_high;         // The last 8 bits of the base.
-} __attribute__((packed)) GDT[5];
+} __attribute__((packed)) GDT[7];
 
 struct GDTR {
   uint16_t size;
@@ -88,9 +88,10 @@ static struct Stack ist_stacks[7];
 // Helper functions
 extern void gdt_flush(); // gdt.s
 
-static void set_kernel_gdt_entry(int index, bool is_code) {
+static void set_gdt_entry(int index, bool is_code, uint8_t ring) {
   memset(&GDT[index], 0, sizeof(GDT[index]));
   GDT[index].type = 1;
+  GDT[index].ring = ring;
   GDT[index].present = 1;
   GDT[index].read_write = 1;
   GDT[index].executable = is_code;
@@ -98,10 +99,11 @@ static void set_kernel_gdt_entry(int index, bool is_code) {
 }
 
 static void setup_tss(int index) {
-  // Fill TSS
+  // Fill TSS. Stacks grow down, so point at the end of each one. rsp0 is
+  // replaced by the kernel stack of every ring 3 thread that runs.
   uint64_t ring_stack_addresses[3];
   for (int i = 0; i < 3; ++i) {
-    ring_stack_addresses[i] = UNION_CAST(&ring_stacks[0].data, uint64_t);
+    ring_stack_addresses[i] = UNION_CAST(&ring_stacks[i + 1], uint64_t);
   }
   TSS.rsp0_low = ring_stack_addresses[0] & 0xFFFFFFFF;
   TSS.rsp0_high = (ring_stack_addresses[0] >> 32) & 0xFFFFFFFF;
@@ -112,7 +114,7 @@ static void setup_tss(int index) {
 
   uint64_t ist_stack_addresses[7];
   for (int i = 0; i < 7; ++i) {
-    ist_stack_addresses[i] = UNION_CAST(&ist_stacks[0].data, uint64_t);
+    ist_stack_addresses[i] = UNION_CAST(&ist_stacks[i + 1], uint64_t);
   }
   TSS.ist1_low = ist_stack_addresses[0] & 0xFFFFFFFF;
   TSS.ist1_high = (ist_stack_addresses[0] >> 32) & 0xFFFFFFFF;
@@ -151,9 +153,11 @@ static void setup_tss(int index) {
 void gdt_init() {
   // Setup GDT
   memset(&GDT[0], 0, sizeof(GDT[0])); // Null segment
-  set_kernel_gdt_entry(1, true); // Code segment
-  set_kernel_gdt_entry(2, false); // Data segment
-  setup_tss(3); // 16 bytes (two gdt_entries)
+  set_gdt_entry(1, true, 0); // Kernel code segment
+  set_gdt_entry(2, false, 0); // Kernel data segment
+  set_gdt_entry(3, false, 3); // User data segment
+  set_gdt_entry(4, true, 3); // User code segment
+  setup_tss(5); // 16 bytes (two gdt_entries)
 
   GDTR.size = sizeof(GDT) - 1;
   GDTR.address = (uint64_t)&GDT[0];
@@ -161,4 +165,9 @@ void gdt_init() {
   gdt_flush();
 
   REGISTER_MODULE("gdt");
-}
\ No newline at end of file
+}
+
+void gdt_set_kernel_stack(uint64_t rsp0) {
+  TSS.rsp0_low = rsp0 & 0xFFFFFFFF;
+  TSS.rsp0_high = (rsp0 >> 32) & 0xFFFFFFFF;
+}
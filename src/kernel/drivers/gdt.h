@@ -5,8 +5,18 @@
 
 #define GDT_KERNEL_CS 0x08
 #define GDT_KERNEL_DS 0x10
-#define GDT_TSS 0x18
+
+// SYSRET takes these from one base in the STAR MSR, the data segment has to
+// come right before the code segment (see syscall.c). Both include RPL 3.
+#define GDT_USER_DS (0x18 | 3)
+#define GDT_USER_CS (0x20 | 3)
+
+#define GDT_TSS 0x28
 
 void gdt_init();
 
+// The stack interrupts and system calls from ring 3 start on, set to the
+// kernel stack of the thread that is about to run
+void gdt_set_kernel_stack(uint64_t rsp0);
+
 #endif
\ No newline at end of file
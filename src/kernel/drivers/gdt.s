@@ -5,8 +5,8 @@
 gdt_flush:
   lgdt (GDTR)         # Load GDT
 
-  mov $0x18, %ax
-  ltr %ax             # Load TSS
+  mov $0x28, %ax
+  ltr %ax             # Load TSS (GDT_TSS)
 
   movq %rsp, %rax
   pushq $0x10         # New SS at 16-bytes in to GDT
@@ -31,3 +31,11 @@ void graphics_draw_pixel(int x, int y, uint32_t color) {
   graphics_data.frame_buffer_base[y * graphics_data.pixels_per_line + x] =
       color;
 }
+
+uint32_t graphics_width() {
+  return graphics_data.gop->Mode->Info->HorizontalResolution;
+}
+
+uint32_t graphics_height() {
+  return graphics_data.gop->Mode->Info->VerticalResolution;
+}
@@ -0,0 +1,245 @@
+#include <kernel/drivers/hpet.h>
+
+#include <kernel/drivers/acpi.h>
+#include <kernel/drivers/apic.h>
+#include <kernel/drivers/text_output.h>
+#include <kernel/drivers/time.h>
+#include <kernel/util.h>
+
+// Register offsets, in bytes
+#define HPET_CAPABILITIES 0x00
+#define HPET_CONFIGURATION 0x10
+#define HPET_INTERRUPT_STATUS 0x20
+#define HPET_MAIN_COUNTER 0xf0
+#define HPET_TIMER_CONFIGURATION(n) (0x100 + 0x20 * (n))
+#define HPET_TIMER_COMPARATOR(n) (0x108 + 0x20 * (n))
+
+// HPET_CAPABILITIES
+#define HPET_CAP_NUM_TIMERS(caps) ((((caps) >> 8) & 0x1f) + 1)
+#define HPET_CAP_COUNTER_64_BIT (1 << 13)
+#define HPET_CAP_LEGACY_REPLACEMENT (1 << 15)
+#define HPET_CAP_PERIOD(caps) ((caps) >> 32)  // In femtoseconds
+#define HPET_MAX_PERIOD 100000000             // 100ns, from the spec
+
+// HPET_CONFIGURATION
+#define HPET_CONF_ENABLE (1 << 0)
+#define HPET_CONF_LEGACY_REPLACEMENT (1 << 1)
+
+// HPET_TIMER_CONFIGURATION
+#define HPET_TIMER_LEVEL_TRIGGERED (1 << 1)
+#define HPET_TIMER_ENABLE (1 << 2)
+#define HPET_TIMER_PERIODIC_MODE (1 << 3)
+#define HPET_TIMER_PERIODIC_CAPABLE (1 << 4)
+#define HPET_TIMER_SET_VALUE (1 << 6)
+#define HPET_TIMER_32_BIT_MODE (1 << 8)
+#define HPET_TIMER_ROUTE_SHIFT 9
+#define HPET_TIMER_ROUTE_MASK (0x1f << HPET_TIMER_ROUTE_SHIFT)
+#define HPET_TIMER_FSB_ENABLE (1 << 14)
+#define HPET_TIMER_ROUTE_CAPABILITIES(conf) ((conf) >> 32)
+
+// With legacy replacement routing, timers 0 and 1 take over the PIT and RTC
+// I/O APIC inputs
+#define HPET_LEGACY_TIMER0_IRQ 2
+#define HPET_LEGACY_TIMER1_IRQ 8
+
+typedef struct {
+  uint8_t address_space_id;  // 0 for system memory
+  uint8_t register_bit_width;
+  uint8_t register_bit_offset;
+  uint8_t reserved;
+  uint64_t address;
+} __attribute__((packed)) GenericAddress;
+
+typedef struct {
+  ACPISDTHeader header;
+  uint32_t event_timer_block_id;
+  GenericAddress base_address;
+  uint8_t hpet_number;
+  uint16_t minimum_tick;
+  uint8_t page_protection;
+} __attribute__((packed)) HPETTable;
+
+static struct {
+  volatile uint8_t *base;
+  bool available;
+
+  uint64_t frequency;
+  uint32_t num_timers;
+  bool legacy_replacement_capable, legacy_replacement_enabled;
+  uint64_t minimum_ticks;  // Smallest safe one-shot delay
+} hpet_data;
+
+static uint64_t hpet_read(uint32_t offset) {
+  return *(volatile uint64_t *)(hpet_data.base + offset);
+}
+
+static void hpet_write(uint32_t offset, uint64_t value) {
+  *(volatile uint64_t *)(hpet_data.base + offset) = value;
+}
+
+static void hpet_set_enabled(bool enabled) {
+  uint64_t configuration = hpet_read(HPET_CONFIGURATION);
+  if (enabled) {
+    configuration |= HPET_CONF_ENABLE;
+  } else {
+    configuration &= ~HPET_CONF_ENABLE;
+  }
+  hpet_write(HPET_CONFIGURATION, configuration);
+}
+
+static uint64_t ns_to_hpet_ticks(uint64_t nanoseconds) {
+  return nanoseconds / NS_PER_SEC * hpet_data.frequency +
+         nanoseconds % NS_PER_SEC * hpet_data.frequency / NS_PER_SEC;
+}
+
+void hpet_init() {
+  REQUIRE_MODULE("acpi_early");
+  REQUIRE_MODULE("apic");
+
+  hpet_data.available = false;
+
+  const HPETTable *table = (HPETTable *)acpi_locate_table("HPET");
+  if (!table) return;
+  if (table->base_address.address_space_id != 0) {
+    text_output_printf("WARNING: HPET is not memory mapped, not using it.\n");
+    return;
+  }
+
+  // Like the APICs, the registers are in the identity mapped low 4GB
+  hpet_data.base = (volatile uint8_t *)(intptr_t)table->base_address.address;
+
+  const uint64_t capabilities = hpet_read(HPET_CAPABILITIES);
+  const uint64_t period = HPET_CAP_PERIOD(capabilities);
+  if (period == 0 || period > HPET_MAX_PERIOD) return;
+
+  // A 32 bit counter wraps around in a few minutes, the PIT will do
+  if (!(capabilities & HPET_CAP_COUNTER_64_BIT)) {
+    text_output_printf("WARNING: HPET counter is 32 bits, not using it.\n");
+    return;
+  }
+
+  hpet_data.frequency = 1000000000000000ULL / period;
+  hpet_data.num_timers = HPET_CAP_NUM_TIMERS(capabilities);
+  hpet_data.legacy_replacement_capable =
+      (capabilities & HPET_CAP_LEGACY_REPLACEMENT) != 0;
+  hpet_data.legacy_replacement_enabled = false;
+  hpet_data.minimum_ticks = table->minimum_tick ? table->minimum_tick : 1;
+
+  // Start from a known state: every timer off, legacy routing off, counter
+  // at 0
+  hpet_write(HPET_CONFIGURATION, hpet_read(HPET_CONFIGURATION) &
+                                     ~HPET_CONF_LEGACY_REPLACEMENT);
+  hpet_set_enabled(false);
+  for (uint32_t i = 0; i < hpet_data.num_timers; ++i) {
+    const uint32_t offset = HPET_TIMER_CONFIGURATION(i);
+    hpet_write(offset, hpet_read(offset) &
+                           ~(HPET_TIMER_ENABLE | HPET_TIMER_FSB_ENABLE));
+  }
+  hpet_write(HPET_INTERRUPT_STATUS, hpet_read(HPET_INTERRUPT_STATUS));
+  hpet_write(HPET_MAIN_COUNTER, 0);
+  hpet_set_enabled(true);
+
+  hpet_data.available = true;
+
+  REGISTER_MODULE("hpet");
+}
+
+bool hpet_available() { return hpet_data.available; }
+
+uint64_t hpet_counter() { return hpet_read(HPET_MAIN_COUNTER); }
+
+uint64_t hpet_frequency() { return hpet_data.frequency; }
+
+uint32_t hpet_num_timers() { return hpet_data.num_timers; }
+
+bool hpet_set_legacy_replacement(bool enabled) {
+  assert(hpet_data.available);
+  if (enabled && !hpet_data.legacy_replacement_capable) return false;
+
+  uint64_t configuration = hpet_read(HPET_CONFIGURATION);
+  if (enabled) {
+    configuration |= HPET_CONF_LEGACY_REPLACEMENT;
+  } else {
+    configuration &= ~HPET_CONF_LEGACY_REPLACEMENT;
+  }
+  hpet_write(HPET_CONFIGURATION, configuration);
+  hpet_data.legacy_replacement_enabled = enabled;
+
+  return true;
+}
+
+// Returns the I/O APIC input `timer` should use, -1 if there's none
+static int hpet_timer_route(uint32_t timer, uint64_t configuration) {
+  // Timers 0 and 1 are wired to the legacy inputs while legacy replacement
+  // is on, whatever their route says
+  if (timer < 2 && hpet_data.legacy_replacement_enabled) {
+    return timer == 0 ? HPET_LEGACY_TIMER0_IRQ : HPET_LEGACY_TIMER1_IRQ;
+  }
+
+  const uint32_t routes = HPET_TIMER_ROUTE_CAPABILITIES(configuration);
+  if (routes == 0) return -1;
+  return 31 - __builtin_clz(routes);
+}
+
+bool hpet_timer_start(uint32_t timer, uint8_t interrupt_vector,
+                      HPETTimerMode mode, uint64_t nanoseconds) {
+  assert(hpet_data.available);
+  assert(timer < hpet_data.num_timers);
+
+  const uint32_t configuration_offset = HPET_TIMER_CONFIGURATION(timer);
+  uint64_t configuration = hpet_read(configuration_offset);
+
+  if (mode == HPET_TIMER_PERIODIC &&
+      !(configuration & HPET_TIMER_PERIODIC_CAPABLE)) {
+    return false;
+  }
+
+  const int route = hpet_timer_route(timer, configuration);
+  if (route < 0) return false;
+
+  uint64_t ticks = ns_to_hpet_ticks(nanoseconds);
+  if (ticks < hpet_data.minimum_ticks) ticks = hpet_data.minimum_ticks;
+
+  configuration &=
+      ~(HPET_TIMER_LEVEL_TRIGGERED | HPET_TIMER_ENABLE |
+        HPET_TIMER_PERIODIC_MODE | HPET_TIMER_SET_VALUE |
+        HPET_TIMER_32_BIT_MODE | HPET_TIMER_ROUTE_MASK | HPET_TIMER_FSB_ENABLE);
+  configuration |= (uint64_t)route << HPET_TIMER_ROUTE_SHIFT;
+  hpet_write(configuration_offset, configuration);
+
+  ioapic_map(route, interrupt_vector, false, false);
+
+  if (mode == HPET_TIMER_PERIODIC) {
+    // The first comparator write sets the first deadline and the second one
+    // the period. The counter is stopped so it can't pass the deadline in
+    // between.
+    hpet_set_enabled(false);
+    hpet_write(configuration_offset, configuration | HPET_TIMER_ENABLE |
+                                         HPET_TIMER_PERIODIC_MODE |
+                                         HPET_TIMER_SET_VALUE);
+    hpet_write(HPET_TIMER_COMPARATOR(timer), hpet_counter() + ticks);
+    hpet_write(HPET_TIMER_COMPARATOR(timer), ticks);
+    hpet_set_enabled(true);
+  } else {
+    hpet_write(configuration_offset, configuration | HPET_TIMER_ENABLE);
+
+    // The comparator only fires when the counter matches it, so if the
+    // counter went past the deadline while it was being written, the
+    // interrupt would never come. Push it back until it's in the future.
+    while (true) {
+      const uint64_t deadline = hpet_counter() + ticks;
+      hpet_write(HPET_TIMER_COMPARATOR(timer), deadline);
+      if ((int64_t)(deadline - hpet_counter()) > 0) break;
+      ticks *= 2;
+    }
+  }
+
+  return true;
+}
+
+void hpet_timer_stop(uint32_t timer) {
+  assert(timer < hpet_data.num_timers);
+
+  const uint32_t offset = HPET_TIMER_CONFIGURATION(timer);
+  hpet_write(offset, hpet_read(offset) & ~HPET_TIMER_ENABLE);
+}
@@ -0,0 +1,35 @@
+#include <kernel/kernel_common.h>
+
+#ifndef _HPET_H
+#define _HPET_H
+
+// High Precision Event Timer. The main counter is a monotonic clock running
+// at hpet_frequency() (at least 10MHz), and each timer has a comparator that
+// can raise one-shot or periodic interrupts.
+
+typedef enum {
+  HPET_TIMER_ONE_SHOT = 0,
+  HPET_TIMER_PERIODIC = 1
+} HPETTimerMode;
+
+void hpet_init();
+bool hpet_available();  // False if there's no usable HPET, nothing else works
+
+uint64_t hpet_counter();
+uint64_t hpet_frequency();  // In Hz
+uint32_t hpet_num_timers();
+
+// Legacy replacement routing disconnects the PIT and the RTC from I/O APIC
+// inputs 2 and 8 and wires timers 0 and 1 there instead. Off after
+// hpet_init(), returns false if the HPET can't do it.
+bool hpet_set_legacy_replacement(bool enabled);
+
+// Makes `timer` raise `interrupt_vector` after `nanoseconds`, and every
+// `nanoseconds` after that in periodic mode. The handler has to be registered
+// by the caller. Returns false if the timer can't do it (e.g. periodic mode
+// isn't supported).
+bool hpet_timer_start(uint32_t timer, uint8_t interrupt_vector,
+                      HPETTimerMode mode, uint64_t nanoseconds);
+void hpet_timer_stop(uint32_t timer);
+
+#endif
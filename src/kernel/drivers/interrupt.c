@@ -3,6 +3,7 @@
 #include <kernel/drivers/gdt.h>
 #include <kernel/drivers/interrupt.h>
 #include <kernel/drivers/text_output.h>
+#include <kernel/threading/scheduler.h>
 #include <kernel/util.h>
 
 enum IDTDescriptorType { INTERRUPT_GATE = 0b01110, TRAP_GATE = 0b01111 };
@@ -26,7 +27,25 @@ static struct IDTR {
   uint64_t address;
 } __attribute__((packed)) IDTR;
 
-static void (*interrupts_handlers[256])(int);
+// What each vector runs. Whether it needs an EOI is decided when it is
+// registered, so the common path doesn't have to ask the APIC.
+static struct InterruptVector {
+  InterruptHandler handler;
+  void *context;
+  uint32_t flags;
+  bool allocated;  // Fixed or handed out by irq_alloc_vector()
+} interrupt_vectors[256];
+
+// Number of handlers currently running on this CPU
+static volatile uint32_t interrupt_nesting = 0;
+
+// Time spent inside each handler. Handlers run with interrupts disabled, so
+// this is also how long each vector keeps interrupts off.
+static struct InterruptStatistics {
+  uint64_t count;
+  uint64_t total_cycles;
+  uint64_t max_cycles;
+} interrupt_statistics[256];
 
 // Helper functions
 static void set_idt_entry(int index, uint64_t isr_address,
@@ -42,78 +61,91 @@ static void set_idt_entry(int index, uint64_t isr_address,
   IDT[index].present = 1;
 }
 
+// Records a handler of vector `num` that started at `start` (a TSC value).
+// Also called by scheduler_timer_isr(), which doesn't go through isr_common().
+void interrupt_account(uint64_t num, uint64_t start) {
+  const uint64_t cycles = read_tsc() - start;
+  struct InterruptStatistics *statistics = &interrupt_statistics[num];
+  statistics->count++;
+  statistics->total_cycles += cycles;
+  if (cycles > statistics->max_cycles) statistics->max_cycles = cycles;
+
+  // IRQs come in through interrupt gates, so this is time with interrupts off
+  // that cli() never sees. The site is the vector's entry point.
+  if (num >= 32) {
+    const struct IDTDescriptor *entry = &IDT[num];
+    const uint64_t site = (uint64_t)entry->offset_high << 32 |
+                          (uint64_t)entry->offset_middle << 16 |
+                          entry->offset_low;
+    interrupts_off_record(site, cycles);
+  }
+}
+
 void isr_common(uint64_t num, uint64_t error_code) {
-  interrupts_handlers[num](error_code);
+  const uint64_t start = read_tsc();
+
+  const struct InterruptVector *vector = &interrupt_vectors[num];
+  interrupt_nesting++;
+  vector->handler(vector->context, error_code);
+  if (vector->flags & INTERRUPT_EOI) apic_send_eoi();
+  interrupt_nesting--;
+
+  interrupt_account(num, start);
+
+  // Exceptions can happen with interrupts disabled, so only run threads woken
+  // by an IRQ handler right away.
+  if (num >= 32) scheduler_interrupt_exit();
+}
+
+bool interrupt_in_handler() { return interrupt_nesting > 0; }
+
+// Vectors nothing was registered for
+static void interrupt_unhandled(void *context, uint64_t error_code) {
+  const uint64_t num = (uint64_t)context;
+  if (num < 32) {
+    panic("\nUnhandled exception %lu! Error Code: 0x%lx\n", num, error_code);
+  }
+
+  // Could be an IRQ nobody claimed or a spurious interrupt, only the first
+  // needs an EOI
   apic_send_eoi_if_necessary(num);
 }
 
-extern void isr0();
-extern void isr1();
-extern void isr2();
-extern void isr3();
-extern void isr4();
-extern void isr5();
-extern void isr6();
-extern void isr7();
-extern void isr8();
-extern void isr9();
-extern void isr10();
-extern void isr11();
-extern void isr12();
-extern void isr13();
-extern void isr14();
-extern void isr16();
-extern void isr17();
-extern void isr18();
-extern void isr19();
-extern void isr20();
-extern void isr30();
-// TODO: Figure out how to not special case this here
-extern void scheduler_timer_isr();  // We have to handle this separately
-extern void isr35();
-extern void isr36();
-extern void isr37();
-extern void isr39();
+static void interrupt_set_vector(int index, InterruptHandler handler,
+                                 void *context, uint32_t flags) {
+  bool interrupts_enabled = interrupts_status();
+  cli();
+
+  interrupt_vectors[index].handler = handler;
+  interrupt_vectors[index].context = context;
+  interrupt_vectors[index].flags = flags;
+
+  // Only re-enable interrupts if they were enabled before
+  if (interrupts_enabled) sti();
+}
+
+extern const uint64_t isr_stubs[256];  // interrupt.s
+extern void scheduler_timer_isr();  // Saves the thread itself (scheduler.s)
+extern char scheduler_timer_iv[];  // Its address is the vector scheduler.s uses
 
 // Public functions
 void interrupt_init() {
   REQUIRE_MODULE("gdt");
   REQUIRE_MODULE("apic");
 
-  // Exceptions (trap gates)
-  set_idt_entry(0, (uint64_t)isr0, TRAP_GATE);
-  set_idt_entry(1, (uint64_t)isr1, TRAP_GATE);
-  set_idt_entry(2, (uint64_t)isr2, TRAP_GATE);
-  set_idt_entry(3, (uint64_t)isr3, TRAP_GATE);
-  set_idt_entry(4, (uint64_t)isr4, TRAP_GATE);
-  set_idt_entry(5, (uint64_t)isr5, TRAP_GATE);
-  set_idt_entry(6, (uint64_t)isr6, TRAP_GATE);
-  set_idt_entry(7, (uint64_t)isr7, TRAP_GATE);
-  set_idt_entry(8, (uint64_t)isr8, TRAP_GATE);
-  set_idt_entry(9, (uint64_t)isr9, TRAP_GATE);
-  set_idt_entry(10, (uint64_t)isr10, TRAP_GATE);
-  set_idt_entry(11, (uint64_t)isr11, TRAP_GATE);
-  set_idt_entry(12, (uint64_t)isr12, TRAP_GATE);
-  set_idt_entry(13, (uint64_t)isr13, TRAP_GATE);
-  set_idt_entry(14, (uint64_t)isr14, TRAP_GATE);
-  set_idt_entry(16, (uint64_t)isr16, TRAP_GATE);
-  set_idt_entry(17, (uint64_t)isr17, TRAP_GATE);
-  set_idt_entry(18, (uint64_t)isr18, TRAP_GATE);
-  set_idt_entry(19, (uint64_t)isr19, TRAP_GATE);
-  set_idt_entry(20, (uint64_t)isr20, TRAP_GATE);
-  set_idt_entry(30, (uint64_t)isr30, TRAP_GATE);
-
-  // IRQs (interrupt gates)
+  // Exceptions are trap gates, IRQs interrupt gates
+  for (int i = 0; i < 256; ++i) {
+    interrupt_vectors[i].handler = interrupt_unhandled;
+    interrupt_vectors[i].context = (void *)(uint64_t)i;
+    interrupt_vectors[i].flags = 0;
+    interrupt_vectors[i].allocated = i < IRQ_FIRST_DYNAMIC_IV ||
+                                     i > IRQ_LAST_DYNAMIC_IV;
+    set_idt_entry(i, isr_stubs[i], i < 32 ? TRAP_GATE : INTERRUPT_GATE);
+  }
+
+  assert((uint64_t)scheduler_timer_iv == SCHEDULER_TIMER_IV);
   set_idt_entry(SCHEDULER_TIMER_IV, (uint64_t)scheduler_timer_isr,
-                INTERRUPT_GATE);  // Local APIC timer (scheduler)
-
-  set_idt_entry(KEYBOARD_IV, (uint64_t)isr35, INTERRUPT_GATE);   // Keyboard
-  set_idt_entry(PIC_TIMER_IV, (uint64_t)isr36, INTERRUPT_GATE);  // PIC timer
-  set_idt_entry(PCI_IV, (uint64_t)isr37, INTERRUPT_GATE);        // PCI ISR
-
-  set_idt_entry(LOCAL_APIC_CALIBRATION_IV, (uint64_t)isr39,
-                INTERRUPT_GATE);  // Local APIC timer (calibration)
-  // Something is weird about IV 38...
+                INTERRUPT_GATE);
 
   IDTR.size = sizeof(IDT) - 1;
   IDTR.address = (uint64_t)&IDT[0];
@@ -123,8 +155,53 @@ void interrupt_init() {
   REGISTER_MODULE("interrupt");
 }
 
-void interrupt_register_handler(int index, void (*handler)()) {
-  if (index < 0 || index >= 256) return;
+void interrupt_register_handler(int index, InterruptHandler handler,
+                                void *context, uint32_t flags) {
+  assert(index >= 0 && index < 256);
+  assert(index < IRQ_FIRST_DYNAMIC_IV || index > IRQ_LAST_DYNAMIC_IV);
+  assert(index != SCHEDULER_TIMER_IV);
+
+  interrupt_set_vector(index, handler, context, flags);
+}
+
+int irq_alloc_vector(InterruptHandler handler, void *context, uint32_t flags) {
+  bool interrupts_enabled = interrupts_status();
+  cli();
+
+  int vector = -1;
+  for (int i = IRQ_FIRST_DYNAMIC_IV; i <= IRQ_LAST_DYNAMIC_IV; ++i) {
+    if (!interrupt_vectors[i].allocated) {
+      interrupt_vectors[i].allocated = true;
+      vector = i;
+      break;
+    }
+  }
+
+  // Only re-enable interrupts if they were enabled before
+  if (interrupts_enabled) sti();
+
+  if (vector >= 0) interrupt_set_vector(vector, handler, context, flags);
+  return vector;
+}
+
+void irq_free_vector(int vector) {
+  assert(vector >= IRQ_FIRST_DYNAMIC_IV && vector <= IRQ_LAST_DYNAMIC_IV);
+  assert(interrupt_vectors[vector].allocated);
+
+  interrupt_set_vector(vector, interrupt_unhandled, (void *)(uint64_t)vector,
+                       0);
+  interrupt_vectors[vector].allocated = false;
+}
 
-  interrupts_handlers[index] = handler;
+void interrupt_print_statistics() {
+  text_output_printf("Interrupt handler cycles (interrupts off):\n");
+  for (int i = 0; i < 256; ++i) {
+    const struct InterruptStatistics *statistics = &interrupt_statistics[i];
+    if (statistics->count == 0) continue;
+
+    text_output_printf("  IV %d: count %lu, avg %lu, max %lu\n", i,
+                       statistics->count,
+                       statistics->total_cycles / statistics->count,
+                       statistics->max_cycles);
+  }
 }
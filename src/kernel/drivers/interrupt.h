@@ -3,14 +3,34 @@
 #ifndef _INTERRUPTS_H
 #define _INTERRUPTS_H
 
+// Fixed vectors, everything from IRQ_FIRST_DYNAMIC_IV up to
+// IRQ_LAST_DYNAMIC_IV is handed out by irq_alloc_vector()
 #define SCHEDULER_TIMER_IV 33
-#define KEYBOARD_IV 35
-#define PIC_TIMER_IV 36
-#define PCI_IV 37
-// Something is weird about IV 38...
 #define LOCAL_APIC_CALIBRATION_IV 39
+#define IRQ_FIRST_DYNAMIC_IV 48
+#define IRQ_LAST_DYNAMIC_IV 0xdf  // The legacy PIC is remapped above (apic.c)
+
+// `error_code` is 0 for vectors that don't have one
+typedef void (*InterruptHandler)(void *context, uint64_t error_code);
+
+// Registration flags
+#define INTERRUPT_EOI (1 << 0)  // Send the local APIC an EOI after the handler
 
 void interrupt_init();
-void interrupt_register_handler(int index, void (*handler)(int));
+
+// For exceptions and the fixed vectors. Vectors without a handler panic if
+// they are exceptions and are acknowledged the slow way otherwise.
+void interrupt_register_handler(int index, InterruptHandler handler,
+                                void *context, uint32_t flags);
+
+// Returns a free vector that calls `handler`, or -1 if there is none.
+// Interrupts routed through the APIC need INTERRUPT_EOI.
+int irq_alloc_vector(InterruptHandler handler, void *context, uint32_t flags);
+
+// The source must not raise the vector anymore
+void irq_free_vector(int vector);
+
+void interrupt_print_statistics();
+bool interrupt_in_handler();
 
 #endif
@@ -1,62 +1,57 @@
 .include "../macros.s"
 
-.extern interrupts_handlers
 .extern isr_common
 
-.macro isr_noerror num 
-.globl isr\num
-isr\num:
-  save_context
-
-  # TODO: Inline the isr_common call
-  movq $0, %rsi
-  movq $\num, %rdi
-  call isr_common
-
-  restore_context
+.altmacro
+
+# Every stub leaves the same frame for isr_entry: the vector on top of an
+# error code, pushed by the CPU for the exceptions that have one and a dummy 0
+# for everything else. Invalid opcode gets the faulting RIP instead.
+.macro isr_stub num
+isr_stub_\num:
+  .if (\num == 8) || (\num >= 10 && \num <= 14) || (\num == 17)
+  .elseif (\num == 21) || (\num == 29) || (\num == 30)
+  .elseif \num == 6
+    pushq (%rsp)
+  .else
+    pushq $0
+  .endif
+  pushq $\num
+  jmp   isr_entry
+.endm
 
-  iretq
+.macro isr_stub_address num
+  .quad isr_stub_\num
 .endm
 
-.macro isr_error num 
-.globl isr\num
-isr\num:
+.text
+
+isr_entry:
   save_context
 
-  # TODO: Inline the isr_common call
-  movq 128(%rsp), %rsi # Note, if you add 8 to the offset, you get the saved RIP (if there's an error)
-  movq $\num, %rdi
-  call isr_common
+  # isr_common(vector, error_code)
+  movq  120(%rsp), %rdi
+  movq  128(%rsp), %rsi
+  call  isr_common
 
   restore_context
 
+  addq  $16, %rsp  # Vector and error code
   iretq
-.endm
 
-# Actual isr definitions
-isr_noerror 0
-isr_noerror 1
-isr_noerror 2
-isr_noerror 3
-isr_noerror 4
-isr_noerror 5
-isr_error 6
-isr_noerror 7
-isr_error 8
-isr_noerror 9
-isr_error 10
-isr_error 11
-isr_error 12
-isr_error 13
-isr_error 14
-isr_noerror 16
-isr_error 17
-isr_noerror 18
-isr_noerror 19
-isr_noerror 20
-isr_noerror 30
-# ISRs 33&34 are handled by the scheduler 
-isr_noerror 35
-isr_noerror 36
-isr_noerror 37
-isr_noerror 39
+.set vector, 0
+.rept 256
+  isr_stub %vector
+  .set vector, vector + 1
+.endr
+
+.data
+
+# Entry point of every vector, for the IDT (interrupt.c)
+.globl isr_stubs
+isr_stubs:
+.set vector, 0
+.rept 256
+  isr_stub_address %vector
+  .set vector, vector + 1
+.endr
@@ -4,10 +4,13 @@
 #include <kernel/drivers/text_output.h>
 #include <kernel/drivers/apic.h>
 #include <kernel/drivers/interrupt.h>
+#include <kernel/drivers/timer.h>
 
 #include <kernel/threading/mutex/lock.h>
+#include <kernel/threading/scheduler.h>
+#include <kernel/threading/wait_queue.h>
 
-#include <kernel/datastructures/queue.h>
+#include <kernel/datastructures/spsc_ring.h>
 
 #include <limits.h>
 
@@ -15,7 +18,13 @@
 
 static struct {
   bool shift_down;
-  Queue *input_queue;
+
+  // keyboard_isr() is the only producer and the reading thread the only
+  // consumer
+  SpscRing *input_ring;
+  uint64_t num_dropped;  // Characters lost because nobody was reading
+  WaitQueue readers;     // Woken by keyboard_isr()
+
   Lock lock;
 } keyboard_data;
 
@@ -47,22 +56,63 @@ void keyboard_isr() {
 
       QueueValue v = { .i = pressed_char };
 
-      queue_enqueue(keyboard_data.input_queue, v, true);
+      if (!spsc_ring_enqueue(keyboard_data.input_ring, v)) {
+        keyboard_data.num_dropped++;
+      }
+
+      // Interrupts are disabled in here, so a reader can't be between
+      // finding the ring empty and going to sleep
+      wait_queue_wake_all(&keyboard_data.readers);
     }
   }
 }
 
-int keyboard_controller_read_char(bool block) {
-  assert(!block); // Not implemented yet
+void keyboard_controller_print_statistics() {
+  text_output_printf("Keyboard: %lu characters buffered, %lu dropped\n",
+                     spsc_ring_count(keyboard_data.input_ring),
+                     keyboard_data.num_dropped);
+}
+
+bool keyboard_controller_poll() {
+  return spsc_ring_count(keyboard_data.input_ring) > 0;
+}
+
+int keyboard_controller_read_char_timeout(int64_t timeout) {
+  bool interrupts_enabled = interrupts_status();
+  cli();
+
+  // keyboard_isr() wakes every reader, another one may have taken the
+  // character by the time we run. Keep waiting until the deadline, which is
+  // only computed once.
+  const uint64_t deadline =
+      timeout < 0 ? UINT64_MAX
+                  : timer_ticks() + timeout * TIMER_FREQUENCY / 1000;
+
+  QueueValue v;
+  bool have_char;
+  while (!(have_char = spsc_ring_dequeue(keyboard_data.input_ring, &v))) {
+    // Milliseconds left, rounded up so we don't give up early
+    int64_t remaining = -1;
+    if (deadline != UINT64_MAX) {
+      const uint64_t now = timer_ticks();
+      if (now >= deadline) break;
+      remaining =
+          ((deadline - now) * 1000 + TIMER_FREQUENCY - 1) / TIMER_FREQUENCY;
+    }
 
-  int return_value = INT_MIN;
-  if (queue_count(keyboard_data.input_queue) > 0) {
-    QueueValue v = queue_dequeue(keyboard_data.input_queue);
-    return_value = v.i;
+    WaitQueueEntry entry;
+    wait_queue_entry_init(&entry, scheduler_current_thread(), 0);
+    if (!wait_queue_wait(&keyboard_data.readers, &entry, remaining)) break;
   }
 
-  return return_value;
+  // Only re-enable interrupts if they were enabled before
+  if (interrupts_enabled) sti();
 
+  return have_char ? v.i : INT_MIN;
+}
+
+int keyboard_controller_read_char(bool block) {
+  return keyboard_controller_read_char_timeout(block ? -1 : 0);
 }
 
 void keyboard_controller_init() {
@@ -70,12 +120,15 @@ void keyboard_controller_init() {
   REQUIRE_MODULE("text_output");
 
   keyboard_data.shift_down = false;
-  keyboard_data.input_queue = queue_alloc(1024);
+  keyboard_data.input_ring = spsc_ring_alloc(1024);
+  keyboard_data.num_dropped = 0;
+  wait_queue_init(&keyboard_data.readers);
   lock_init(&keyboard_data.lock);
 
   // Map keyboard interrupt
-  interrupt_register_handler(KEYBOARD_IV, keyboard_isr);
-  ioapic_map(KEYBOARD_IRQ, KEYBOARD_IV, false, false);
+  const int vector = irq_alloc_vector(keyboard_isr, NULL, INTERRUPT_EOI);
+  assert(vector >= 0);
+  ioapic_map(KEYBOARD_IRQ, vector, false, false);
 
   REGISTER_MODULE("keyboard_controller");
 }
@@ -4,6 +4,14 @@
 #define _KEYBOARD_CONTROLLER_H
 
 void keyboard_controller_init();
+
+// Input is buffered in a single consumer ring, so only one thread may read.
+// Reads return INT_MIN if there's no character.
+bool keyboard_controller_poll();  // True if a read wouldn't block
 int keyboard_controller_read_char(bool block);
+// Timeout in milliseconds, -1 means wait forever and 0 means don't wait
+int keyboard_controller_read_char_timeout(int64_t timeout);
+
+void keyboard_controller_print_statistics();
 
 #endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <kernel/drivers/interrupt.h>
 #include <kernel/drivers/pci.h>
 #include <kernel/drivers/text_output.h>
+#include <kernel/threading/mutex/lock.h>
 
 #include <acpi.h>
 
@@ -26,25 +27,36 @@ typedef union {
 
 } PCIConfigAddress;
 
+// The device, interrupt device and driver tables are append-only. Writers
+// (serialized by update_lock) fill in an entry and then publish it by
+// incrementing the count with release semantics, so readers only need to load
+// the count with acquire semantics and never take a lock.
 static struct {
   PCIDevice devices[PCI_MAX_DEVICES];
   int num_devices;
 
+  // Devices whose driver needs to see PCI interrupts, so pci_isr() doesn't
+  // have to poll every device
+  PCIDevice *interrupt_devices[PCI_MAX_DEVICES];
+  int num_interrupt_devices;
+  int interrupt_vector;  // Shared by every device
+
   PCIDeviceDriver drivers[PCI_MAX_DRIVERS];
   int num_drivers;
 
+  Lock update_lock;
+
   // TODO: Support more than just bus 0
   uint32_t irq_routing_table[PCI_MAX_SLOT_NUM][4];
 } pci_data;
 
 // TODO: Try to set up MSI again
 static void pci_isr() {
-  for (int i = 0; i < pci_data.num_devices; ++i) {
-    PCIDevice *device = &pci_data.devices[i];
-
-    if (device->has_interrupts && device->has_driver) {
-      device->driver.isr(&device->driver);
-    }
+  const int num_interrupt_devices =
+      __atomic_load_n(&pci_data.num_interrupt_devices, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < num_interrupt_devices; ++i) {
+    PCIDevice *device = pci_data.interrupt_devices[i];
+    device->driver.isr(&device->driver);
   }
 }
 
@@ -130,7 +142,9 @@ UNUSED static void print_pci_device(PCIDevice *device) {
 }
 
 static PCIDeviceDriver *driver_for_device(PCIDevice *device) {
-  for (int i = 0; i < pci_data.num_drivers; ++i) {
+  const int num_drivers =
+      __atomic_load_n(&pci_data.num_drivers, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < num_drivers; ++i) {
     PCIDeviceDriver *driver = &pci_data.drivers[i];
     if (driver->class_code == device->class_code &&
         driver->subclass == device->subclass &&
@@ -146,7 +160,8 @@ static PCIDevice *add_pci_device(uint8_t bus, uint8_t slot, uint8_t function) {
   uint32_t vendor_word =
       PCI_HEADER_READ_FIELD_WORD(bus, slot, function, vendor_id);
   if (PCI_HEADER_FIELD_IN_WORD(vendor_word, vendor_id) != 0xffff) {
-    PCIDevice *new_device = &pci_data.devices[pci_data.num_devices++];
+    assert(pci_data.num_devices < PCI_MAX_DEVICES);
+    PCIDevice *new_device = &pci_data.devices[pci_data.num_devices];
     new_device->bus = bus;
     new_device->slot = slot;
     new_device->function = function;
@@ -182,23 +197,33 @@ static PCIDevice *add_pci_device(uint8_t bus, uint8_t slot, uint8_t function) {
     }
 
     PCIDeviceDriver *driver = driver_for_device(new_device);
+    new_device->has_driver = driver != NULL;
     if (driver != NULL) {
-      text_output_printf("Loading PCI driver \"%s\"...\n", driver->driver_name);
       new_device->driver = *driver;
-      new_device->has_driver = true;
       new_device->driver.device = new_device;
 
+      text_output_printf("Loading PCI driver \"%s\"...\n", driver->driver_name);
+
       if (new_device->has_interrupts) {
+        pci_data.interrupt_devices[pci_data.num_interrupt_devices] = new_device;
+        __atomic_store_n(&pci_data.num_interrupt_devices,
+                         pci_data.num_interrupt_devices + 1, __ATOMIC_RELEASE);
+
         // TODO: We probably shouldn't remap if this IRQ has already been mapped
-        ioapic_map(new_device->real_irq, PCI_IV, true, true);
+        ioapic_map(new_device->real_irq, pci_data.interrupt_vector, true,
+                   true);
       }
 
-      // init() must be called when the device is able to issue commands
+      // init() must be called when the device is able to issue commands.
+      // pci_isr() already sees the device, its driver's isr() has to cope
+      // with interrupts before init() returns.
       new_device->driver.init(&new_device->driver);
-    } else {
-      new_device->has_driver = false;
     }
 
+    // The device and its driver are fully set up, publish it
+    __atomic_store_n(&pci_data.num_devices, pci_data.num_devices + 1,
+                     __ATOMIC_RELEASE);
+
     return new_device;
   }
 
@@ -207,7 +232,10 @@ static PCIDevice *add_pci_device(uint8_t bus, uint8_t slot, uint8_t function) {
 
 void pci_enumerate_devices() {
   REQUIRE_MODULE("pci");
+
+  lock_acquire(&pci_data.update_lock, -1);
   pci_data.num_devices = 0;
+  pci_data.num_interrupt_devices = 0;
 
   for (int bus = 0; bus < PCI_MAX_BUS_NUM; bus++) {
     for (int slot = 0; slot < PCI_MAX_SLOT_NUM; slot++) {
@@ -220,6 +248,8 @@ void pci_enumerate_devices() {
       }
     }
   }
+
+  lock_release(&pci_data.update_lock);
 }
 
 void pci_init() {
@@ -227,19 +257,23 @@ void pci_init() {
   REQUIRE_MODULE("acpi_full");
 
   pci_data.num_drivers = 0;
+  lock_init(&pci_data.update_lock);
 
   pci_load_irq_routing_table();
 
   // TODO: Handle each interrupt number with a different ISR for better
   // performance
-  interrupt_register_handler(PCI_IV, pci_isr);
+  pci_data.interrupt_vector = irq_alloc_vector(pci_isr, NULL, INTERRUPT_EOI);
+  assert(pci_data.interrupt_vector >= 0);
 
   REGISTER_MODULE("pci");
 }
 
 PCIDevice *pci_find_device(uint8_t class_code, uint8_t subclass,
                            uint8_t program_if) {
-  for (int i = 0; i < pci_data.num_devices; ++i) {
+  const int num_devices =
+      __atomic_load_n(&pci_data.num_devices, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < num_devices; ++i) {
     PCIDevice *device = &pci_data.devices[i];
     if (device->class_code == class_code && device->subclass == subclass &&
         device->program_if == program_if) {
@@ -253,6 +287,10 @@ PCIDevice *pci_find_device(uint8_t class_code, uint8_t subclass,
 void pci_register_device_driver(PCIDeviceDriver driver) {
   REQUIRE_MODULE("pci");
 
+  lock_acquire(&pci_data.update_lock, -1);
   assert(pci_data.num_drivers < PCI_MAX_DRIVERS);
-  pci_data.drivers[pci_data.num_drivers++] = driver;
+  pci_data.drivers[pci_data.num_drivers] = driver;
+  __atomic_store_n(&pci_data.num_drivers, pci_data.num_drivers + 1,
+                   __ATOMIC_RELEASE);
+  lock_release(&pci_data.update_lock);
 }
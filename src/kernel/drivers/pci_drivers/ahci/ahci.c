@@ -12,7 +12,8 @@
 #include <kernel/memory/kmalloc.h>
 #include <kernel/util.h>
 
-#include <kernel/threading/mutex/semaphore.h>
+#include <kernel/threading/completion.h>
+#include <kernel/threading/work_queue.h>
 
 // TOOD: Make sure we don't use PCI/SATA MMIO/DMA space for other stuff
 
@@ -38,7 +39,7 @@ static enum AHCIDeviceType device_type_in_port(HBAPort *port);
 
 typedef struct _AHCIDevice {
   uint8_t port_number;
-  Semaphore pending_command;
+  Completion command_complete;
   PCIDeviceDriver *driver;
 
   struct AHCIDeviceInfo device_info;
@@ -50,6 +51,11 @@ typedef struct _AHCIData {
   bool use_64_bits;
   AHCIDevice devices[MAX_CACHED_DEVICES];
   uint8_t num_devices;
+
+  // Bitmask of devices (by index in `devices`) with completed commands, set by
+  // ahci_isr() and consumed by ahci_complete_commands().
+  volatile uint32_t completed_devices;
+  WorkItem completion_work;
 } AHCIData;
 
 static inline HBAPort *port_from_device(AHCIDevice *device) {
@@ -256,6 +262,9 @@ bool ahci_issue_command(AHCIDevice *device, int slot) {
   // Clear error before issuing command
   port->sata_error = ALL_ONES;
 
+  // Forget interrupts that came in for earlier commands
+  completion_reinit(&device->command_complete);
+
   // Issue command
   port->command_issue |= 1 << slot;
 
@@ -264,7 +273,7 @@ bool ahci_issue_command(AHCIDevice *device, int slot) {
   // Make sure the command has actually finished
   while (port->command_issue & (1 << slot)) {
     // Sleep until we get an interrupt or we timeout
-    if (!semaphore_down(&device->pending_command, 1, COMMAND_TIMEOUT_MS)) {
+    if (!completion_wait(&device->command_complete, COMMAND_TIMEOUT_MS)) {
       text_output_printf("AHCI command issue timeout.\n");
       success = false;
       break;
@@ -313,7 +322,7 @@ static void enumerate_devices(PCIDeviceDriver *driver, HBAMemory *hba,
         new_device->port_number = i;
         new_device->device_info.device_type = device_type;
 
-        semaphore_init(&new_device->pending_command, 0);
+        completion_init(&new_device->command_complete);
 
         // fill_device_info issues a command, so the command infrastructure must
         // be ready
@@ -353,6 +362,18 @@ static enum AHCIDeviceType device_type_in_port(HBAPort *port) {
   }
 }
 
+// Bottom half of ahci_isr(), wakes up threads waiting for their commands.
+static void ahci_complete_commands(void *context) {
+  AHCIData *ahci_data = (AHCIData *)context;
+
+  uint32_t completed = __sync_lock_test_and_set(&ahci_data->completed_devices, 0);
+  for (size_t i = 0; i < ahci_data->num_devices; ++i) {
+    if ((completed & (1 << i)) != 0) {
+      completion_complete(&ahci_data->devices[i].command_complete);
+    }
+  }
+}
+
 static bool initialize_hba(PCIDeviceDriver *driver) {
   PCIDevice *hba_device = driver->device;
 
@@ -385,6 +406,9 @@ static bool initialize_hba(PCIDeviceDriver *driver) {
   AHCIData *ahci_data = (AHCIData *)(driver->driver_data);
   ahci_data->use_64_bits = (hba->capabilities & (1 << 31)) > 0;
   ahci_data->hba = hba;
+  ahci_data->completed_devices = 0;
+  work_item_init(&ahci_data->completion_work, ahci_complete_commands,
+                 ahci_data);
 
   enumerate_devices(driver, hba, ahci_data);
 
@@ -501,12 +525,13 @@ static void ahci_isr(PCIDeviceDriver *driver) {
   if (ahci_data->hba->interrupt_status == 0) return;
 
   // TODO: Only loop over ports with bits set in hba->interrupt_status
+  uint32_t completed = 0;
   for (size_t i = 0; i < ahci_data->num_devices; ++i) {
     AHCIDevice *device = &ahci_data->devices[i];
     HBAPort *port = port_from_device(device);
 
     if (port->interrupt_status > 0) {
-      semaphore_up(&device->pending_command, 1);
+      completed |= 1 << i;
       // Clear port interrupt status
       port->interrupt_status = ALL_ONES;
     }
@@ -514,6 +539,12 @@ static void ahci_isr(PCIDeviceDriver *driver) {
 
   // Clear HBA interrupt status when we are done
   ahci_data->hba->interrupt_status = ALL_ONES;
+
+  // Waking the waiting threads is left to the bottom half
+  if (completed != 0) {
+    __sync_fetch_and_or(&ahci_data->completed_devices, completed);
+    work_queue_enqueue(work_queue_system(), &ahci_data->completion_work);
+  }
 }
 
 void ahci_register() {
@@ -2,8 +2,11 @@
 
 #include <kernel/drivers/serial_port.h>
 #include <kernel/drivers/text_output.h>
+#include <kernel/format/format.h>
 #include <kernel/util.h>
 
+#include <stdarg.h>
+
 #define SERIAL_MAX_BAUD_RATE            115200
 #define SERIAL_BAUD_RATE                38400
 
@@ -65,4 +68,31 @@ void serial_port_putchar(const char c) {
 
 
   io_write_8(SERIAL_DATA_PORT(SERIAL_COM1_BASE), c);
-}
\ No newline at end of file
+}
+
+void serial_port_print(const char *str) {
+  while (*str != '\0') {
+    serial_port_putchar(*str);
+    str++;
+  }
+}
+
+static void *serial_port_format_consumer(void *arg UNUSED, const char *buffer,
+                                         size_t n) {
+  while (n--) {
+    serial_port_putchar(*buffer++);
+  }
+
+  return (void *)(!NULL);
+}
+
+int serial_port_printf(const char *fmt, ...) {
+  va_list arg_list;
+  va_start(arg_list, fmt);
+
+  int num_chars = format(serial_port_format_consumer, NULL, fmt, arg_list);
+
+  va_end(arg_list);
+
+  return num_chars;
+}
@@ -5,5 +5,9 @@
 
 void serial_port_init();
 void serial_port_putchar(const char c);
+void serial_port_print(const char *str);
+
+// Like text_output_printf, but doesn't draw anything on the screen
+int serial_port_printf(const char *format, ...);
 
 #endif // _SERIAL_PORT_H_
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include <kernel/drivers/gdt.h>
+#include <kernel/drivers/syscall.h>
+#include <kernel/util.h>
+
+#include <kernel/drivers/timer.h>
+#include <kernel/memory/virtual_memory.h>
+#include <kernel/threading/scheduler.h>
+#include <kernel/threading/thread.h>
+
+#define MSR_EFER 0xC0000080
+#define MSR_STAR 0xC0000081
+#define MSR_LSTAR 0xC0000082
+#define MSR_FMASK 0xC0000084
+
+#define EFER_SYSCALL_ENABLE (1 << 0)
+
+// RFLAGS bits cleared on entry: interrupts (until syscall_entry is on the
+// kernel stack), trap, direction and alignment check
+#define SYSCALL_FMASK ((1 << 9) | (1 << 8) | (1 << 10) | (1 << 18))
+
+extern void syscall_entry();  // syscall.s
+
+static struct {
+  SyscallHandler handlers[SYSCALL_MAX];
+} syscall_data;
+
+static uint64_t syscall_null(uint64_t arg0 UNUSED, uint64_t arg1 UNUSED,
+                             uint64_t arg2 UNUSED, uint64_t arg3 UNUSED,
+                             uint64_t arg4 UNUSED) {
+  return 0;
+}
+
+static uint64_t syscall_exit(uint64_t return_value, uint64_t arg1 UNUSED,
+                             uint64_t arg2 UNUSED, uint64_t arg3 UNUSED,
+                             uint64_t arg4 UNUSED) {
+  thread_exit_with_value((void *)return_value);
+  return 0;  // We never get here
+}
+
+static uint64_t syscall_yield(uint64_t arg0 UNUSED, uint64_t arg1 UNUSED,
+                              uint64_t arg2 UNUSED, uint64_t arg3 UNUSED,
+                              uint64_t arg4 UNUSED) {
+  scheduler_yield();
+  return 0;
+}
+
+static uint64_t syscall_thread_id(uint64_t arg0 UNUSED, uint64_t arg1 UNUSED,
+                                  uint64_t arg2 UNUSED, uint64_t arg3 UNUSED,
+                                  uint64_t arg4 UNUSED) {
+  return thread_id(scheduler_current_thread());
+}
+
+static uint64_t syscall_sleep(uint64_t milliseconds, uint64_t arg1 UNUSED,
+                              uint64_t arg2 UNUSED, uint64_t arg3 UNUSED,
+                              uint64_t arg4 UNUSED) {
+  timer_thread_sleep(milliseconds);
+  return 0;
+}
+
+void syscall_init() {
+  REQUIRE_MODULE("gdt");
+  REQUIRE_MODULE("virtual_memory");
+
+  syscall_register(SYSCALL_NULL, syscall_null);
+  syscall_register(SYSCALL_EXIT, syscall_exit);
+  syscall_register(SYSCALL_YIELD, syscall_yield);
+  syscall_register(SYSCALL_THREAD_ID, syscall_thread_id);
+  syscall_register(SYSCALL_SLEEP, syscall_sleep);
+
+  // SYSCALL loads the kernel segments from STAR[47:32], SYSRET the user ones
+  // from STAR[63:48]: data at +8 and code at +16
+  const uint64_t user_base = (GDT_USER_DS & ~3) - 8;
+  assert((GDT_USER_CS & ~3) == user_base + 16);
+  write_msr(MSR_STAR, user_base << 48 | (uint64_t)GDT_KERNEL_CS << 32);
+  write_msr(MSR_LSTAR, (uint64_t)syscall_entry);
+  write_msr(MSR_FMASK, SYSCALL_FMASK);
+  write_msr(MSR_EFER, read_msr(MSR_EFER) | EFER_SYSCALL_ENABLE);
+
+  // Every user thread returns through it
+  vm_set_user_accessible((void *)syscall_user_thread_exit, 16);
+
+  REGISTER_MODULE("syscall");
+}
+
+void syscall_register(uint64_t number, SyscallHandler handler) {
+  assert(number < SYSCALL_MAX);
+  syscall_data.handlers[number] = handler;
+}
+
+uint64_t syscall_dispatch(uint64_t arg0, uint64_t arg1, uint64_t arg2,
+                          uint64_t arg3, uint64_t arg4, uint64_t number) {
+  if (number >= SYSCALL_MAX || !syscall_data.handlers[number]) {
+    return SYSCALL_INVALID;
+  }
+
+  return syscall_data.handlers[number](arg0, arg1, arg2, arg3, arg4);
+}
@@ -0,0 +1,71 @@
+#include <kernel/kernel_common.h>
+
+#ifndef _SYSCALL_H
+#define _SYSCALL_H
+
+// System calls from ring 3 threads (see thread_create_user()) go through the
+// SYSCALL instruction: the number in rax, up to five arguments in rdi, rsi,
+// rdx, r10 and r8, the result in rax. Everything but rax, rcx and r11 is
+// preserved. Handlers run on the calling thread's kernel stack with
+// interrupts enabled, and can sleep.
+
+#define SYSCALL_NULL 0       // Does nothing, for benchmarks
+#define SYSCALL_EXIT 1       // (return_value), doesn't return
+#define SYSCALL_YIELD 2      // ()
+#define SYSCALL_THREAD_ID 3  // (), returns the caller's tid
+#define SYSCALL_SLEEP 4      // (milliseconds)
+
+#define SYSCALL_MAX 64
+
+// Returned for numbers without a handler
+#define SYSCALL_INVALID UINT64_MAX
+
+typedef uint64_t (*SyscallHandler)(uint64_t arg0, uint64_t arg1,
+                                   uint64_t arg2, uint64_t arg3,
+                                   uint64_t arg4);
+
+void syscall_init();
+
+void syscall_register(uint64_t number, SyscallHandler handler);
+
+// Called by syscall_entry (syscall.s)
+uint64_t syscall_dispatch(uint64_t arg0, uint64_t arg1, uint64_t arg2,
+                          uint64_t arg3, uint64_t arg4, uint64_t number);
+
+// Where the main function of a ring 3 thread returns to, it exits the thread
+// with the return value (syscall.s)
+extern void syscall_user_thread_exit();
+
+// For code running in ring 3. Always inlined, so they don't need anything
+// else to be accessible from there.
+static inline __attribute__((always_inline)) uint64_t syscall0(
+    uint64_t number) {
+  uint64_t result;
+  __asm__ volatile("syscall"
+                   : "=a"(result)
+                   : "a"(number)
+                   : "rcx", "r11", "memory");
+  return result;
+}
+
+static inline __attribute__((always_inline)) uint64_t syscall1(
+    uint64_t number, uint64_t arg0) {
+  uint64_t result;
+  __asm__ volatile("syscall"
+                   : "=a"(result)
+                   : "a"(number), "D"(arg0)
+                   : "rcx", "r11", "memory");
+  return result;
+}
+
+static inline __attribute__((always_inline)) uint64_t syscall2(
+    uint64_t number, uint64_t arg0, uint64_t arg1) {
+  uint64_t result;
+  __asm__ volatile("syscall"
+                   : "=a"(result)
+                   : "a"(number), "D"(arg0), "S"(arg1)
+                   : "rcx", "r11", "memory");
+  return result;
+}
+
+#endif
@@ -0,0 +1,66 @@
+.extern TSS
+.extern syscall_dispatch
+
+.data
+
+# The user stack pointer, only between SYSCALL and the switch to the kernel
+# stack. Interrupts are masked in between, and there is only one CPU.
+syscall_user_rsp:
+  .quad 0
+
+.text
+
+.globl syscall_entry
+syscall_entry:
+  # SYSCALL doesn't switch stacks, and leaves the user rip in rcx and the user
+  # rflags in r11
+  movq  %rsp, (syscall_user_rsp)
+  movq  (TSS + 4), %rsp  # TSS.rsp0, the current thread's kernel stack (gdt.c)
+
+  pushq (syscall_user_rsp)
+  pushq %rcx
+  pushq %r11
+
+  # Preserved for the caller, syscall_dispatch() takes care of the rest
+  pushq %rdi
+  pushq %rsi
+  pushq %rdx
+  pushq %r8
+  pushq %r9
+  pushq %r10
+  subq  $8, %rsp  # Keep the stack 16-byte aligned for the call
+
+  sti
+
+  # syscall_dispatch(arg0, arg1, arg2, arg3, arg4, number)
+  movq  %r10, %rcx
+  movq  %rax, %r9
+  call  syscall_dispatch
+
+  # Nothing may interrupt us once we're back on the user stack
+  cli
+
+  addq  $8, %rsp
+  popq  %r10
+  popq  %r9
+  popq  %r8
+  popq  %rdx
+  popq  %rsi
+  popq  %rdi
+
+  popq  %r11
+  popq  %rcx
+  popq  %rsp
+
+  sysretq  # Restores rflags (and interrupts) from r11
+
+# Runs in ring 3, the main function of a user thread returns here. It has a
+# page to itself, so code that is only user accessible for a while (and gets
+# its pages cleared with vm_clear_user_accessible()) never shares it.
+.balign 4096
+.globl syscall_user_thread_exit
+syscall_user_thread_exit:
+  movq  %rax, %rdi
+  movq  $1, %rax  # SYSCALL_EXIT
+  syscall
+.balign 4096
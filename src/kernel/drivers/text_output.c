@@ -140,6 +140,36 @@ int text_output_vprintf(const char *fmt, va_list arg_list) {
   return format(text_output_format_consumer, NULL, fmt, arg_list);
 }
 
+struct PositionedOutput {
+  int col, row;
+};
+
+static void *text_output_positioned_consumer(void *arg, const char *buffer,
+                                             size_t n) {
+  struct PositionedOutput *position = (struct PositionedOutput *)arg;
+  while (n--) {
+    text_output_draw_char(*buffer++, position->col++, position->row);
+  }
+
+  return (void *)( !NULL );
+}
+
+int text_output_printf_at(int col, int row, const char *fmt, ...) {
+  struct PositionedOutput position = {.col = col, .row = row};
+
+  va_list arg_list;
+  va_start(arg_list, fmt);
+
+  int num_chars =
+      format(text_output_positioned_consumer, &position, fmt, arg_list);
+
+  va_end(arg_list);
+
+  return num_chars;
+}
+
+int text_output_num_columns() { return graphics_width() / kCharacterWidth; }
+
 void text_output_safe_printf(const char *fmt, ...) {
   va_list arg_list;
   va_start(arg_list, fmt);
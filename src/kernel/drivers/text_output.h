@@ -17,6 +17,11 @@ void text_output_print(const char *str);
 int text_output_printf(const char *format, ...);
 int text_output_vprintf(const char *format, va_list arg_list);
 
+// Draws formatted text starting at character cell (col, row) without moving
+// the cursor or writing to the serial port. Newlines are not supported.
+int text_output_printf_at(int col, int row, const char *format, ...);
+int text_output_num_columns();
+
 void text_output_safe_printf(const char *format, ...);
 void text_output_safe_vprintf(const char *format, va_list arg_list);
 
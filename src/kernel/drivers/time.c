@@ -0,0 +1,201 @@
+#include <kernel/drivers/time.h>
+#include <kernel/drivers/apic.h>
+#include <kernel/drivers/cpuid.h>
+#include <kernel/drivers/hpet.h>
+#include <kernel/drivers/interrupt.h>
+#include <kernel/drivers/text_output.h>
+#include <kernel/drivers/timer.h>
+#include <kernel/util.h>
+
+#define PIT_FREQUENCY_HZ 1193182
+#define CALIBRATION_MS 10
+#define CPUID_CHECK_MS 1
+#define CPUID_TOLERANCE 100  // Enumerated frequencies must be within 1%
+
+// Fixed point conversion factors, so conversions don't need a division
+#define TIME_SCALE_SHIFT 32
+
+static struct {
+  uint64_t tsc_frequency;
+  uint64_t apic_timer_frequency;  // At divider 1
+  uint64_t boot_tsc;
+
+  uint64_t ns_per_cycle;  // Scaled by 2^TIME_SCALE_SHIFT
+  uint64_t cycles_per_ns;  // Scaled by 2^TIME_SCALE_SHIFT
+
+  const char *calibration_source;
+  uint64_t calibration_cycles;  // Time time_init() took
+} time_data;
+
+typedef struct {
+  uint64_t reference;  // HPET counter or timer ticks
+  uint64_t tsc;
+  uint32_t apic_count;
+} CalibrationSample;
+
+static void take_sample(CalibrationSample *sample, bool use_hpet) {
+  bool interrupts_enabled = interrupts_status();
+  cli();
+
+  sample->reference = use_hpet ? hpet_counter() : timer_ticks();
+  sample->tsc = read_tsc();
+  sample->apic_count = apic_local_timer_count();
+
+  // Only re-enable interrupts if they were enabled before
+  if (interrupts_enabled) sti();
+}
+
+// Measures the TSC and the local APIC timer against the same `window_ms`
+// window of the HPET counter, or of timer ticks if there's no HPET. Timer
+// ticks need interrupts to be enabled.
+static void calibrate_clocks(uint64_t window_ms, uint64_t *tsc_frequency,
+                             uint64_t *apic_timer_frequency) {
+  const bool use_hpet = hpet_available();
+
+  // The APIC timer keeps counting down while masked, and at divider 1 it
+  // takes seconds to get through a full count
+  apic_setup_local_timer(APIC_DIV_1, LOCAL_APIC_CALIBRATION_IV,
+                         APIC_TIMER_ONE_SHOT, UINT32_MAX);
+
+  CalibrationSample start, end;
+  uint64_t reference_frequency, reference_elapsed;
+  if (use_hpet) {
+    reference_frequency = hpet_frequency();
+    const uint64_t window = reference_frequency * window_ms / 1000;
+
+    take_sample(&start, true);
+    do {
+      __asm__ volatile("pause");
+      take_sample(&end, true);
+    } while (end.reference < start.reference + window);
+
+    reference_elapsed = end.reference - start.reference;
+  } else {
+    const uint64_t window = window_ms * TIMER_FREQUENCY / 1000;
+
+    // Sample right after a tick starts, on both ends
+    const uint64_t first_tick = timer_ticks();
+    while (timer_ticks() == first_tick) __asm__ volatile("pause");
+    take_sample(&start, false);
+    while (timer_ticks() < start.reference + window) {
+      __asm__ volatile("pause");
+    }
+    take_sample(&end, false);
+
+    // Count in PIT input clock cycles, the ticks are slightly longer than
+    // 1 / TIMER_FREQUENCY
+    reference_frequency = PIT_FREQUENCY_HZ;
+    reference_elapsed = (end.reference - start.reference) * TIMER_DIVIDER;
+  }
+
+  *tsc_frequency =
+      (end.tsc - start.tsc) * reference_frequency / reference_elapsed;
+  *apic_timer_frequency = (uint64_t)(start.apic_count - end.apic_count) *
+                          reference_frequency / reference_elapsed;
+}
+
+static bool frequency_matches(uint64_t enumerated, uint64_t measured) {
+  const uint64_t difference =
+      enumerated > measured ? enumerated - measured : measured - enumerated;
+  return difference <= measured / CPUID_TOLERANCE;
+}
+
+// Returns (a << TIME_SCALE_SHIFT) / b without overflowing
+static uint64_t scaled_ratio(uint64_t a, uint64_t b) {
+  const uint64_t quotient = a / b, remainder = a % b;
+  return (quotient << TIME_SCALE_SHIFT) +
+         (remainder << TIME_SCALE_SHIFT) / b;
+}
+
+static uint64_t scale(uint64_t value, uint64_t factor) {
+  return ((unsigned __int128)value * factor) >> TIME_SCALE_SHIFT;
+}
+
+void time_init() {
+  REQUIRE_MODULE("cpuid");
+  REQUIRE_MODULE("apic");
+  REQUIRE_MODULE("timer");
+
+  const uint64_t start = read_tsc();
+
+  assert(cpuid_has_capability(CPUID_CAP_TSC));
+  if (!cpuid_has_invariant_tsc()) {
+    text_output_printf(
+        "WARNING: TSC is not invariant, time will drift with CPU frequency.\n");
+  }
+
+  // CPUs that enumerate the TSC frequency also enumerate the crystal, which
+  // drives the APIC timer on bare metal. Hypervisors pass the leaves through
+  // but run the APIC timer at whatever rate they emulate (1GHz on KVM), so
+  // the enumerated values are only used if a short HPET measurement agrees.
+  // Otherwise both are measured over the full window.
+  const uint64_t cpuid_tsc = cpuid_tsc_frequency();
+  const uint64_t cpuid_crystal = cpuid_crystal_frequency();
+  uint64_t tsc_frequency, apic_timer_frequency;
+  time_data.calibration_source = NULL;
+  if (cpuid_tsc != 0 && cpuid_crystal != 0 && hpet_available()) {
+    calibrate_clocks(CPUID_CHECK_MS, &tsc_frequency, &apic_timer_frequency);
+    if (frequency_matches(cpuid_tsc, tsc_frequency) &&
+        frequency_matches(cpuid_crystal, apic_timer_frequency)) {
+      time_data.tsc_frequency = cpuid_tsc;
+      time_data.apic_timer_frequency = cpuid_crystal;
+      time_data.calibration_source = "CPUID";
+    } else {
+      text_output_printf("WARNING: CPUID clock frequencies don't match the "
+                         "HPET, measuring them.\n");
+    }
+  }
+
+  if (time_data.calibration_source == NULL) {
+    calibrate_clocks(CALIBRATION_MS, &tsc_frequency, &apic_timer_frequency);
+    time_data.tsc_frequency = tsc_frequency;
+    time_data.apic_timer_frequency = apic_timer_frequency;
+    time_data.calibration_source = hpet_available() ? "HPET" : "PIT";
+  }
+  assert(time_data.tsc_frequency > 0);
+  assert(time_data.apic_timer_frequency > 0);
+
+  time_data.ns_per_cycle = scaled_ratio(NS_PER_SEC, time_data.tsc_frequency);
+  time_data.cycles_per_ns = scaled_ratio(time_data.tsc_frequency, NS_PER_SEC);
+  time_data.boot_tsc = read_tsc();
+  time_data.calibration_cycles = time_data.boot_tsc - start;
+
+  REGISTER_MODULE("time");
+}
+
+uint64_t time_apic_timer_frequency() { return time_data.apic_timer_frequency; }
+
+void time_print_calibration() {
+  const uint64_t calibration_ns =
+      time_cycles_to_ns(time_data.calibration_cycles);
+
+  text_output_printf(
+      "Clocks from %s: TSC %lu kHz, APIC timer %lu kHz, took %lu us\n",
+      time_data.calibration_source, time_data.tsc_frequency / 1000,
+      time_data.apic_timer_frequency / 1000, calibration_ns / NS_PER_US);
+}
+
+uint64_t time_now_ns() {
+  return time_cycles_to_ns(read_tsc() - time_data.boot_tsc);
+}
+
+uint64_t time_tsc_frequency() { return time_data.tsc_frequency; }
+
+uint64_t time_cycles_to_ns(uint64_t cycles) {
+  return scale(cycles, time_data.ns_per_cycle);
+}
+
+uint64_t time_ns_to_cycles(uint64_t nanoseconds) {
+  return scale(nanoseconds, time_data.cycles_per_ns);
+}
+
+void time_delay_ns(uint64_t nanoseconds) {
+  // Spin on a deadline rather than a number of iterations, so time spent in
+  // interrupt handlers counts towards the delay
+  const uint64_t end = read_tsc() + time_ns_to_cycles(nanoseconds);
+  while (read_tsc() < end) __asm__ volatile("pause");
+}
+
+void time_delay_us(uint64_t microseconds) {
+  time_delay_ns(microseconds * NS_PER_US);
+}
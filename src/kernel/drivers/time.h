@@ -0,0 +1,33 @@
+#include <kernel/kernel_common.h>
+
+#ifndef _TIME_H
+#define _TIME_H
+
+// High resolution time, based on the TSC. The TSC and local APIC timer
+// frequencies come from CPUID when the CPU enumerates them and a quick HPET
+// measurement agrees, otherwise both are measured in one short window of the
+// HPET (or of PIT ticks if there's no HPET).
+// Without an invariant TSC the frequency can change with power states, so
+// times are only approximate.
+
+#define NS_PER_US 1000ULL
+#define NS_PER_MS 1000000ULL
+#define NS_PER_SEC 1000000000ULL
+
+void time_init();
+
+// Monotonic time since time_init(), in nanoseconds
+uint64_t time_now_ns();
+
+uint64_t time_tsc_frequency();  // In Hz
+uint64_t time_apic_timer_frequency();  // In Hz, at divider 1
+void time_print_calibration();
+uint64_t time_cycles_to_ns(uint64_t cycles);
+uint64_t time_ns_to_cycles(uint64_t nanoseconds);
+
+// Busy wait, these don't give up the CPU. Interrupts and preemption only make
+// them longer.
+void time_delay_ns(uint64_t nanoseconds);
+void time_delay_us(uint64_t microseconds);
+
+#endif
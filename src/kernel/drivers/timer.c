@@ -1,47 +1,229 @@
 #include <kernel/drivers/timer.h>
 #include <kernel/drivers/text_output.h>
+#include <kernel/drivers/time.h>
 #include <kernel/drivers/apic.h>
+#include <kernel/drivers/hpet.h>
 #include <kernel/drivers/interrupt.h>
 #include <kernel/util.h>
 #include <kernel/datastructures/list.h>
-#include <kernel/memory/kmalloc.h>
 #include <kernel/threading/scheduler.h>
+#include <kernel/threading/wait_queue.h>
+#include <kernel/threading/work_queue.h>
 
 #define TIMER_IRQ 2
-
-struct waiting_thread {
-  ListEntry entry;
-
-  KernelThread *thread;
-  uint64_t wake_time;
+#define TIMER_HPET_TIMER 0
+
+// Hierarchical timing wheel: level 0 has one slot per tick, and each level
+// above covers TIMER_WHEEL_SLOTS times the range of the one below. Timers are
+// put in the level that matches how far away they are and are cascaded down
+// a level each time the level below wraps around, so adding and cancelling a
+// timer are O(1) and a tick only touches the slots that are due.
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_RANGE (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+// Lives on the stack of the sleeping thread. The queue only ever holds
+// `entry`, which the timer wakes.
+struct timer_sleeper {
+  TimerNode node;
+  WaitQueue queue;
+  WaitQueueEntry entry;
 };
 
 static struct {
   volatile uint64_t ticks; // Won't overflow for 5e8 ticks
-  uint64_t cycles_per_tick;
-  List waiting_threads;
+  const char *source;  // What drives the ticks
+
+  // Only modified with preemption disabled, the ISR just peeks at level 0
+  List wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+  uint64_t wheel_next_tick;  // The next tick the wheel will process
+  volatile uint64_t num_pending;
+
+  // Expiry runs in a bottom half, the ISR only checks whether any slot is due.
+  // Every sleep, timeout and deadline replenishment waits on it, so it goes
+  // on the high priority queue where no thread can hold it up.
+  WorkItem expiry_work;
+
+  // Statistics
+  uint64_t num_expiry_runs, num_ticks_processed, num_expired;
+  uint64_t total_expiry_cycles, max_expiry_cycles;
 } timer_data;
 
-static inline void wake_waiting_thread(struct waiting_thread *wt) {
-  list_remove(&timer_data.waiting_threads, &wt->entry);
-  thread_wake(wt->thread);
-  kfree(wt);
+// Puts `node` in the slot for its expiry time, relative to wheel_next_tick
+static void timer_wheel_insert(TimerNode *node) {
+  const uint64_t now = timer_data.wheel_next_tick;
+  if (node->expires < now) node->expires = now;
+
+  uint64_t delta = node->expires - now;
+  uint64_t expires = node->expires;
+  if (delta >= TIMER_WHEEL_RANGE) {
+    // Too far away, park it at the end of the wheel. It is put back in the
+    // right place when it is cascaded.
+    delta = TIMER_WHEEL_RANGE - 1;
+    expires = now + delta;
+  }
+
+  uint32_t level = 0;
+  while (delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1)))) level++;
+
+  const uint32_t slot =
+      (expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+  node->bucket = &timer_data.wheel[level][slot];
+  list_push_back(node->bucket, &node->entry);
+}
+
+// Re-inserts every timer in wheel[level][slot] relative to the current tick
+static void timer_wheel_cascade(uint32_t level, uint32_t slot) {
+  List *bucket = &timer_data.wheel[level][slot];
+  ListEntry *current = list_head(bucket);
+  list_init(bucket);
+
+  while (current) {
+    TimerNode *node = container_of(current, TimerNode, entry);
+    current = list_next(current);
+    timer_wheel_insert(node);
+  }
+}
+
+// Processes one tick of the wheel, runs the timers that expire on it
+static void timer_wheel_tick() {
+  const uint64_t tick = timer_data.wheel_next_tick;
+
+  // Cascade every level whose lower level just wrapped around
+  for (uint32_t level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+    if ((tick >> (TIMER_WHEEL_BITS * (level - 1))) & TIMER_WHEEL_MASK) break;
+    timer_wheel_cascade(
+        level, (tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+  }
+
+  // Detach the due slot first: callbacks can add timers, which go in the slots
+  // for the following ticks.
+  List *bucket = &timer_data.wheel[0][tick & TIMER_WHEEL_MASK];
+  ListEntry *current = list_head(bucket);
+  list_init(bucket);
+  timer_data.wheel_next_tick = tick + 1;
+
+  while (current) {
+    TimerNode *node = container_of(current, TimerNode, entry);
+    current = list_next(current);
+
+    node->bucket = NULL;
+    timer_data.num_pending--;
+    timer_data.num_expired++;
+    node->callback(node);
+  }
+}
+
+// Bottom half of timer_isr(), catches the wheel up with the tick count.
+static void timer_expire(void *context UNUSED) {
+  const uint64_t start = read_tsc();
+
+  preempt_disable();
+
+  const uint64_t current_ticks = timer_data.ticks;
+  while (timer_data.wheel_next_tick <= current_ticks) {
+    timer_wheel_tick();
+    timer_data.num_ticks_processed++;
+  }
+
+  const uint64_t cycles = read_tsc() - start;
+  timer_data.num_expiry_runs++;
+  timer_data.total_expiry_cycles += cycles;
+  if (cycles > timer_data.max_expiry_cycles) {
+    timer_data.max_expiry_cycles = cycles;
+  }
+
+  preempt_enable();
 }
 
 void timer_isr() {
   uint64_t current_ticks = __sync_add_and_fetch(&timer_data.ticks, 1);
+  scheduler_timer_tick();
+  if (timer_data.num_pending == 0) return;
+
+  // Something is due if this tick's slot has timers in it, or if the next
+  // level has to be cascaded. If the bottom half is behind, it catches up
+  // with every tick it missed when it runs.
+  if ((current_ticks & TIMER_WHEEL_MASK) == 0 ||
+      list_head(&timer_data.wheel[0][current_ticks & TIMER_WHEEL_MASK])) {
+    work_queue_enqueue(work_queue_high_priority(), &timer_data.expiry_work);
+  }
+}
 
-  ListEntry *current = list_head(&timer_data.waiting_threads);
-  while (current) {
-    struct waiting_thread *current_waiting_thread = container_of(current, struct waiting_thread, entry);
-    ListEntry *next = list_next(current);
+void timer_node_init(TimerNode *node, TimerCallback callback) {
+  node->callback = callback;
+  node->bucket = NULL;
+}
 
-    if (current_ticks >= current_waiting_thread->wake_time) {
-      wake_waiting_thread(current_waiting_thread);
-    }
+static void timer_add_ticks(TimerNode *node, uint64_t ticks) {
+  assert(node->bucket == NULL);
 
-    current = next;
+  preempt_disable();
+
+  // The wheel doesn't move while it's empty, skip ahead instead of making
+  // the bottom half catch up
+  if (timer_data.num_pending == 0) timer_data.wheel_next_tick = timer_data.ticks;
+
+  node->expires = timer_data.ticks + ticks;
+  timer_wheel_insert(node);
+  timer_data.num_pending++;
+
+  // If the wheel is behind, the ISR may already have passed the slot this
+  // timer went in
+  if (timer_data.wheel_next_tick <= timer_data.ticks) {
+    work_queue_enqueue(work_queue_high_priority(), &timer_data.expiry_work);
   }
+
+  preempt_enable();
+}
+
+void timer_add(TimerNode *node, uint64_t milliseconds) {
+  timer_add_ticks(node, milliseconds * TIMER_FREQUENCY / 1000);
+}
+
+bool timer_cancel(TimerNode *node) {
+  preempt_disable();
+
+  const bool pending = node->bucket != NULL;
+  if (pending) {
+    list_remove(node->bucket, &node->entry);
+    node->bucket = NULL;
+    timer_data.num_pending--;
+  }
+
+  preempt_enable();
+
+  return pending;
+}
+
+bool timer_pending(TimerNode *node) { return node->bucket != NULL; }
+
+void timer_print_statistics() {
+  const uint64_t average_cycles =
+      timer_data.num_expiry_runs
+          ? timer_data.total_expiry_cycles / timer_data.num_expiry_runs
+          : 0;
+
+  text_output_printf(
+      "Timer wheel (%s): %lu pending, %lu expired, %lu ticks processed in %lu "
+      "runs, avg %lu max %lu cycles per run\n",
+      timer_data.source, timer_data.num_pending, timer_data.num_expired,
+      timer_data.num_ticks_processed, timer_data.num_expiry_runs,
+      average_cycles, timer_data.max_expiry_cycles);
+}
+
+void timer_get_statistics(TimerStatistics *statistics) {
+  preempt_disable();
+
+  statistics->num_expiry_runs = timer_data.num_expiry_runs;
+  statistics->num_ticks_processed = timer_data.num_ticks_processed;
+  statistics->num_expired = timer_data.num_expired;
+  statistics->total_expiry_cycles = timer_data.total_expiry_cycles;
+  statistics->max_expiry_cycles = timer_data.max_expiry_cycles;
+
+  preempt_enable();
 }
 
 uint64_t timer_ticks() {
@@ -51,81 +233,107 @@ uint64_t timer_ticks() {
 void timer_init() {
   REQUIRE_MODULE("interrupt");
 
-  list_init(&timer_data.waiting_threads);
+  for (uint32_t level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+    for (uint32_t slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot) {
+      list_init(&timer_data.wheel[level][slot]);
+    }
+  }
+  timer_data.wheel_next_tick = 0;
+  timer_data.num_pending = 0;
+  work_item_init(&timer_data.expiry_work, timer_expire, NULL);
+
+  const int vector = irq_alloc_vector(timer_isr, NULL, INTERRUPT_EOI);
+  assert(vector >= 0);
+
+  // Prefer the HPET: it is exact to the nanosecond and doesn't need port I/O
+  bool use_hpet = false;
+  if (hpet_available()) {
+    // Take over the PIT's input with legacy replacement routing, if the HPET
+    // has it: unlike the inputs in a timer's route capabilities, it's never
+    // shared with a PCI interrupt. This also silences the PIT and the RTC
+    // (nothing uses the RTC), so it's turned back off if the HPET can't
+    // drive the tick after all.
+    hpet_set_legacy_replacement(true);
+    use_hpet = hpet_timer_start(TIMER_HPET_TIMER, vector, HPET_TIMER_PERIODIC,
+                                NS_PER_SEC / TIMER_FREQUENCY);
+    if (!use_hpet) hpet_set_legacy_replacement(false);
+  }
 
-  interrupt_register_handler(PIC_TIMER_IV, timer_isr);
+  if (use_hpet) {
+    timer_data.source = "HPET";
 
-  // Use Legacy PIC Timer
-  // TODO: Use HPET eventually
-  io_write_8(0x43, 0x68);
+    // Mode 0 without a count never fires, so this stops the PIT
+    io_write_8(0x43, 0x30);
+  } else {
+    timer_data.source = "PIT";
 
-  // Set up timer to have frequency TIMER_FREQUENCY
-  io_write_8(0x40, TIMER_DIVIDER & 0xff);
-  io_write_8(0x40, TIMER_DIVIDER >> 8);
+    // Use Legacy PIC Timer
+    io_write_8(0x43, 0x68);
 
-  // Enable I/O APIC routing for PIC timer
-  ioapic_map(TIMER_IRQ, PIC_TIMER_IV, false, false);
+    // Set up timer to have frequency TIMER_FREQUENCY
+    io_write_8(0x40, TIMER_DIVIDER & 0xff);
+    io_write_8(0x40, TIMER_DIVIDER >> 8);
 
-  // Calibrate cycles_per_tick
-  timer_data.cycles_per_tick = 0;
-  timer_data.ticks = 0;
-  while (timer_data.ticks < 128) {
-    timer_data.cycles_per_tick++;
-    __sync_synchronize();
+    // Enable I/O APIC routing for PIC timer
+    ioapic_map(TIMER_IRQ, vector, false, false);
   }
-  timer_data.cycles_per_tick >>= 5; // We execute about 4x more instructions in this loop than in the timer_thread_stall() loop
 
   REGISTER_MODULE("timer");
 }
 
-void timer_thread_stall(uint64_t microseconds) {
-  // TODO: Who knows if this is even remotely precise. Also, it can get interrupted by things
-
-  uint64_t cycles = microseconds * TIMER_FREQUENCY * timer_data.cycles_per_tick / 1e6;
-  while (cycles > 0) cycles--;
+static void timer_wake_sleeper(TimerNode *node) {
+  struct timer_sleeper *sleeper =
+      container_of(node, struct timer_sleeper, node);
+  wait_queue_wake_entry(&sleeper->queue, &sleeper->entry);
 }
 
-void timer_thread_sleep(uint64_t milliseconds) {
-  KernelThread *thread = scheduler_current_thread();
-
-  struct waiting_thread *new_entry = kmalloc(sizeof(struct waiting_thread));
+// Returns false if the thread was woken up by something else
+static bool timer_sleep_ticks(uint64_t ticks) {
+  struct timer_sleeper sleeper;
+  timer_node_init(&sleeper.node, timer_wake_sleeper);
+  wait_queue_init(&sleeper.queue);
+  wait_queue_entry_init(&sleeper.entry, scheduler_current_thread(), 0);
 
-  new_entry->thread = thread;
+  preempt_disable();
 
-  uint64_t ticks = milliseconds * 1000 / TIMER_FREQUENCY;
-  new_entry->wake_time = timer_data.ticks + ticks;
+  wait_queue_add(&sleeper.queue, &sleeper.entry);
+  timer_add_ticks(&sleeper.node, ticks);
 
-  bool interrupts_enabled = interrupts_status();
-  cli();
+  // Sleep once instead of wait_queue_wait(), which only returns once the entry
+  // is woken. Waiting on other queues with a timeout (wait_queue_sleep(), the
+  // multi-waits) relies on their wakes ending this sleep early.
+  thread_sleep(sleeper.entry.thread);
 
-  list_push_front(&timer_data.waiting_threads, &new_entry->entry);
-
-  // This won't return until the thread wakes up
-  // NOTE: Interrupts will be disabled when it returns
-  thread_sleep(thread);
+  // The node and entry have to be removed before they go out of scope
+  if (!sleeper.entry.woken) {
+    timer_cancel(&sleeper.node);
+    wait_queue_remove(&sleeper.queue, &sleeper.entry);
+  }
 
-  // Only re-enable interrupts if they were enabled before
-  if (interrupts_enabled) sti();
+  preempt_enable();
 
+  return sleeper.entry.woken;
 }
 
-void timer_cancel_thread_sleep(KernelThread *thread) {
-  bool interrupts_enabled = interrupts_status();
-  cli();
-
-  ListEntry *current = list_head(&timer_data.waiting_threads);
-  while (current) {
-    struct waiting_thread *current_waiting_thread = container_of(current, struct waiting_thread, entry);
-    ListEntry *next = list_next(current);
+void timer_thread_sleep(uint64_t milliseconds) {
+  timer_sleep_ticks(milliseconds * TIMER_FREQUENCY / 1000);
+}
 
-    if (current_waiting_thread->thread == thread) {
-      wake_waiting_thread(current_waiting_thread);
+void timer_thread_sleep_ns(uint64_t nanoseconds) {
+  const uint64_t tick_ns = NS_PER_SEC / TIMER_FREQUENCY;
+  const uint64_t deadline = time_now_ns() + nanoseconds;
+
+  // The wheel only has tick resolution, and the current tick has already
+  // partly elapsed. Sleep on it until the deadline is less than two ticks
+  // away, then spin for the rest.
+  uint64_t now;
+  while ((now = time_now_ns()) < deadline) {
+    const uint64_t remaining_ticks = (deadline - now) / tick_ns;
+    if (remaining_ticks < 2) {
+      time_delay_ns(deadline - now);
+      break;
     }
 
-    current = next;
+    if (!timer_sleep_ticks(remaining_ticks - 1)) break;
   }
-
-  // Only re-enable interrupts if they were enabled before
-  if (interrupts_enabled) sti();
 }
-
@@ -1,3 +1,4 @@
+#include <kernel/datastructures/list.h>
 #include <kernel/kernel_common.h>
 #include <kernel/threading/thread.h>
 
@@ -10,10 +11,41 @@
 void timer_init();
 uint64_t timer_ticks();
 
-void timer_thread_stall(uint64_t microseconds);
+// One-shot timers, embedded in whatever needs a timeout. Callbacks run in the
+// timer bottom half with preemption disabled, so they must be short and must
+// not sleep. Adding and cancelling are O(1).
+typedef struct TimerNode TimerNode;
+typedef void (*TimerCallback)(TimerNode *node);
 
+struct TimerNode {
+  ListEntry entry;
+  List *bucket;      // Timing wheel slot, NULL when not pending
+  uint64_t expires;  // In ticks
+  TimerCallback callback;
+};
+
+void timer_node_init(TimerNode *node, TimerCallback callback);
+void timer_add(TimerNode *node, uint64_t milliseconds);  // Must not be pending
+bool timer_cancel(TimerNode *node);  // Returns false if it wasn't pending
+bool timer_pending(TimerNode *node);
+
+void timer_print_statistics();
+
+// Point-in-time copy of the expiry statistics. Cycles are spent in the
+// bottom half, including the callbacks it runs.
+typedef struct {
+  uint64_t num_expiry_runs, num_ticks_processed, num_expired;
+  uint64_t total_expiry_cycles, max_expiry_cycles;
+} TimerStatistics;
+
+void timer_get_statistics(TimerStatistics *statistics);
+
+// Returns early if the thread is woken up by something else
 void timer_thread_sleep(uint64_t milliseconds);
-void timer_cancel_thread_sleep(KernelThread *thread);
+
+// Same as timer_thread_sleep(), but accurate to well under a millisecond: the
+// last tick is spent spinning on the TSC (see time.h).
+void timer_thread_sleep_ns(uint64_t nanoseconds);
 
 // void timer_thread_sleep_internal(KernelThread *thread, uin64_t milliseconds);
 #endif
\ No newline at end of file
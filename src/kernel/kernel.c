@@ -6,6 +6,7 @@
 #include <common/mem_util.h>
 #include <kernel/util.h>
 
+#include <kernel/boot_timeline.h>
 #include <kernel/module_manager.h>
 
 #include <kernel/drivers/graphics.h>
@@ -23,17 +24,28 @@
 #include <kernel/drivers/cpuid.h>
 #include <kernel/drivers/exception.h>
 #include <kernel/drivers/gdt.h>
+#include <kernel/drivers/hpet.h>
 #include <kernel/drivers/interrupt.h>
 #include <kernel/drivers/random.h>
 #include <kernel/drivers/serial_port.h>
+#include <kernel/drivers/syscall.h>
 #include <kernel/drivers/text_output.h>
+#include <kernel/drivers/time.h>
 #include <kernel/drivers/timer.h>
 
+#include <kernel/memory/address_space.h>
 #include <kernel/memory/kmalloc.h>
 #include <kernel/memory/virtual_memory.h>
 
+#include <kernel/benchmarks/benchmark.h>
+
+#include <kernel/threading/fork_join.h>
 #include <kernel/threading/mutex/lock.h>
+#include <kernel/threading/rcu.h>
 #include <kernel/threading/scheduler.h>
+#include <kernel/threading/scheduler_statistics.h>
+#include <kernel/threading/task.h>
+#include <kernel/threading/work_queue.h>
 
 #include <common/build_info.h>
 
@@ -46,6 +58,7 @@ void kernel_main(KernelInfo info) {
   // Disable interrupts as we have no way to handle them now
   cli();
 
+  boot_timeline_mark("kernel_main");
   module_manager_init();
 
   serial_port_init();
@@ -61,6 +74,7 @@ void kernel_main(KernelInfo info) {
   text_output_set_foreground_color(0x00FFFF00);
   text_output_printf("Built from %s on %s\n\n", build_git_info, build_time);
   text_output_set_foreground_color(0x00FFFFFF);
+  boot_timeline_mark("output");
 
   lock_init(&kernel_lock);
 
@@ -71,14 +85,22 @@ void kernel_main(KernelInfo info) {
   apic_init();
   interrupt_init();
   exception_init();
+  boot_timeline_mark("cpu");
 
   // Now that interrupt/exception handlers are set up, we can enable interrupts
   sti();
 
   // Set up the dynamic memory subsystem
   vm_init(info.memory_map, info.mem_map_size, info.mem_map_descriptor_size);
+  syscall_init();
+  address_space_init();
+  boot_timeline_mark("memory");
 
+  hpet_init();
   timer_init();
+  boot_timeline_mark("timer");
+  time_init();  // Calibrates the TSC and APIC timer
+  boot_timeline_mark("calibration");
   keyboard_controller_init();
 
   // Set up random numbers and start collecting entropy
@@ -87,7 +109,15 @@ void kernel_main(KernelInfo info) {
   // Set up scheduler
   scheduler_init();
 
-  KernelThread *main_thread = thread_create(kernel_main_thread, NULL, 31, 4);
+  // Set up worker threads for interrupt bottom halves
+  work_queue_init();
+  rcu_init();
+  task_executor_init();
+  fork_join_init();
+  boot_timeline_mark("scheduler");
+
+  // Just below the timer bottom half (see work_queue_high_priority())
+  KernelThread *main_thread = thread_create(kernel_main_thread, NULL, 30, 4);
   thread_start(main_thread);
 
   // kernel_main will not execute any more after this call
@@ -102,7 +132,8 @@ void *keyboard_echo_thread() {
   lock_release(&kernel_lock);
 
   while (1) {
-    int c = keyboard_controller_read_char(false);
+    // Sleeps until a key is pressed
+    int c = keyboard_controller_read_char(true);
     if (c >= 0) {
       if (c == '\b' || c == 127) {
         text_output_backspace();
@@ -122,6 +153,7 @@ void *keyboard_echo_thread() {
 void *kernel_main_thread() {
   // Full acpica needs dynamic memory and scheduling
   acpi_enable_acpica();
+  boot_timeline_mark("acpica");
 
   // PCI needs APCICA to determine IRQ mappings
   pci_init();
@@ -132,10 +164,12 @@ void *kernel_main_thread() {
   // Once we've registered the PCI drivers, enumerate and instantiate PCI
   // drivers
   pci_enumerate_devices();
+  boot_timeline_mark("pci");
 
   // Set up low-priority thread to echo keyboard to screen
   KernelThread *keyboard_thread =
       thread_create(keyboard_echo_thread, NULL, 1, 1);
+  thread_set_scheduling_class(keyboard_thread, THREAD_CLASS_FAIR);
   thread_start(keyboard_thread);
 
   // Register filesystems
@@ -145,13 +179,32 @@ void *kernel_main_thread() {
 
   // Enumerate filesystems
   filesystem_tree_init();
+  boot_timeline_mark("filesystems");
+
+#ifdef KERNEL_BENCHMARKS
+  benchmark_run_all();
+#endif
 
   lock_acquire(&kernel_lock, -1);
+  boot_timeline_print();
+  interrupt_print_statistics();
+  interrupts_off_print_statistics();
+  keyboard_controller_print_statistics();
+  work_queue_print_statistics();
+  fork_join_print_statistics();
+  address_space_print_statistics();
+  timer_print_statistics();
+  thread_print_statistics();
+  scheduler_print_statistics();
+  scheduler_statistics_dump_serial();
+
   text_output_set_foreground_color(0x0000FF00);
   text_output_printf(
       "\nKernel initialization complete. Exiting kernel_main_thread.\n\n");
   text_output_set_foreground_color(0x00FFFFFF);
   lock_release(&kernel_lock);
 
+  scheduler_statistics_start_top(1000);
+
   return NULL;
 }
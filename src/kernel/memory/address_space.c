@@ -0,0 +1,330 @@
+#include <kernel/memory/address_space.h>
+#include <kernel/memory/virtual_memory.h>
+#include <kernel/util.h>
+
+#include <common/mem_util.h>
+#include <kernel/drivers/cpuid.h>
+#include <kernel/drivers/text_output.h>
+#include <kernel/memory/kmalloc.h>
+#include <kernel/threading/mutex/spinlock.h>
+
+#define ENTRIES_PER_TABLE 512
+#define USER_TOP_LEVEL_INDEX (ADDRESS_SPACE_USER_START >> 39)
+
+#define PTE_PRESENT (1ULL << 0)
+#define PTE_WRITABLE (1ULL << 1)
+#define PTE_USER (1ULL << 2)
+#define PTE_LARGE (1ULL << 7)
+#define PTE_ADDRESS_MASK 0x000FFFFFFFFFF000ULL
+
+#define CR3_NO_FLUSH (1ULL << 63)
+#define CR4_PCIDE (1 << 17)
+
+#define NUM_PCIDS 4096
+
+struct AddressSpace {
+  uint64_t *top_level;  // Physical, which is also where the kernel sees it
+  uint16_t pcid;        // 0 (the kernel's) if PCIDs aren't supported
+
+  // The TLB may hold entries for this PCID that don't match the page tables
+  // anymore, e.g. from a destroyed address space that had the same PCID. The
+  // next switch to it flushes them.
+  bool stale;
+  uint64_t generation;  // address_space_data.generation when last switched to
+};
+
+static struct {
+  AddressSpace kernel;
+  AddressSpace *current;
+
+  bool pcid_supported;
+  bool pcid_enabled;
+  uint64_t pcids_used[NUM_PCIDS / 64];  // PCID 0 is the kernel's
+
+  // Bumped to make every address space flush on its next switch
+  uint64_t generation;
+
+  // Held with interrupts disabled, the scheduler switches address spaces
+  // from an interrupt handler
+  SpinLock spinlock;
+
+  // Statistics
+  uint64_t num_switches, num_flushes;
+} address_space_data;
+
+void address_space_init() {
+  REQUIRE_MODULE("cpuid");
+  REQUIRE_MODULE("virtual_memory");
+
+  spinlock_init(&address_space_data.spinlock);
+  address_space_data.generation = 1;
+  address_space_data.num_switches = address_space_data.num_flushes = 0;
+  memset(address_space_data.pcids_used, 0,
+         sizeof(address_space_data.pcids_used));
+  address_space_data.pcids_used[0] = 1;
+
+  // The user region has to be free in the boot page tables, everything else
+  // is shared with the address spaces we create
+  AddressSpace *kernel = &address_space_data.kernel;
+  kernel->top_level = (uint64_t *)(vm_read_cr3() & PTE_ADDRESS_MASK);
+  kernel->pcid = 0;
+  kernel->stale = false;
+  kernel->generation = address_space_data.generation;
+  assert(!(kernel->top_level[USER_TOP_LEVEL_INDEX] & PTE_PRESENT));
+  address_space_data.current = kernel;
+
+  // CR4.PCIDE can only be set while the current PCID is 0, which also clears
+  // any cache control bits the firmware left in CR3
+  address_space_data.pcid_supported = cpuid_has_capability(CPUID_CAP_PCID);
+  address_space_data.pcid_enabled = address_space_data.pcid_supported;
+  if (address_space_data.pcid_supported) {
+    bool interrupts_enabled = interrupts_status();
+    cli();
+
+    vm_write_cr3((uint64_t)kernel->top_level);
+    vm_write_cr4(vm_read_cr4() | CR4_PCIDE);
+
+    // Only re-enable interrupts if they were enabled before
+    if (interrupts_enabled) sti();
+  }
+
+  REGISTER_MODULE("address_space");
+}
+
+AddressSpace *address_space_kernel() { return &address_space_data.kernel; }
+
+AddressSpace *address_space_current() { return address_space_data.current; }
+
+// Returns a free PCID, or 0 if there is none. The spinlock must be held.
+static uint16_t address_space_take_pcid() {
+  for (uint32_t i = 0; i < NUM_PCIDS / 64; ++i) {
+    const uint64_t used = address_space_data.pcids_used[i];
+    if (used == UINT64_MAX) continue;
+
+    const uint32_t bit = __builtin_ctzll(~used);
+    address_space_data.pcids_used[i] |= 1ULL << bit;
+    return i * 64 + bit;
+  }
+  return 0;
+}
+
+static uint64_t *address_space_alloc_table() {
+  uint64_t *table = vm_palloc(1);
+  if (table) memset(table, 0, VM_PAGE_SIZE);
+  return table;
+}
+
+AddressSpace *address_space_create() {
+  AddressSpace *space = kmalloc(sizeof(AddressSpace));
+  if (!space) return NULL;
+
+  space->top_level = address_space_alloc_table();
+  if (!space->top_level) {
+    kfree(space);
+    return NULL;
+  }
+
+  bool interrupts_enabled =
+      spinlock_acquire_irqsave(&address_space_data.spinlock);
+
+  space->pcid = 0;
+  if (address_space_data.pcid_supported) {
+    space->pcid = address_space_take_pcid();
+  }
+
+  spinlock_release_irqrestore(&address_space_data.spinlock,
+                              interrupts_enabled);
+
+  if (address_space_data.pcid_supported && space->pcid == 0) {
+    vm_pfree(space->top_level, 1);
+    kfree(space);
+    return NULL;
+  }
+
+  // Share every kernel mapping below the top level. The kernel's top level
+  // never changes after vm_init(), permission changes only touch the shared
+  // levels below it (see vm_set_user_accessible()), so the copy stays in
+  // sync.
+  memcpy(space->top_level, address_space_data.kernel.top_level, VM_PAGE_SIZE);
+  space->top_level[USER_TOP_LEVEL_INDEX] = 0;
+
+  // The PCID may have been used by a destroyed address space
+  space->stale = true;
+  space->generation = address_space_data.generation;
+
+  return space;
+}
+
+// Frees `table` (at `level`, 3 being the top one) and the tables below it
+static void address_space_free_tables(uint64_t *table, int level) {
+  if (level > 0) {
+    for (uint32_t i = 0; i < ENTRIES_PER_TABLE; ++i) {
+      if (table[i] & PTE_PRESENT) {
+        address_space_free_tables(
+            (uint64_t *)(table[i] & PTE_ADDRESS_MASK), level - 1);
+      }
+    }
+  }
+  vm_pfree(table, 1);
+}
+
+void address_space_destroy(AddressSpace *space) {
+  assert(space != &address_space_data.kernel);
+
+  bool interrupts_enabled =
+      spinlock_acquire_irqsave(&address_space_data.spinlock);
+
+  // A kernel thread may still be running on it
+  if (address_space_data.current == space) {
+    address_space_switch(&address_space_data.kernel);
+  }
+
+  if (space->pcid != 0) {
+    address_space_data.pcids_used[space->pcid / 64] &=
+        ~(1ULL << (space->pcid % 64));
+  }
+
+  spinlock_release_irqrestore(&address_space_data.spinlock,
+                              interrupts_enabled);
+
+  // Only the user region belongs to this address space
+  const uint64_t user_entry = space->top_level[USER_TOP_LEVEL_INDEX];
+  if (user_entry & PTE_PRESENT) {
+    address_space_free_tables((uint64_t *)(user_entry & PTE_ADDRESS_MASK), 2);
+  }
+  vm_pfree(space->top_level, 1);
+  kfree(space);
+}
+
+// Returns the last-level entry for `virtual_address`, creating the tables on
+// the way if `create` is set. NULL if they don't exist (or can't be created).
+// The spinlock must be held.
+static uint64_t *address_space_walk(AddressSpace *space,
+                                    uint64_t virtual_address, bool create) {
+  uint64_t *table = space->top_level;
+  for (int level = 3; level > 0; --level) {
+    uint64_t *entry =
+        &table[(virtual_address >> (12 + 9 * level)) % ENTRIES_PER_TABLE];
+    if (!(*entry & PTE_PRESENT)) {
+      if (!create) return NULL;
+
+      uint64_t *new_table = address_space_alloc_table();
+      if (!new_table) return NULL;
+
+      // The last level decides what is actually allowed
+      *entry = (uint64_t)new_table | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
+    }
+    assert(!(*entry & PTE_LARGE));
+
+    table = (uint64_t *)(*entry & PTE_ADDRESS_MASK);
+  }
+
+  return &table[(virtual_address >> 12) % ENTRIES_PER_TABLE];
+}
+
+// Drops the TLB entry for `virtual_address` of `space`. The spinlock must be
+// held.
+static void address_space_invalidate(AddressSpace *space,
+                                     uint64_t virtual_address) {
+  // INVLPG only reaches the current PCID
+  if (space == address_space_data.current) {
+    __asm__ volatile("invlpg (%0)" : : "r"(virtual_address) : "memory");
+  } else {
+    space->stale = true;
+  }
+}
+
+bool address_space_map(AddressSpace *space, uint64_t virtual_address,
+                       uint64_t physical_address, uint64_t flags) {
+  assert(space != &address_space_data.kernel);
+  assert(virtual_address >= ADDRESS_SPACE_USER_START &&
+         virtual_address < ADDRESS_SPACE_USER_END);
+  assert(virtual_address % VM_PAGE_SIZE == 0 &&
+         physical_address % VM_PAGE_SIZE == 0);
+
+  bool interrupts_enabled =
+      spinlock_acquire_irqsave(&address_space_data.spinlock);
+
+  uint64_t *entry = address_space_walk(space, virtual_address, true);
+  if (entry) {
+    const bool was_present = *entry & PTE_PRESENT;
+    *entry = physical_address | PTE_PRESENT |
+             (flags & (ADDRESS_SPACE_WRITABLE | ADDRESS_SPACE_USER));
+    if (was_present) address_space_invalidate(space, virtual_address);
+  }
+
+  spinlock_release_irqrestore(&address_space_data.spinlock,
+                              interrupts_enabled);
+
+  return entry != NULL;
+}
+
+uint64_t address_space_unmap(AddressSpace *space, uint64_t virtual_address) {
+  assert(virtual_address >= ADDRESS_SPACE_USER_START &&
+         virtual_address < ADDRESS_SPACE_USER_END);
+
+  bool interrupts_enabled =
+      spinlock_acquire_irqsave(&address_space_data.spinlock);
+
+  uint64_t physical_address = 0;
+  uint64_t *entry = address_space_walk(space, virtual_address, false);
+  if (entry && (*entry & PTE_PRESENT)) {
+    physical_address = *entry & PTE_ADDRESS_MASK;
+    *entry = 0;
+    address_space_invalidate(space, virtual_address);
+  }
+
+  spinlock_release_irqrestore(&address_space_data.spinlock,
+                              interrupts_enabled);
+
+  return physical_address;
+}
+
+void address_space_switch(AddressSpace *space) {
+  if (space == address_space_data.current) return;
+
+  uint64_t cr3 = (uint64_t)space->top_level;
+  bool flush = true;
+  if (address_space_data.pcid_enabled) {
+    flush = space->stale ||
+            space->generation != address_space_data.generation;
+    cr3 |= space->pcid;
+    if (!flush) cr3 |= CR3_NO_FLUSH;
+  }
+  // Without PCIDs everything is cached under PCID 0, which the write flushes
+
+  space->stale = false;
+  space->generation = address_space_data.generation;
+  vm_write_cr3(cr3);
+  address_space_data.current = space;
+
+  address_space_data.num_switches++;
+  if (flush) address_space_data.num_flushes++;
+}
+
+bool address_space_pcid_supported() {
+  return address_space_data.pcid_supported;
+}
+
+void address_space_set_pcid_enabled(bool enabled) {
+  assert(!enabled || address_space_data.pcid_supported);
+
+  bool interrupts_enabled =
+      spinlock_acquire_irqsave(&address_space_data.spinlock);
+
+  // Entries cached under the PCIDs while they were off may be out of date
+  address_space_data.pcid_enabled = enabled;
+  address_space_data.generation++;
+
+  spinlock_release_irqrestore(&address_space_data.spinlock,
+                              interrupts_enabled);
+}
+
+void address_space_print_statistics() {
+  text_output_printf(
+      "Address spaces: PCIDs %s, %lu switches, %lu of them flushed the TLB\n",
+      !address_space_data.pcid_supported ? "not supported"
+      : address_space_data.pcid_enabled  ? "enabled"
+                                         : "disabled",
+      address_space_data.num_switches, address_space_data.num_flushes);
+}
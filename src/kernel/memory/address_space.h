@@ -0,0 +1,57 @@
+#include <kernel/kernel_common.h>
+
+#ifndef _ADDRESS_SPACE_H
+#define _ADDRESS_SPACE_H
+
+// An address space owns a top-level page table. Every address space shares
+// the kernel's mappings (the identity map the kernel runs in), only the user
+// region below is private to each one.
+//
+// Switching address spaces normally flushes the TLB. When the CPU supports
+// PCIDs, each address space gets its own, its TLB entries survive switches
+// to other address spaces and switching back to it doesn't flush.
+//
+// Kernel threads run in whatever address space is loaded, only threads that
+// were given one (see thread_set_address_space()) make the scheduler switch.
+
+// One top-level entry, 512 GiB
+#define ADDRESS_SPACE_USER_START 0x00007F8000000000ULL
+#define ADDRESS_SPACE_USER_END 0x0000800000000000ULL
+
+// Mapping flags
+#define ADDRESS_SPACE_WRITABLE (1 << 1)
+#define ADDRESS_SPACE_USER (1 << 2)  // Accessible from ring 3
+
+typedef struct AddressSpace AddressSpace;
+
+void address_space_init();
+
+AddressSpace *address_space_kernel();   // The boot page tables
+AddressSpace *address_space_current();  // Currently loaded
+
+// Returns NULL if out of memory or PCIDs
+AddressSpace *address_space_create();
+
+// Frees the page tables, but not the pages that are still mapped. The
+// address space must not be used by any thread anymore.
+void address_space_destroy(AddressSpace *space);
+
+// Map/unmap one page at a page-aligned `virtual_address` in the user region.
+// map() returns false if out of memory, unmap() returns the physical address
+// that was mapped, or 0 if there was none.
+bool address_space_map(AddressSpace *space, uint64_t virtual_address,
+                       uint64_t physical_address, uint64_t flags);
+uint64_t address_space_unmap(AddressSpace *space, uint64_t virtual_address);
+
+// Loads `space`. Called by the scheduler, interrupts must be disabled.
+void address_space_switch(AddressSpace *space);
+
+bool address_space_pcid_supported();
+
+// Switches flush the TLB every time while PCIDs are off, for comparison.
+// They are on by default if the CPU supports them.
+void address_space_set_pcid_enabled(bool enabled);
+
+void address_space_print_statistics();
+
+#endif
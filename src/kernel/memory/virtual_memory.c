@@ -9,7 +9,7 @@
 #include <kernel/datastructures/list.h>
 #include <kernel/drivers/text_output.h>
 #include <kernel/memory/kmalloc.h>
-#include <kernel/threading/mutex/lock.h>
+#include <kernel/threading/mutex/spinlock.h>
 
 static struct {
   uint8_t *memory_map;
@@ -20,8 +20,10 @@ static struct {
   uint64_t num_free_pages;
   List free_list;
 
-  SpinLock spinlock;  // Use a spinlock here, since this is used before the
-                      // scheduler is initialized
+  // Use a spinlock here, since this is used before the scheduler is
+  // initialized. It's held with interrupts disabled so that a thread holding
+  // it can't be preempted by another one that wants it.
+  SpinLock spinlock;
 
 } virtual_memory_data;
 
@@ -46,6 +48,17 @@ typedef struct {
 
 #define PTES_PER_PAGE (EFI_PAGE_SIZE / sizeof(PageTableEntry))
 
+#define CR4_PGE (1 << 7)
+
+// Raw entry bits, for splitting large pages
+#define PTE_PRESENT (1ULL << 0)
+#define PTE_WRITABLE (1ULL << 1)
+#define PTE_USER (1ULL << 2)
+#define PTE_LARGE (1ULL << 7)
+#define PTE_PAT (1ULL << 7)         // In 4KiB pages, where PTE_LARGE would be
+#define PTE_LARGE_PAT (1ULL << 12)  // In 2MiB and 1GiB pages
+#define PTE_ADDRESS_MASK 0x000FFFFFFFFFF000ULL
+
 static inline uint64_t physical_start(FreeBlock *block) {
   return (uint64_t)block;
 }
@@ -143,15 +156,41 @@ PageTableEntry *follow_pte(PageTableEntry entry) {
   return (PageTableEntry *)(intptr_t)(entry.address << 12);
 }
 
-void vm_write_cr3(uint64_t cr3) { __asm__("movq %0, %%cr3" : : "r"(cr3)); }
+void vm_write_cr3(uint64_t cr3) {
+  __asm__ volatile("movq %0, %%cr3" : : "r"(cr3) : "memory");
+}
 
 uint64_t vm_read_cr3() {
   uint64_t cr3;
-  __asm__("movq %%cr3, %0" : "=r"(cr3));
+  __asm__ volatile("movq %%cr3, %0" : "=r"(cr3));
 
   return cr3;
 }
 
+void vm_write_cr4(uint64_t cr4) {
+  __asm__ volatile("movq %0, %%cr4" : : "r"(cr4) : "memory");
+}
+
+uint64_t vm_read_cr4() {
+  uint64_t cr4;
+  __asm__ volatile("movq %%cr4, %0" : "=r"(cr4));
+
+  return cr4;
+}
+
+void vm_flush_tlb_all() {
+  bool interrupts_enabled = interrupts_status();
+  cli();
+
+  // Any change to CR4.PGE flushes everything
+  const uint64_t cr4 = vm_read_cr4();
+  vm_write_cr4(cr4 ^ CR4_PGE);
+  vm_write_cr4(cr4);
+
+  // Only re-enable interrupts if they were enabled before
+  if (interrupts_enabled) sti();
+}
+
 void vm_init(uint8_t *memory_map, uint64_t mem_map_size,
              uint64_t mem_map_descriptor_size) {
   assert(sizeof(FreeBlock) < VM_PAGE_SIZE);
@@ -168,6 +207,18 @@ void vm_init(uint8_t *memory_map, uint64_t mem_map_size,
 
   setup_free_memory();
 
+  // Every address space copies the top level of the identity map (see
+  // address_space_create()), so it must never change. Its entries get the
+  // user bit once, here, and vm_set_user_accessible() only changes the
+  // levels below, which are shared. The bit grants nothing by itself, every
+  // level has to allow the access.
+  uint64_t *top_level =
+      (uint64_t *)(vm_read_cr3() & BOTTOM_N_BITS_OFF(VM_PAGE_BIT_SIZE));
+  for (uint64_t i = 0; i < PTES_PER_PAGE; ++i) {
+    if (top_level[i] & PTE_PRESENT) top_level[i] |= PTE_USER;
+  }
+  vm_flush_tlb_all();
+
   REGISTER_MODULE("virtual_memory");
 
   kmalloc_init();
@@ -175,9 +226,8 @@ void vm_init(uint8_t *memory_map, uint64_t mem_map_size,
 
 uintptr_t vm_max_physical_address() { return virtual_memory_data.physical_end; }
 
-void *vm_palloc(uint64_t num_pages) {
-  spinlock_acquire(&virtual_memory_data.spinlock);
-
+// vm_palloc() with the spinlock already held
+static void *vm_palloc_locked(uint64_t num_pages) {
   FreeBlock *chunk = (FreeBlock *)list_head(&virtual_memory_data.free_list);
 
   while (chunk) {
@@ -201,13 +251,22 @@ void *vm_palloc(uint64_t num_pages) {
     chunk->num_pages -= num_pages;
   }
 
-  spinlock_release(&virtual_memory_data.spinlock);
-
   return last_pages;
 }
 
+void *vm_palloc(uint64_t num_pages) {
+  bool interrupts_enabled =
+      spinlock_acquire_irqsave(&virtual_memory_data.spinlock);
+  void *pages = vm_palloc_locked(num_pages);
+  spinlock_release_irqrestore(&virtual_memory_data.spinlock,
+                              interrupts_enabled);
+
+  return pages;
+}
+
 void *vm_pmap(uint64_t virtual_address, uint64_t num_pages) {
-  spinlock_acquire(&virtual_memory_data.spinlock);
+  bool interrupts_enabled =
+      spinlock_acquire_irqsave(&virtual_memory_data.spinlock);
 
   virtual_address =
       (virtual_address &
@@ -226,6 +285,8 @@ void *vm_pmap(uint64_t virtual_address, uint64_t num_pages) {
   }
 
   if (chunk == NULL) {
+    spinlock_release_irqrestore(&virtual_memory_data.spinlock,
+                                interrupts_enabled);
     return NULL;  // We can't fulfill the request
   }
 
@@ -248,15 +309,99 @@ void *vm_pmap(uint64_t virtual_address, uint64_t num_pages) {
                       &new_block->entry);
   }
 
-  spinlock_release(&virtual_memory_data.spinlock);
+  spinlock_release_irqrestore(&virtual_memory_data.spinlock,
+                              interrupts_enabled);
 
   return pages;
 }
 
 void vm_pfree(void *physical_address, uint64_t num_pages) {
-  spinlock_acquire(&virtual_memory_data.spinlock);
+  bool interrupts_enabled =
+      spinlock_acquire_irqsave(&virtual_memory_data.spinlock);
   vm_add_to_free_list((uint64_t)physical_address, num_pages);
-  spinlock_release(&virtual_memory_data.spinlock);
+  spinlock_release_irqrestore(&virtual_memory_data.spinlock,
+                              interrupts_enabled);
+}
+
+// Replaces the large page `entry` at `level` (1 for 2MiB, 2 for 1GiB) with a
+// table of pages one level down, mapping the same memory with the same
+// attributes. The spinlock must be held.
+static void vm_split_large_page(PageTableEntry *entry, int level) {
+  uint64_t *table = vm_palloc_locked(1);
+  assert(table);
+
+  const uint64_t large = *(uint64_t *)entry;
+  const uint64_t address = large & PTE_ADDRESS_MASK & ~PTE_LARGE_PAT;
+  const uint64_t page_size = 1ULL << (VM_PAGE_BIT_SIZE + 9 * (level - 1));
+
+  // 4KiB pages keep the PAT bit where large pages have the size bit
+  uint64_t flags = large & ~PTE_ADDRESS_MASK;
+  if (level == 1) {
+    flags &= ~PTE_LARGE;
+    if (large & PTE_LARGE_PAT) flags |= PTE_PAT;
+  } else {
+    flags |= large & PTE_LARGE_PAT;
+  }
+
+  for (uint64_t i = 0; i < PTES_PER_PAGE; ++i) {
+    table[i] = (address + i * page_size) | flags;
+  }
+  *(uint64_t *)entry =
+      (uint64_t)table | PTE_PRESENT | PTE_WRITABLE | (large & PTE_USER);
+}
+
+// Returns the 4KiB entry for `page` in the identity map, splitting large
+// pages on the way. With `user_path`, the entries between it and the top
+// level (which vm_init() already set up) get the user bit, which ring 3 needs
+// at every level: it grants nothing by itself, since the other 4KiB entries
+// under them keep theirs clear. The spinlock must be held.
+static PageTableEntry *vm_identity_map_entry(uint64_t page, bool user_path) {
+  PageTableEntry *table =
+      (PageTableEntry *)(vm_read_cr3() & BOTTOM_N_BITS_OFF(VM_PAGE_BIT_SIZE));
+  for (int level = 3; level > 0; --level) {
+    const uint64_t index =
+        (page >> (VM_PAGE_BIT_SIZE + 9 * level)) % PTES_PER_PAGE;
+    PageTableEntry *entry = &table[index];
+    assert(entry->present);
+
+    if (entry->page_size) vm_split_large_page(entry, level);
+    if (level == 3) {
+      assert(entry->user_accessable);
+    } else if (user_path) {
+      entry->user_accessable = 1;
+    }
+    table = follow_pte(*entry);
+  }
+
+  PageTableEntry *entry = &table[(page >> VM_PAGE_BIT_SIZE) % PTES_PER_PAGE];
+  assert(entry->present);
+  return entry;
+}
+
+static void vm_set_user_bit(void *address, uint64_t size, bool user) {
+  bool interrupts_enabled =
+      spinlock_acquire_irqsave(&virtual_memory_data.spinlock);
+
+  const uint64_t start =
+      (uint64_t)address & BOTTOM_N_BITS_OFF(VM_PAGE_BIT_SIZE);
+  const uint64_t end = (uint64_t)address + size;
+  for (uint64_t page = start; page < end; page += VM_PAGE_SIZE) {
+    vm_identity_map_entry(page, user)->user_accessable = user;
+  }
+
+  spinlock_release_irqrestore(&virtual_memory_data.spinlock,
+                              interrupts_enabled);
+
+  // The identity map is cached under every address space's PCID
+  vm_flush_tlb_all();
+}
+
+void vm_set_user_accessible(void *address, uint64_t size) {
+  vm_set_user_bit(address, size, true);
+}
+
+void vm_clear_user_accessible(void *address, uint64_t size) {
+  vm_set_user_bit(address, size, false);
 }
 
 void vm_map(uint64_t physical_address, void *virtual_address, uint64_t flags) {
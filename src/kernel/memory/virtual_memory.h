@@ -15,6 +15,23 @@ void *vm_palloc(uint64_t num_pages);
 void *vm_pmap(uint64_t virtual_address, uint64_t num_pages);
 void vm_pfree(void *virtual_address, uint64_t num_pages);
 
+// Lets ring 3 code access the pages in [address, address + size) of the
+// identity map, which every address space shares. Large pages in the range
+// are split, so only the 4KiB pages it touches become accessible. Use an
+// AddressSpace for memory that only one user thread should see.
+void vm_set_user_accessible(void *address, uint64_t size);
+// Takes the access back, from every page the range touches. Memory that was
+// made accessible must go through this before it is freed.
+void vm_clear_user_accessible(void *address, uint64_t size);
+
+uint64_t vm_read_cr3();
+void vm_write_cr3(uint64_t cr3);
+uint64_t vm_read_cr4();
+void vm_write_cr4(uint64_t cr4);
+
+// Invalidates every TLB entry, global ones and those of every PCID included
+void vm_flush_tlb_all();
+
 void vm_map(uint64_t physical_address, void *virtual_address, uint64_t flags);
 void vm_unmap(void *virtual_address);
 
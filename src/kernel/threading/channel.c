@@ -0,0 +1,238 @@
+#include <kernel/threading/channel.h>
+#include <kernel/threading/scheduler.h>
+#include <kernel/threading/wait_queue.h>
+#include <kernel/util.h>
+
+#include <kernel/drivers/timer.h>
+#include <kernel/memory/kmalloc.h>
+
+#define CHANNEL_NO_DEADLINE UINT64_MAX
+
+// Everything is protected by disabling preemption. Whoever frees space or
+// adds a message wakes one waiter on the other side, which checks the channel
+// again once it runs: someone else may have gotten there first.
+struct _Channel {
+  uint32_t head;  // Oldest message
+  uint32_t count;
+  uint32_t capacity;
+  bool closed;
+
+  WaitQueue senders;    // Waiting for space
+  WaitQueue receivers;  // Waiting for a message
+
+  void *messages[0];
+};
+
+Channel *channel_alloc(uint32_t capacity) {
+  assert(capacity > 0);
+
+  Channel *channel = kmalloc(sizeof(Channel) + capacity * sizeof(void *));
+  if (!channel) return NULL;
+
+  channel->head = channel->count = 0;
+  channel->capacity = capacity;
+  channel->closed = false;
+  wait_queue_init(&channel->senders);
+  wait_queue_init(&channel->receivers);
+
+  return channel;
+}
+
+void channel_free(Channel *channel) {
+  assert(wait_queue_empty(&channel->senders) &&
+         wait_queue_empty(&channel->receivers));
+  kfree(channel);
+}
+
+// head and count are both below capacity, so a conditional subtraction is
+// enough to wrap the indices, no division needed
+static void channel_push(Channel *channel, void *message) {
+  uint32_t tail = channel->head + channel->count;
+  if (tail >= channel->capacity) tail -= channel->capacity;
+  channel->messages[tail] = message;
+  channel->count++;
+
+  wait_queue_wake_one(&channel->receivers);
+}
+
+static void *channel_pop(Channel *channel) {
+  void *message = channel->messages[channel->head];
+  if (++channel->head == channel->capacity) channel->head = 0;
+  channel->count--;
+
+  wait_queue_wake_one(&channel->senders);
+  return message;
+}
+
+static uint64_t channel_deadline(int64_t timeout) {
+  if (timeout < 0) return CHANNEL_NO_DEADLINE;
+  return timer_ticks() + timeout * TIMER_FREQUENCY / 1000;
+}
+
+// Milliseconds left until `deadline`, rounded up so we don't give up early.
+// -1 if there is no deadline, 0 once it has passed.
+static int64_t channel_remaining(uint64_t deadline) {
+  if (deadline == CHANNEL_NO_DEADLINE) return -1;
+
+  const uint64_t now = timer_ticks();
+  if (now >= deadline) return 0;
+  return ((deadline - now) * 1000 + TIMER_FREQUENCY - 1) / TIMER_FREQUENCY;
+}
+
+// Sleeps on `queue` until woken up, returns false if `deadline` passed first
+static bool channel_wait(WaitQueue *queue, uint64_t deadline) {
+  const int64_t timeout = channel_remaining(deadline);
+  if (timeout == 0) return false;
+
+  WaitQueueEntry entry;
+  wait_queue_entry_init(&entry, scheduler_current_thread(), 0);
+  return wait_queue_wait(queue, &entry, timeout);
+}
+
+uint32_t channel_send_batch(Channel *channel, void **messages, uint32_t count,
+                            int64_t timeout) {
+  const uint64_t deadline = channel_deadline(timeout);
+  uint32_t num_sent = 0;
+
+  preempt_disable();
+
+  while (!channel->closed && channel->count == channel->capacity) {
+    if (!channel_wait(&channel->senders, deadline)) break;
+  }
+
+  if (!channel->closed) {
+    while (num_sent < count && channel->count < channel->capacity) {
+      channel_push(channel, messages[num_sent++]);
+    }
+  }
+
+  preempt_enable();
+
+  return num_sent;
+}
+
+uint32_t channel_receive_batch(Channel *channel, void **messages,
+                               uint32_t count, int64_t timeout) {
+  const uint64_t deadline = channel_deadline(timeout);
+  uint32_t num_received = 0;
+
+  preempt_disable();
+
+  while (!channel->closed && channel->count == 0) {
+    if (!channel_wait(&channel->receivers, deadline)) break;
+  }
+
+  while (num_received < count && channel->count > 0) {
+    messages[num_received++] = channel_pop(channel);
+  }
+
+  preempt_enable();
+
+  return num_received;
+}
+
+bool channel_send(Channel *channel, void *message, int64_t timeout) {
+  return channel_send_batch(channel, &message, 1, timeout) == 1;
+}
+
+bool channel_receive(Channel *channel, void **message, int64_t timeout) {
+  return channel_receive_batch(channel, message, 1, timeout) == 1;
+}
+
+void channel_close(Channel *channel) {
+  preempt_disable();
+
+  channel->closed = true;
+  wait_queue_wake_all(&channel->senders);
+  wait_queue_wake_all(&channel->receivers);
+
+  preempt_enable();
+}
+
+uint32_t channel_count(Channel *channel) { return channel->count; }
+
+static WaitQueue *channel_case_queue(ChannelCase *channel_case) {
+  Channel *channel = channel_case->channel;
+  return channel_case->operation == CHANNEL_SEND ? &channel->senders
+                                                 : &channel->receivers;
+}
+
+// Performs `channel_case` if it can go ahead right away. Sets `open` if it
+// could still go ahead later.
+static bool channel_case_try(ChannelCase *channel_case, bool *open) {
+  Channel *channel = channel_case->channel;
+
+  if (channel_case->operation == CHANNEL_SEND) {
+    if (channel->closed) return false;
+    *open = true;
+    if (channel->count == channel->capacity) return false;
+    channel_push(channel, channel_case->message);
+  } else {
+    if (channel->count == 0) {
+      if (!channel->closed) *open = true;
+      return false;
+    }
+    channel_case->message = channel_pop(channel);
+  }
+  return true;
+}
+
+int channel_select(ChannelCase *cases, uint32_t count, int64_t timeout) {
+  assert(count > 0 && count <= CHANNEL_MAX_SELECT_CASES);
+
+  const uint64_t deadline = channel_deadline(timeout);
+  KernelThread *thread = scheduler_current_thread();
+  WaitQueueEntry entries[CHANNEL_MAX_SELECT_CASES];
+  bool woken[CHANNEL_MAX_SELECT_CASES] = {false};
+  int selected = -1;
+
+  preempt_disable();
+
+  while (true) {
+    bool open = false;
+    for (uint32_t i = 0; i < count && selected < 0; ++i) {
+      if (channel_case_try(&cases[i], &open)) selected = i;
+    }
+    if (selected >= 0 || !open) break;
+
+    const int64_t remaining = channel_remaining(deadline);
+    if (remaining == 0) break;
+
+    // Wait on every channel at once, whichever wakes us first wins
+    for (uint32_t i = 0; i < count; ++i) {
+      wait_queue_entry_init(&entries[i], thread, 0);
+      wait_queue_add(channel_case_queue(&cases[i]), &entries[i]);
+    }
+
+    // Same as wait_queue_sleep(), the timer returns early if we're woken
+    bool any_woken = false;
+    if (remaining == -1) {
+      while (!any_woken) {
+        thread_sleep(thread);
+        for (uint32_t i = 0; i < count; ++i) any_woken |= entries[i].woken;
+      }
+    } else {
+      timer_thread_sleep(remaining);
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+      if (entries[i].woken) {
+        woken[i] = true;
+      } else {
+        wait_queue_remove(channel_case_queue(&cases[i]), &entries[i]);
+      }
+    }
+  }
+
+  // Every wake was meant for one waiter. Pass on the ones we didn't use, or
+  // whoever else waits on those channels could sleep through a message.
+  for (uint32_t i = 0; i < count; ++i) {
+    if (woken[i] && (int)i != selected) {
+      wait_queue_wake_one(channel_case_queue(&cases[i]));
+    }
+  }
+
+  preempt_enable();
+
+  return selected;
+}
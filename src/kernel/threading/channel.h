@@ -0,0 +1,66 @@
+#include <kernel/kernel_common.h>
+
+#ifndef _CHANNEL_H
+#define _CHANNEL_H
+
+// Bounded message queues between threads, for subsystems built as pipelines.
+// Messages are pointers: sending one hands the buffer it points to over to the
+// receiver, nothing is copied. The sender must not touch a buffer after
+// sending it.
+//
+// Timeouts are in milliseconds, -1 means wait forever and 0 means do not wait.
+// Channels are for threads only, interrupt handlers should use an SpscRing.
+
+typedef struct _Channel Channel;
+
+Channel *channel_alloc(uint32_t capacity);
+void channel_free(Channel *channel);  // Nobody may be waiting on it
+
+// Return false on timeout, or if the channel is closed. A closed channel
+// still delivers the messages that were sent before it was closed.
+bool channel_send(Channel *channel, void *message, int64_t timeout);
+bool channel_receive(Channel *channel, void **message, int64_t timeout);
+
+// Send/receive as many of `count` messages as possible at once, waiting only
+// until the first one can be. Return the number of messages sent/received.
+uint32_t channel_send_batch(Channel *channel, void **messages, uint32_t count,
+                            int64_t timeout);
+uint32_t channel_receive_batch(Channel *channel, void **messages,
+                               uint32_t count, int64_t timeout);
+
+// Wakes everyone waiting on `channel`. Sends fail from now on, receives fail
+// once the channel is empty.
+void channel_close(Channel *channel);
+
+uint32_t channel_count(Channel *channel);
+
+#define CHANNEL_MAX_SELECT_CASES 8
+
+typedef enum { CHANNEL_SEND, CHANNEL_RECEIVE } ChannelOperation;
+
+typedef struct {
+  Channel *channel;
+  ChannelOperation operation;
+  void *message;  // Sent, or where the received message is stored
+} ChannelCase;
+
+// Performs the first of `cases` that can go ahead, waiting until one can.
+// Returns its index, or -1 on timeout or if every channel is closed. Closed
+// channels are skipped.
+int channel_select(ChannelCase *cases, uint32_t count, int64_t timeout);
+
+// Declares wrappers that only send and receive pointers to `type`, e.g.
+// DECLARE_TYPED_CHANNEL(request_channel, Request) declares
+// request_channel_send(Channel *, Request *, int64_t) and
+// request_channel_receive(Channel *, Request **, int64_t).
+#define DECLARE_TYPED_CHANNEL(name, type)                               \
+  static inline bool name##_send(Channel *channel, type *message,       \
+                                 int64_t timeout) {                     \
+    return channel_send(channel, message, timeout);                     \
+  }                                                                     \
+  static inline bool name##_receive(Channel *channel, type **message,   \
+                                    int64_t timeout) {                  \
+    return channel_receive(channel, (void **)message, timeout);         \
+  }
+
+#endif
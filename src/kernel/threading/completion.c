@@ -0,0 +1,267 @@
+#include <kernel/threading/completion.h>
+#include <kernel/threading/scheduler.h>
+#include <kernel/util.h>
+
+#include <kernel/drivers/timer.h>
+
+#define COMPLETION_DONE_ALL UINT32_MAX
+
+// WaitQueueEntry values, to tell the two kinds of waiters apart
+#define COMPLETION_WAIT_THREAD 0
+#define COMPLETION_WAIT_ASYNC 1
+
+struct CompletionWaiter;
+
+// One per completion being waited on, in CompletionWaiter
+typedef struct {
+  WaitQueueEntry wait;
+  Completion *completion;
+  struct CompletionWaiter *waiter;
+  bool queued;     // In `completion`'s wait queue
+  bool signalled;  // Consumed a completion for the waiter
+} CompletionEntry;
+
+// Lives on the stack of the waiting thread
+typedef struct CompletionWaiter {
+  KernelThread *thread;
+  CompletionEntry *entries;  // One per completion, also on the stack
+  uint32_t num_entries;
+
+  uint32_t num_remaining;  // Completions still needed to wake up
+  int signalled_index;     // First entry that was signalled, -1 if none
+  volatile bool woken;
+} CompletionWaiter;
+
+void completion_init(Completion *completion) {
+  completion->done = 0;
+  wait_queue_init(&completion->waiters);
+}
+
+static void completion_entry_signal(CompletionWaiter *waiter, uint32_t index) {
+  waiter->entries[index].signalled = true;
+  if (waiter->signalled_index < 0) waiter->signalled_index = index;
+  waiter->num_remaining--;
+}
+
+// Hands one completion to the waiter of `entry`, waking it up if that was the
+// last one it needed. Interrupts must be disabled.
+static void completion_signal(CompletionEntry *entry) {
+  CompletionWaiter *waiter = entry->waiter;
+
+  wait_queue_remove(&entry->completion->waiters, &entry->wait);
+  entry->queued = false;
+  completion_entry_signal(waiter, entry - waiter->entries);
+  if (waiter->num_remaining > 0) return;
+
+  // A wait_any() is done with the other completions, make sure they don't
+  // hand it anything else
+  for (uint32_t i = 0; i < waiter->num_entries; ++i) {
+    CompletionEntry *other = &waiter->entries[i];
+    if (other->queued) {
+      wait_queue_remove(&other->completion->waiters, &other->wait);
+      other->queued = false;
+    }
+  }
+
+  waiter->woken = true;
+  thread_wake(waiter->thread);
+}
+
+static void completion_signal_async(CompletionAsyncWait *wait) {
+  wait_queue_remove(&wait->completion->waiters, &wait->wait);
+  wait->queued = false;
+  wait->callback(wait);
+}
+
+// Hands one completion to `head`, the first waiter of a completion
+static void completion_signal_head(WaitQueueEntry *head) {
+  if (head->value == COMPLETION_WAIT_ASYNC) {
+    completion_signal_async(container_of(head, CompletionAsyncWait, wait));
+  } else {
+    completion_signal(container_of(head, CompletionEntry, wait));
+  }
+}
+
+// completion_complete() without disabling preemption
+static void completion_complete_locked(Completion *completion) {
+  if (completion->done == COMPLETION_DONE_ALL) return;
+
+  WaitQueueEntry *head = wait_queue_head(&completion->waiters);
+  if (head) {
+    completion_signal_head(head);
+  } else {
+    completion->done++;
+  }
+}
+
+void completion_reinit(Completion *completion) {
+  preempt_disable();
+
+  completion->done = 0;
+
+  preempt_enable();
+}
+
+void completion_complete(Completion *completion) {
+  preempt_disable();
+
+  completion_complete_locked(completion);
+
+  preempt_enable();
+}
+
+void completion_complete_all(Completion *completion) {
+  preempt_disable();
+
+  completion->done = COMPLETION_DONE_ALL;
+
+  WaitQueueEntry *head;
+  while ((head = wait_queue_head(&completion->waiters))) {
+    completion_signal_head(head);
+  }
+
+  preempt_enable();
+}
+
+bool completion_done(Completion *completion) { return completion->done > 0; }
+
+// Takes a completion that happened while nobody was waiting
+static bool completion_try_consume(Completion *completion) {
+  if (completion->done == 0) return false;
+  if (completion->done != COMPLETION_DONE_ALL) completion->done--;
+  return true;
+}
+
+// Waits for one (`wait_all` false) or all of `completions`, returns whether
+// the wait was satisfied
+static bool completion_wait_objects(CompletionWaiter *waiter,
+                                    Completion **completions, uint32_t count,
+                                    bool wait_all, int64_t timeout) {
+  assert(count > 0);
+
+  preempt_disable();
+
+  waiter->thread = scheduler_current_thread();
+  waiter->num_entries = count;
+  waiter->num_remaining = wait_all ? count : 1;
+  waiter->signalled_index = -1;
+  waiter->woken = false;
+
+  for (uint32_t i = 0; i < count; ++i) {
+    CompletionEntry *entry = &waiter->entries[i];
+    entry->completion = completions[i];
+    entry->waiter = waiter;
+    entry->queued = false;
+    entry->signalled = false;
+  }
+
+  // Take whatever has already completed
+  for (uint32_t i = 0; i < count && waiter->num_remaining > 0; ++i) {
+    if (completion_try_consume(completions[i])) {
+      completion_entry_signal(waiter, i);
+    }
+  }
+
+  if (waiter->num_remaining > 0 && timeout != 0) {
+    for (uint32_t i = 0; i < count; ++i) {
+      CompletionEntry *entry = &waiter->entries[i];
+      if (entry->signalled) continue;
+
+      wait_queue_entry_init(&entry->wait, waiter->thread,
+                            COMPLETION_WAIT_THREAD);
+      wait_queue_add(&entry->completion->waiters, &entry->wait);
+      entry->queued = true;
+    }
+
+    // Same as wait_queue_sleep(), the timer returns early if we're woken
+    if (timeout == -1) {
+      while (!waiter->woken) thread_sleep(waiter->thread);
+    } else if (!waiter->woken) {
+      timer_thread_sleep(timeout);
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+      CompletionEntry *entry = &waiter->entries[i];
+      if (entry->queued) {
+        wait_queue_remove(&entry->completion->waiters, &entry->wait);
+        entry->queued = false;
+      }
+    }
+  }
+
+  const bool satisfied = waiter->num_remaining == 0;
+
+  // A timed out wait_all() gives back what it got
+  if (!satisfied) {
+    for (uint32_t i = 0; i < count; ++i) {
+      if (waiter->entries[i].signalled) {
+        completion_complete_locked(completions[i]);
+      }
+    }
+  }
+
+  preempt_enable();
+
+  return satisfied;
+}
+
+bool completion_wait(Completion *completion, int64_t timeout) {
+  CompletionEntry entry;
+  CompletionWaiter waiter = {.entries = &entry};
+  return completion_wait_objects(&waiter, &completion, 1, false, timeout);
+}
+
+int completion_wait_any(Completion **completions, uint32_t count,
+                        int64_t timeout) {
+  assert(count <= COMPLETION_MAX_WAIT_OBJECTS);
+
+  CompletionEntry entries[COMPLETION_MAX_WAIT_OBJECTS];
+  CompletionWaiter waiter = {.entries = entries};
+  if (!completion_wait_objects(&waiter, completions, count, false, timeout)) {
+    return -1;
+  }
+  return waiter.signalled_index;
+}
+
+bool completion_wait_all(Completion **completions, uint32_t count,
+                         int64_t timeout) {
+  assert(count <= COMPLETION_MAX_WAIT_OBJECTS);
+
+  CompletionEntry entries[COMPLETION_MAX_WAIT_OBJECTS];
+  CompletionWaiter waiter = {.entries = entries};
+  return completion_wait_objects(&waiter, completions, count, true, timeout);
+}
+
+bool completion_wait_async(Completion *completion, CompletionAsyncWait *wait,
+                           KernelThread *thread, CompletionCallback callback) {
+  wait->completion = completion;
+  wait->callback = callback;
+  wait->queued = false;
+
+  preempt_disable();
+
+  const bool consumed = completion_try_consume(completion);
+  if (!consumed) {
+    wait_queue_entry_init(&wait->wait, thread, COMPLETION_WAIT_ASYNC);
+    wait_queue_add(&completion->waiters, &wait->wait);
+    wait->queued = true;
+  }
+
+  preempt_enable();
+
+  return consumed;
+}
+
+bool completion_cancel_async(CompletionAsyncWait *wait) {
+  preempt_disable();
+
+  const bool cancelled = wait->queued;
+  if (cancelled) {
+    wait_queue_remove(&wait->completion->waiters, &wait->wait);
+    wait->queued = false;
+  }
+
+  preempt_enable();
+
+  return cancelled;
+}
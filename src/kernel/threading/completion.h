@@ -0,0 +1,65 @@
+#include <kernel/kernel_common.h>
+#include <kernel/threading/wait_queue.h>
+
+#ifndef _COMPLETION_H
+#define _COMPLETION_H
+
+// A completion counts events (e.g. finished I/O requests) that threads wait
+// for. Each completion_complete() satisfies exactly one wait, either one that
+// is already sleeping or the next one to come. completion_complete_all()
+// satisfies every wait from then on, until completion_reinit().
+//
+// A thread can wait on several completions at once, either for any one of
+// them or for all of them, so a single thread can serve many devices.
+
+#define COMPLETION_MAX_WAIT_OBJECTS 16
+
+typedef struct {
+  uint32_t done;      // Unconsumed completions, UINT32_MAX after complete_all
+  WaitQueue waiters;
+} Completion;
+
+void completion_init(Completion *completion);
+void completion_reinit(Completion *completion);  // Drops unconsumed completions
+
+void completion_complete(Completion *completion);
+void completion_complete_all(Completion *completion);
+bool completion_done(Completion *completion);  // True if a wait wouldn't block
+
+// Timeouts are in milliseconds, -1 means wait forever and 0 means don't wait.
+
+// Returns false on timeout
+bool completion_wait(Completion *completion, int64_t timeout);
+
+// Consumes one completion from the first of `completions` that completes and
+// returns its index, or -1 on timeout
+int completion_wait_any(Completion **completions, uint32_t count,
+                        int64_t timeout);
+
+// Consumes one completion from each of `completions`. On timeout nothing is
+// consumed and false is returned.
+bool completion_wait_all(Completion **completions, uint32_t count,
+                         int64_t timeout);
+
+// Waits that don't block, for code that can't sleep (e.g. async tasks, see
+// task.h). The callback runs with preemption disabled once a completion has
+// been consumed for the wait, and must not sleep.
+typedef struct CompletionAsyncWait CompletionAsyncWait;
+typedef void (*CompletionCallback)(CompletionAsyncWait *wait);
+
+struct CompletionAsyncWait {
+  WaitQueueEntry wait;
+  Completion *completion;
+  CompletionCallback callback;
+  volatile bool queued;  // Cleared when a completion is handed over
+};
+
+// Consumes a completion and returns true if one is available. Otherwise
+// queues `wait`, ordered like `thread` would be, and returns false.
+bool completion_wait_async(Completion *completion, CompletionAsyncWait *wait,
+                           KernelThread *thread, CompletionCallback callback);
+
+// Returns false if a completion was already handed to `wait`
+bool completion_cancel_async(CompletionAsyncWait *wait);
+
+#endif
@@ -0,0 +1,238 @@
+#include <kernel/threading/fork_join.h>
+#include <kernel/threading/scheduler.h>
+#include <kernel/threading/thread.h>
+#include <kernel/threading/wait_queue.h>
+#include <kernel/util.h>
+
+#include <kernel/drivers/text_output.h>
+
+// There is only one CPU for now, so the workers take turns on it. More than
+// one still lets the others go on while one of them is blocked.
+#define FORK_JOIN_NUM_WORKERS 4
+#define FORK_JOIN_DEQUE_SIZE 256
+#define FORK_JOIN_STACK_PAGES 8
+
+// Below the async task executor, CPU-bound jobs shouldn't hold up drivers
+#define FORK_JOIN_PRIORITY 10
+
+// The deques are protected by disabling preemption. The owner pushes and pops
+// at the bottom, thieves take from the top. The indices increase forever and
+// are wrapped on access.
+typedef struct {
+  KernelThread *thread;
+  ForkJoinTask *tasks[FORK_JOIN_DEQUE_SIZE];
+  uint32_t top, bottom;
+
+  // Statistics
+  uint64_t num_tasks, num_steals;
+} ForkJoinWorker;
+
+static struct {
+  ForkJoinWorker workers[FORK_JOIN_NUM_WORKERS];
+  WaitQueue idle;  // Workers that found nothing to run or steal
+
+  uint32_t next_worker;  // Gets the next task spawned outside the pool
+  uint64_t num_inline;   // Tasks that ran right away, the deque was full
+  uint64_t num_joiner_tasks;  // Run by joiners outside the pool
+} fork_join_data;
+
+static ForkJoinWorker *fork_join_current_worker() {
+  KernelThread *thread = scheduler_current_thread();
+  for (uint32_t i = 0; i < FORK_JOIN_NUM_WORKERS; ++i) {
+    if (fork_join_data.workers[i].thread == thread) {
+      return &fork_join_data.workers[i];
+    }
+  }
+  return NULL;
+}
+
+// Returns `worker`'s newest task, or the oldest task of another worker.
+// `worker` can be NULL to only steal. Preemption must be disabled.
+static ForkJoinTask *fork_join_take(ForkJoinWorker *worker) {
+  if (worker && worker->bottom != worker->top) {
+    worker->bottom--;
+    return worker->tasks[worker->bottom % FORK_JOIN_DEQUE_SIZE];
+  }
+
+  // Start after ourselves, so the thieves don't all go for the same victim
+  const uint32_t start = worker ? worker - fork_join_data.workers + 1 : 0;
+  for (uint32_t i = 0; i < FORK_JOIN_NUM_WORKERS; ++i) {
+    ForkJoinWorker *victim =
+        &fork_join_data.workers[(start + i) % FORK_JOIN_NUM_WORKERS];
+    if (victim == worker || victim->bottom == victim->top) continue;
+
+    ForkJoinTask *task = victim->tasks[victim->top % FORK_JOIN_DEQUE_SIZE];
+    victim->top++;
+    if (worker) worker->num_steals++;
+    return task;
+  }
+
+  return NULL;
+}
+
+static void fork_join_run(ForkJoinWorker *worker, ForkJoinTask *task) {
+  task->result = task->function(task->argument);
+  task->done = true;
+  completion_complete_all(&task->finished);
+
+  if (worker) {
+    worker->num_tasks++;
+  } else {
+    fork_join_data.num_joiner_tasks++;
+  }
+}
+
+static void *fork_join_worker_main(void *parameter) {
+  ForkJoinWorker *worker = (ForkJoinWorker *)parameter;
+
+  while (true) {
+    preempt_disable();
+    ForkJoinTask *task;
+    while (!(task = fork_join_take(worker))) {
+      WaitQueueEntry entry;
+      wait_queue_entry_init(&entry, worker->thread, 0);
+      wait_queue_wait(&fork_join_data.idle, &entry, -1);
+    }
+    preempt_enable();
+
+    fork_join_run(worker, task);
+  }
+
+  return NULL;
+}
+
+void fork_join_init() {
+  REQUIRE_MODULE("scheduler");
+
+  wait_queue_init(&fork_join_data.idle);
+  fork_join_data.next_worker = 0;
+  fork_join_data.num_inline = 0;
+  fork_join_data.num_joiner_tasks = 0;
+
+  for (uint32_t i = 0; i < FORK_JOIN_NUM_WORKERS; ++i) {
+    ForkJoinWorker *worker = &fork_join_data.workers[i];
+    worker->top = worker->bottom = 0;
+    worker->num_tasks = worker->num_steals = 0;
+    worker->thread = thread_create(fork_join_worker_main, worker,
+                                   FORK_JOIN_PRIORITY, FORK_JOIN_STACK_PAGES);
+    assert(worker->thread);
+
+    // Background computation, it shouldn't hold up realtime threads. A
+    // realtime thread that joins runs the tasks itself instead of waiting for
+    // the workers to get the CPU (see fork_join_join()).
+    thread_set_scheduling_class(worker->thread, THREAD_CLASS_FAIR);
+  }
+
+  // Every worker has to exist before any of them looks for work
+  for (uint32_t i = 0; i < FORK_JOIN_NUM_WORKERS; ++i) {
+    thread_start(fork_join_data.workers[i].thread);
+  }
+
+  REGISTER_MODULE("fork_join");
+}
+
+void fork_join_spawn(ForkJoinTask *task, ForkJoinFunction function,
+                     void *argument) {
+  task->function = function;
+  task->argument = argument;
+  task->result = NULL;
+  task->done = false;
+  completion_init(&task->finished);
+
+  preempt_disable();
+
+  ForkJoinWorker *current = fork_join_current_worker();
+  ForkJoinWorker *worker = current;
+  if (!worker) {
+    worker = &fork_join_data.workers[fork_join_data.next_worker++ %
+                                     FORK_JOIN_NUM_WORKERS];
+  }
+
+  const bool full = worker->bottom - worker->top == FORK_JOIN_DEQUE_SIZE;
+  if (!full) {
+    worker->tasks[worker->bottom % FORK_JOIN_DEQUE_SIZE] = task;
+    worker->bottom++;
+    wait_queue_wake_one(&fork_join_data.idle);
+  } else {
+    fork_join_data.num_inline++;
+  }
+
+  preempt_enable();
+
+  if (full) fork_join_run(current, task);
+}
+
+void *fork_join_join(ForkJoinTask *task) {
+  ForkJoinWorker *worker = fork_join_current_worker();
+
+  // The joiner runs whatever it can find until `task` is done, stealing if
+  // it's not a worker. It only sleeps if every other task is already running
+  // somewhere, so joiners can't all end up waiting on tasks that nobody runs,
+  // or on workers that can't get the CPU.
+  while (!task->done) {
+    preempt_disable();
+    ForkJoinTask *other = fork_join_take(worker);
+    preempt_enable();
+
+    if (!other) break;
+    fork_join_run(worker, other);
+  }
+
+  completion_wait(&task->finished, -1);
+  return task->result;
+}
+
+typedef struct {
+  uint64_t begin, end, grain;
+  ParallelForFunction function;
+  void *context;
+} ParallelForRange;
+
+// Spawns the upper half for someone to steal and splits the lower half again,
+// until the ranges are small enough
+static void *parallel_for_range(void *argument) {
+  ParallelForRange *range = (ParallelForRange *)argument;
+
+  if (range->end - range->begin <= range->grain) {
+    range->function(range->begin, range->end, range->context);
+    return NULL;
+  }
+
+  const uint64_t middle = range->begin + (range->end - range->begin) / 2;
+  ParallelForRange lower = *range, upper = *range;
+  lower.end = upper.begin = middle;
+
+  ForkJoinTask task;
+  fork_join_spawn(&task, parallel_for_range, &upper);
+  parallel_for_range(&lower);
+  fork_join_join(&task);
+
+  return NULL;
+}
+
+void parallel_for(uint64_t begin, uint64_t end, uint64_t grain,
+                  ParallelForFunction function, void *context) {
+  assert(grain > 0);
+  if (begin >= end) return;
+
+  ParallelForRange range = {.begin = begin,
+                            .end = end,
+                            .grain = grain,
+                            .function = function,
+                            .context = context};
+
+  // Outside the pool too, the caller takes part like a worker: every join
+  // runs tasks until its own one is done
+  parallel_for_range(&range);
+}
+
+void fork_join_print_statistics() {
+  text_output_printf(
+      "Fork-join statistics (%lu ran inline, %lu run by other joiners):\n",
+      fork_join_data.num_inline, fork_join_data.num_joiner_tasks);
+  for (uint32_t i = 0; i < FORK_JOIN_NUM_WORKERS; ++i) {
+    const ForkJoinWorker *worker = &fork_join_data.workers[i];
+    text_output_printf("  worker %u: tasks %lu, steals %lu\n", i,
+                       worker->num_tasks, worker->num_steals);
+  }
+}
@@ -0,0 +1,52 @@
+#include <kernel/kernel_common.h>
+#include <kernel/threading/completion.h>
+
+#ifndef _FORK_JOIN_H
+#define _FORK_JOIN_H
+
+// A pool of worker threads for CPU-bound kernel jobs (checksumming, zeroing,
+// parsing tables). Tasks spawned by a worker go on that worker's own deque,
+// the worker runs the newest one first and idle workers steal the oldest
+// ones, so big chunks of work are split up where they are needed. A thread
+// that joins a task which hasn't finished runs other tasks in the meantime
+// instead of blocking, stealing them if it isn't a worker. Those run on its
+// own stack, parallel_for() recursion takes a couple hundred bytes per
+// halving of the range.
+//
+// Tasks are owned by the caller (usually on its stack) and must be joined,
+// exactly once, before they go away:
+//
+//   ForkJoinTask left;
+//   fork_join_spawn(&left, sum_range, &left_half);
+//   uint64_t right = (uint64_t)sum_range(&right_half);
+//   uint64_t total = (uint64_t)fork_join_join(&left) + right;
+
+typedef void *(*ForkJoinFunction)(void *argument);
+
+typedef struct {
+  ForkJoinFunction function;
+  void *argument;
+  void *result;
+  volatile bool done;
+  Completion finished;  // For joins that have nothing else to run
+} ForkJoinTask;
+
+void fork_join_init();
+
+// Queues `task` to run `function(argument)` on the pool
+void fork_join_spawn(ForkJoinTask *task, ForkJoinFunction function,
+                     void *argument);
+
+// Waits for `task` to finish and returns what its function returned
+void *fork_join_join(ForkJoinTask *task);
+
+// Calls `function` on consecutive ranges of [begin, end) of at most `grain`
+// indices each, spread across the pool, and returns once every call returned
+typedef void (*ParallelForFunction)(uint64_t begin, uint64_t end,
+                                    void *context);
+void parallel_for(uint64_t begin, uint64_t end, uint64_t grain,
+                  ParallelForFunction function, void *context);
+
+void fork_join_print_statistics();
+
+#endif
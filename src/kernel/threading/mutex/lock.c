@@ -1,36 +1,153 @@
 #include <kernel/threading/mutex/lock.h>
+#include <kernel/threading/scheduler.h>
+#include <kernel/threading/thread_internal.h>
+#include <kernel/util.h>
 
-// TODO: Add memory barriers
-void lock_init(Lock *lock) {
-  semaphore_init(&lock->sema, 1);
+// Lives on the stack of the waiting thread for as long as it waits. The wait
+// queue entry is woken by lock_release() once the lock has been handed over.
+typedef struct LockWaiter {
+  WaitQueueEntry wait;
+  Lock *lock;
+} LockWaiter;
+
+// Orders threads by the class and priority they currently run with. Realtime
+// threads outrank deadline threads, which outrank fair threads. Deadline
+// threads don't use their priority.
+static uint32_t lock_rank(KernelThreadSchedulingClass scheduling_class,
+                          uint8_t priority) {
+  switch (scheduling_class) {
+    case THREAD_CLASS_REALTIME:
+      return 33 + priority;
+    case THREAD_CLASS_DEADLINE:
+      return 32;
+    default:
+      return priority;
+  }
 }
 
-bool lock_acquire(Lock *lock, int64_t timeout) {
-  assert(semaphore_value(&lock->sema) <= 1);
-  return semaphore_down(&lock->sema, 1, timeout);
+static uint32_t thread_rank(KernelThread *thread) {
+  return lock_rank(thread->scheduling_class, thread->priority);
 }
 
-void lock_release(Lock *lock) {
-  assert(semaphore_value(&lock->sema) == 0);
-  semaphore_up(&lock->sema, 1);
+// Recomputes the priority of `thread` from its base priority and the highest
+// priority waiter of every lock it holds. Returns true if it changed.
+static bool lock_update_priority(KernelThread *thread) {
+  KernelThreadSchedulingClass scheduling_class = thread->base_scheduling_class;
+  uint8_t priority = thread->base_priority;
+
+  ListEntry *current = list_head(&thread->held_locks);
+  while (current) {
+    Lock *lock = container_of(current, Lock, held_entry);
+    WaitQueueEntry *head = wait_queue_head(&lock->waiters);
+    if (head &&
+        thread_rank(head->thread) > lock_rank(scheduling_class, priority)) {
+      scheduling_class = head->thread->scheduling_class;
+      priority = head->thread->priority;
+
+      // A deadline waiter has no deadline to lend to a thread without a
+      // reservation. The owner runs above every deadline thread instead, at
+      // the lowest realtime priority.
+      if (scheduling_class == THREAD_CLASS_DEADLINE) {
+        scheduling_class = THREAD_CLASS_REALTIME;
+        priority = 0;
+      }
+    }
+    current = list_next(current);
+  }
+
+  if (scheduling_class == thread->scheduling_class &&
+      priority == thread->priority) {
+    return false;
+  }
+
+  scheduler_set_effective_priority(thread, scheduling_class, priority);
+  return true;
 }
 
+// Called after the waiters of `lock` changed. Walks the chain of owners, each
+// of which may be waiting for another lock, until a priority doesn't change.
+static void lock_propagate_priority(Lock *lock) {
+  while (lock && lock->owner) {
+    KernelThread *owner = lock->owner;
+    if (!lock_update_priority(owner)) return;
 
+    LockWaiter *waiter = owner->blocked_on;
+    if (!waiter) return;
 
+    // Keep the owner's place in the next lock's queue up to date
+    lock = waiter->lock;
+    wait_queue_reposition(&lock->waiters, &waiter->wait);
+  }
+}
 
+static void lock_take(Lock *lock, KernelThread *thread) {
+  lock->owner = thread;
+  list_push_back(&thread->held_locks, &lock->held_entry);
+}
 
-void spinlock_init(SpinLock *lock) {
-  lock->value = 0;
+void lock_init(Lock *lock) {
+  lock->owner = NULL;
+  wait_queue_init(&lock->waiters);
 }
 
-void spinlock_acquire(SpinLock *lock) {
-  // TODO: Determine the appropriate memory model (currently the strictest)
-  // TODO: This is probably very broken, I think it will never let a lower
-  // priority thread run while the lock is held
-  while (__sync_lock_test_and_set(&lock->value, 1));
+bool lock_acquire(Lock *lock, int64_t timeout) {
+  preempt_disable();
+
+  KernelThread *current = scheduler_current_thread();
+  assert(current);
+
+  bool acquired = false;
+  if (!lock->owner) {
+    lock_take(lock, current);
+    acquired = true;
+  } else if (timeout != 0) {
+    assert(lock->owner != current);  // Locks aren't recursive
+
+    LockWaiter waiter = {.lock = lock};
+    wait_queue_entry_init(&waiter.wait, current, 0);
+    wait_queue_add(&lock->waiters, &waiter.wait);
+    current->blocked_on = &waiter;
+    lock_propagate_priority(lock);
+
+    acquired = wait_queue_sleep(&lock->waiters, &waiter.wait, timeout);
+    if (!acquired) {
+      // Timed out, stop lending our priority to the owner
+      current->blocked_on = NULL;
+      lock_propagate_priority(lock);
+    }
+  }
+
+  preempt_enable();
+
+  return acquired;
 }
 
-void spinlock_release(SpinLock *lock) {
-  // TODO: Determine the appropriate memory model (currently the strictest)
-  __sync_lock_release(&lock->value);
+void lock_release(Lock *lock) {
+  preempt_disable();
+
+  KernelThread *current = scheduler_current_thread();
+  assert(lock->owner == current);
+  list_remove(&current->held_locks, &lock->held_entry);
+
+  // Hand the lock directly to the highest priority waiter, so a lower priority
+  // thread can't take it in between
+  WaitQueueEntry *head = wait_queue_head(&lock->waiters);
+  if (head) {
+    KernelThread *thread = head->thread;
+    thread->blocked_on = NULL;
+    lock_take(lock, thread);
+    wait_queue_wake_entry(&lock->waiters, head);
+
+    // The new owner inherits from the remaining waiters
+    lock_update_priority(thread);
+  } else {
+    lock->owner = NULL;
+  }
+
+  // Drop whatever we inherited through this lock
+  lock_update_priority(current);
+
+  preempt_enable();
 }
+
+KernelThread *lock_owner(Lock *lock) { return lock->owner; }
@@ -1,23 +1,26 @@
+#include <kernel/datastructures/list.h>
 #include <kernel/kernel_common.h>
-#include <kernel/threading/mutex/semaphore.h>
+#include <kernel/threading/mutex/spinlock.h>
+#include <kernel/threading/thread.h>
+#include <kernel/threading/wait_queue.h>
 
 #ifndef _LOCK_H
 #define _LOCK_H
 
+// A sleeping mutex with an owner. Threads waiting for a Lock lend their
+// priority (and scheduling class) to the owner, and transitively to whatever
+// the owner is waiting for, so a low priority owner can't hold up a high
+// priority waiter indefinitely. On release the lock is handed directly to the
+// highest priority waiter.
 typedef struct {
-  Semaphore sema;
+  KernelThread *owner;
+  WaitQueue waiters;
+  ListEntry held_entry;  // In the owner's list of held locks
 } Lock;
 
 void lock_init(Lock *lock);
 bool lock_acquire(Lock *lock, int64_t timeout); // timeout of -1 means wait forever
 void lock_release(Lock *lock);
-
-typedef struct {
-  char value;
-} SpinLock;
-
-void spinlock_init(SpinLock *lock);
-void spinlock_acquire(SpinLock *lock);
-void spinlock_release(SpinLock *lock);
+KernelThread *lock_owner(Lock *lock);
 
 #endif
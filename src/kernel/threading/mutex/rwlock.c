@@ -0,0 +1,77 @@
+#include <kernel/threading/mutex/rwlock.h>
+#include <kernel/threading/scheduler.h>
+#include <kernel/util.h>
+
+void rwlock_init(RWLock *lock) {
+  lock->num_readers = 0;
+  lock->num_waiting_writers = 0;
+  lock->writer = false;
+  wait_queue_init(&lock->waiting_readers);
+  wait_queue_init(&lock->waiting_writers);
+}
+
+// Gives the lock to the highest priority waiting writer
+static void rwlock_wake_writer(RWLock *lock) {
+  lock->num_waiting_writers--;
+  lock->writer = true;
+  wait_queue_wake_one(&lock->waiting_writers);
+}
+
+void rwlock_read_acquire(RWLock *lock) {
+  preempt_disable();
+
+  if (!lock->writer && lock->num_waiting_writers == 0) {
+    lock->num_readers++;
+  } else {
+    // The releasing writer counts us as a reader before waking us up
+    WaitQueueEntry waiter;
+    wait_queue_entry_init(&waiter, scheduler_current_thread(), 0);
+    wait_queue_wait(&lock->waiting_readers, &waiter, -1);
+  }
+
+  preempt_enable();
+}
+
+void rwlock_read_release(RWLock *lock) {
+  preempt_disable();
+
+  assert(lock->num_readers > 0 && !lock->writer);
+  lock->num_readers--;
+  if (lock->num_readers == 0 && lock->num_waiting_writers > 0) {
+    rwlock_wake_writer(lock);
+  }
+
+  preempt_enable();
+}
+
+void rwlock_write_acquire(RWLock *lock) {
+  preempt_disable();
+
+  if (!lock->writer && lock->num_readers == 0) {
+    lock->writer = true;
+  } else {
+    // The releasing thread sets `writer` for us before waking us up
+    lock->num_waiting_writers++;
+    WaitQueueEntry waiter;
+    wait_queue_entry_init(&waiter, scheduler_current_thread(), 0);
+    wait_queue_wait(&lock->waiting_writers, &waiter, -1);
+  }
+
+  preempt_enable();
+}
+
+void rwlock_write_release(RWLock *lock) {
+  preempt_disable();
+
+  assert(lock->writer);
+  lock->writer = false;
+
+  if (lock->num_waiting_writers > 0) {
+    rwlock_wake_writer(lock);
+  } else {
+    // Let every waiting reader in at once
+    lock->num_readers += wait_queue_wake_all(&lock->waiting_readers);
+  }
+
+  preempt_enable();
+}
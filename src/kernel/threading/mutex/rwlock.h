@@ -0,0 +1,30 @@
+#include <kernel/kernel_common.h>
+#include <kernel/threading/wait_queue.h>
+
+#ifndef _RWLOCK_H
+#define _RWLOCK_H
+
+// Sleeping reader-writer lock with writer preference: once a writer is waiting,
+// new readers wait behind it, so a steady stream of readers can't starve
+// writers. Ownership is handed over directly on release.
+//
+// For read-mostly data that readers must not block on at all, use RCU
+// (threading/rcu.h) instead.
+typedef struct {
+  uint32_t num_readers;          // Readers holding the lock
+  uint32_t num_waiting_writers;
+  bool writer;                   // A writer holds the lock
+
+  WaitQueue waiting_readers;
+  WaitQueue waiting_writers;
+} RWLock;
+
+void rwlock_init(RWLock *lock);
+
+void rwlock_read_acquire(RWLock *lock);
+void rwlock_read_release(RWLock *lock);
+
+void rwlock_write_acquire(RWLock *lock);
+void rwlock_write_release(RWLock *lock);
+
+#endif
@@ -1,114 +1,57 @@
 #include <kernel/threading/mutex/semaphore.h>
 #include <kernel/threading/scheduler.h>
 #include <kernel/util.h>
-#include <kernel/memory/kmalloc.h>
-#include <kernel/drivers/timer.h>
-#include <kernel/drivers/text_output.h>
-
-typedef struct {
-  ListEntry entry;
-
-  KernelThread *thread;
-} WaitingThread;
 
 void semaphore_init(Semaphore *sema, uint64_t initial_value) {
   sema->value = initial_value;
-  list_init(&sema->waiting_threads);
+  wait_queue_init(&sema->waiters);
+}
+
+// Hands the available units directly to waiters in priority order, waking
+// only as many as can be satisfied. Stops at the first one that can't be, so a
+// waiter that wants many units isn't starved by ones that want few.
+static void semaphore_wake_waiters(Semaphore *sema) {
+  WaitQueueEntry *waiter;
+  while ((waiter = wait_queue_head(&sema->waiters)) &&
+         waiter->value <= sema->value) {
+    sema->value -= waiter->value;
+    wait_queue_wake_entry(&sema->waiters, waiter);
+  }
 }
 
 void semaphore_up(Semaphore *sema, uint64_t value) {
-  bool interrupts_enabled = interrupts_status();
-  cli();
+  preempt_disable();
   
   sema->value += value;
-
-  // We have to wake all threads potentially, in case the first one can't be
-  // satisfied, but a later one can
-  ListEntry *current = list_head(&sema->waiting_threads);
-  while (current) {
-    WaitingThread *waiting_thread = container_of(current, WaitingThread, entry);
-    ListEntry *next = list_next(current);
-    list_remove(&sema->waiting_threads, &waiting_thread->entry);
-    thread_wake(waiting_thread->thread);
-    kfree(waiting_thread);
-
-    current = next;
-  }
+  semaphore_wake_waiters(sema);
   
-  // Only re-enable interrupts if they were enabled before
-  if (interrupts_enabled) sti();
+  preempt_enable();
 }
 
 bool semaphore_down(Semaphore *sema, uint64_t value, int64_t timeout) {
-  bool interrupts_enabled = interrupts_status();
-  cli();
-
-  while (sema->value < value) {
-    if (timeout == 0) return false;
-
-    WaitingThread *waiting_thread = kmalloc(sizeof(WaitingThread));
-    assert(waiting_thread);
-
-    waiting_thread->thread = scheduler_current_thread();
-
-    // Insert based on priority (higher priority first)
-    ListEntry *current = list_head(&sema->waiting_threads);
-
-    // Try to find a place to put the new thread
-    while (current) {
-      WaitingThread *to_compare = container_of(current, WaitingThread, entry);
-
-      if (thread_priority(waiting_thread->thread) >= thread_priority(to_compare->thread)) break;
-      current = list_next(current);
-    }
-
-    // If we couldn't find a place to put it, put it at the end
-    if (current) {
-      list_insert_before(&sema->waiting_threads, current, &waiting_thread->entry);
-    } else {
-      list_push_back(&sema->waiting_threads, &waiting_thread->entry);
-    }
-
-    if (timeout == -1) {
-      thread_sleep(waiting_thread->thread);
-    } else {
-      uint64_t old_value = sema->value;
-
-      // timer_thread_sleep() will return with interrupts in the same state as when it
-      // is called. Interrupts will be re-enabled while the thread sleeps.
-      timer_thread_sleep(timeout);
-      // Interrupts will be off again when we get here
-
-      // We woke up either from the timer, or the semaphore
-      if (sema->value != old_value) {
-        // Semaphore wakeup, waiting_thread has been kfree'd
-
-        if (sema->value >= value) {
-          timer_cancel_thread_sleep(scheduler_current_thread());
-          break;
-        }
-      } else {
-        // Timer wakeup, destroy waiting_thread and return
-        list_remove(&sema->waiting_threads, &waiting_thread->entry);
-        kfree(waiting_thread);
-
-        if (interrupts_enabled) sti();
-        return false; // Did not get semaphore
-      }
-    }
+  preempt_disable();
+
+  // Don't take units from under threads that are already waiting
+  bool acquired = false;
+  if (wait_queue_empty(&sema->waiters) && sema->value >= value) {
+    sema->value -= value;
+    acquired = true;
+  } else if (timeout != 0) {
+    // semaphore_up() takes the units for us before waking us up
+    WaitQueueEntry waiter;
+    wait_queue_entry_init(&waiter, scheduler_current_thread(), value);
+    acquired = wait_queue_wait(&sema->waiters, &waiter, timeout);
+
+    // If we timed out at the head of the queue, the waiters behind us may be
+    // satisfiable now
+    if (!acquired) semaphore_wake_waiters(sema);
   }
-  
-  // If we get here, we should be able to decrement the semaphore
-  assert(sema->value > 0);
-  sema->value -= value;
 
-  // Only re-enable interrupts if they were enabled before
-  if (interrupts_enabled) sti();
+  preempt_enable();
 
-  return true; // Got semaphore
+  return acquired;
 }
 
 uint64_t semaphore_value(Semaphore *sema) {
   return sema->value;
 }
-
@@ -1,13 +1,13 @@
 #include <kernel/threading/thread.h>
+#include <kernel/threading/wait_queue.h>
 #include <kernel/kernel_common.h>
-#include <kernel/datastructures/list.h>
 
 #ifndef _SEMAPHORE_H
 #define _SEMAPHORE_H
 
 typedef struct {
   uint64_t value;
-  List waiting_threads;
+  WaitQueue waiters;  // Entry values are the number of units wanted
 } Semaphore;
 
 void semaphore_init(Semaphore *sema, uint64_t initial_value);
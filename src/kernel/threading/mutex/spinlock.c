@@ -0,0 +1,107 @@
+#include <kernel/threading/mutex/spinlock.h>
+#include <kernel/util.h>
+
+#define SPINLOCK_MAX_BACKOFF 1024  // In pause instructions
+#define TICKET_LOCK_BACKOFF 64     // Pauses per ticket ahead of us
+
+static inline void cpu_relax() { __asm__ volatile("pause" ::: "memory"); }
+
+// Pauses for `*backoff` iterations and doubles it, up to SPINLOCK_MAX_BACKOFF
+static void spin_backoff(uint32_t *backoff) {
+  for (uint32_t i = 0; i < *backoff; ++i) cpu_relax();
+  if (*backoff < SPINLOCK_MAX_BACKOFF) *backoff *= 2;
+}
+
+void spinlock_init(SpinLock *lock) {
+  lock->value = 0;
+}
+
+void spinlock_acquire(SpinLock *lock) {
+  uint32_t backoff = 1;
+
+  // Only try the atomic operation when the lock looks free, so waiters spin on
+  // a shared cache line instead of fighting over it
+  while (__sync_lock_test_and_set(&lock->value, 1)) {
+    do {
+      spin_backoff(&backoff);
+    } while (lock->value);
+  }
+}
+
+void spinlock_release(SpinLock *lock) {
+  __sync_lock_release(&lock->value);
+}
+
+bool spinlock_acquire_irqsave(SpinLock *lock) {
+  bool interrupts_enabled = interrupts_status();
+  cli();
+
+  spinlock_acquire(lock);
+  return interrupts_enabled;
+}
+
+void spinlock_release_irqrestore(SpinLock *lock, bool interrupts_enabled) {
+  spinlock_release(lock);
+
+  // Only re-enable interrupts if they were enabled before
+  if (interrupts_enabled) sti();
+}
+
+void ticket_lock_init(TicketLock *lock) {
+  lock->next_ticket = 0;
+  lock->now_serving = 0;
+}
+
+void ticket_lock_acquire(TicketLock *lock) {
+  const uint32_t ticket = __sync_fetch_and_add(&lock->next_ticket, 1);
+
+  while (true) {
+    const uint32_t now_serving = lock->now_serving;
+    if (now_serving == ticket) break;
+
+    // Back off in proportion to the number of waiters ahead of us
+    for (uint32_t i = 0; i < (ticket - now_serving) * TICKET_LOCK_BACKOFF; ++i) {
+      cpu_relax();
+    }
+  }
+
+  __sync_synchronize();
+}
+
+void ticket_lock_release(TicketLock *lock) {
+  __sync_synchronize();
+
+  // Only the holder writes now_serving, so this doesn't need to be atomic
+  lock->now_serving = lock->now_serving + 1;
+}
+
+void mcs_lock_init(McsLock *lock) {
+  lock->tail = NULL;
+}
+
+void mcs_lock_acquire(McsLock *lock, McsNode *node) {
+  node->next = NULL;
+  node->locked = true;
+
+  McsNode *predecessor = __sync_lock_test_and_set(&lock->tail, node);
+  if (!predecessor) return;  // The lock was free
+
+  predecessor->next = node;
+  while (node->locked) cpu_relax();
+
+  __sync_synchronize();
+}
+
+void mcs_lock_release(McsLock *lock, McsNode *node) {
+  __sync_synchronize();
+
+  if (!node->next) {
+    // No known successor, try to mark the lock as free
+    if (__sync_bool_compare_and_swap(&lock->tail, node, NULL)) return;
+
+    // Someone swapped themselves in as the tail, wait for them to link up
+    while (!node->next) cpu_relax();
+  }
+
+  node->next->locked = false;
+}
@@ -0,0 +1,55 @@
+#include <kernel/kernel_common.h>
+
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+// Busy-waiting locks for short critical sections. Waiting threads don't sleep,
+// so a lock that is also taken by an ISR (or by threads that can preempt each
+// other) must be held with interrupts disabled, otherwise a waiter can spin
+// forever on a holder that never gets to run again. Use the _irqsave variants
+// for that, or disable interrupts around the ticket/MCS functions.
+
+// Test-and-test-and-set lock with exponential backoff.
+typedef struct {
+  volatile char value;
+} SpinLock;
+
+void spinlock_init(SpinLock *lock);
+void spinlock_acquire(SpinLock *lock);
+void spinlock_release(SpinLock *lock);
+
+// Disables interrupts before taking the lock. Returns whether interrupts were
+// enabled, which must be passed to spinlock_release_irqrestore().
+bool spinlock_acquire_irqsave(SpinLock *lock);
+void spinlock_release_irqrestore(SpinLock *lock, bool interrupts_enabled);
+
+// FIFO lock: waiters are served in the order they arrived. Best for short,
+// lightly contended sections.
+typedef struct {
+  volatile uint32_t next_ticket;
+  volatile uint32_t now_serving;
+} TicketLock;
+
+void ticket_lock_init(TicketLock *lock);
+void ticket_lock_acquire(TicketLock *lock);
+void ticket_lock_release(TicketLock *lock);
+
+// MCS queue lock: FIFO, and each waiter spins on its own McsNode instead of
+// the shared lock word, so contended handoffs don't bounce a cache line
+// between every waiter. The node is owned by the caller (usually on its stack)
+// and must stay valid until the matching mcs_lock_release().
+typedef struct McsNode McsNode;
+struct McsNode {
+  McsNode *volatile next;
+  volatile bool locked;
+};
+
+typedef struct {
+  McsNode *volatile tail;
+} McsLock;
+
+void mcs_lock_init(McsLock *lock);
+void mcs_lock_acquire(McsLock *lock, McsNode *node);
+void mcs_lock_release(McsLock *lock, McsNode *node);
+
+#endif
@@ -0,0 +1,96 @@
+#include <kernel/threading/rcu.h>
+#include <kernel/threading/scheduler.h>
+#include <kernel/threading/work_queue.h>
+#include <kernel/util.h>
+
+// NOTE: There is only one CPU for now, so the per-CPU state is a single
+// instance. With more CPUs, synchronize_rcu() would wait for each CPU's
+// quiescent state count to move.
+
+static void rcu_process_callbacks(void *context);
+
+static struct {
+  // Read-side nesting depth. Readers disable preemption, this is only kept to
+  // catch a reader that sleeps.
+  uint32_t read_nesting;
+
+  // Number of context switches on this CPU
+  volatile uint64_t num_quiescent_states;
+
+  // Callbacks queued by call_rcu(), newest first
+  RcuHead *pending_callbacks;
+  WorkItem callback_work;
+} rcu_data;
+
+void rcu_init() {
+  REQUIRE_MODULE("work_queue");
+
+  rcu_data.read_nesting = 0;
+  rcu_data.num_quiescent_states = 0;
+  rcu_data.pending_callbacks = NULL;
+  work_item_init(&rcu_data.callback_work, rcu_process_callbacks, NULL);
+
+  REGISTER_MODULE("rcu");
+}
+
+void rcu_read_lock() {
+  preempt_disable();
+  rcu_data.read_nesting++;
+}
+
+void rcu_read_unlock() {
+  assert(rcu_data.read_nesting > 0);
+  rcu_data.read_nesting--;
+  preempt_enable();
+}
+
+void rcu_note_context_switch() {
+  // Switching away from a thread inside a read-side section would make this
+  // quiescent state a lie
+  assert(rcu_data.read_nesting == 0);
+  rcu_data.num_quiescent_states++;
+}
+
+void synchronize_rcu() {
+  assert(rcu_data.read_nesting == 0);
+
+  // Force a context switch, after which no reader that started before this
+  // call can still be running
+  const uint64_t start = rcu_data.num_quiescent_states;
+  while (rcu_data.num_quiescent_states == start) scheduler_yield();
+}
+
+void call_rcu(RcuHead *head, RcuCallback callback) {
+  head->callback = callback;
+
+  bool interrupts_enabled = interrupts_status();
+  cli();
+
+  head->next = rcu_data.pending_callbacks;
+  rcu_data.pending_callbacks = head;
+
+  // Only re-enable interrupts if they were enabled before
+  if (interrupts_enabled) sti();
+
+  work_queue_enqueue(work_queue_system(), &rcu_data.callback_work);
+}
+
+static void rcu_process_callbacks(void *context UNUSED) {
+  bool interrupts_enabled = interrupts_status();
+  cli();
+
+  RcuHead *callbacks = rcu_data.pending_callbacks;
+  rcu_data.pending_callbacks = NULL;
+
+  // Only re-enable interrupts if they were enabled before
+  if (interrupts_enabled) sti();
+
+  // Callbacks queued after this point are picked up by the next run
+  synchronize_rcu();
+
+  while (callbacks) {
+    RcuHead *next = callbacks->next;
+    callbacks->callback(callbacks);
+    callbacks = next;
+  }
+}
@@ -0,0 +1,45 @@
+#include <kernel/kernel_common.h>
+
+#ifndef _RCU_H
+#define _RCU_H
+
+// Read-copy-update for read-mostly data. Readers don't take any lock: they
+// wrap their accesses in rcu_read_lock()/rcu_read_unlock() and load shared
+// pointers with rcu_dereference(). Writers (serialized among themselves by
+// some other lock) publish a new version with rcu_assign_pointer() and must
+// wait for a grace period before freeing the old one, either by blocking in
+// synchronize_rcu() or by passing it to call_rcu().
+//
+// Read-side sections can't be preempted, so a context switch is a quiescent
+// state for the CPU it happens on, and a grace period has passed once every
+// CPU has gone through one. Read-side sections must not sleep.
+
+typedef struct RcuHead RcuHead;
+typedef void (*RcuCallback)(RcuHead *head);
+
+// Embed this in the structure to be freed
+struct RcuHead {
+  RcuHead *next;
+  RcuCallback callback;
+};
+
+#define rcu_dereference(pointer) __atomic_load_n(&(pointer), __ATOMIC_CONSUME)
+#define rcu_assign_pointer(pointer, value) \
+  __atomic_store_n(&(pointer), (value), __ATOMIC_RELEASE)
+
+void rcu_init();
+
+// Can be nested and used from interrupt handlers
+void rcu_read_lock();
+void rcu_read_unlock();
+
+// Waits until every read-side section that started before the call is over
+void synchronize_rcu();
+
+// Runs `callback` on the system work queue after a grace period
+void call_rcu(RcuHead *head, RcuCallback callback);
+
+// Called by the scheduler on every context switch
+void rcu_note_context_switch();
+
+#endif
@@ -1,48 +1,91 @@
+#include <kernel/threading/rcu.h>
 #include <kernel/threading/scheduler.h>
+#include <kernel/threading/scheduler_statistics.h>
 #include <kernel/threading/thread.h>
+#include <kernel/threading/thread_internal.h>
 #include <kernel/util.h>
 
 #include <kernel/drivers/apic.h>
+#include <kernel/drivers/gdt.h>
 #include <kernel/drivers/interrupt.h>
+#include <kernel/drivers/time.h>
 #include <kernel/drivers/timer.h>
 
 #include <kernel/datastructures/list.h>
 #include <kernel/drivers/text_output.h>
+#include <kernel/memory/address_space.h>
+#include <kernel/memory/virtual_memory.h>
 
-#define SCHEDULER_TIMER_CALIBRATION_PERIOD 0x0ffffff
 #define SCHEDULER_TIMER_DIVIDER APIC_DIV_2
 #define SCHEDULER_TIME_SLICE_MS 10
 
+#define SCHEDULER_MAX_FAIR_THREADS 256
+#define SCHEDULER_FAIR_BASE_WEIGHT 1024
+
+// A woken fair thread only preempts a running fair thread if it is behind by
+// at least this much vruntime, so fair threads don't thrash on every wakeup.
+#define SCHEDULER_FAIR_WAKEUP_GRANULARITY 1000000
+
+// Deadline thread bandwidth is a fraction of the CPU in fixed point. At most
+// 90% of the CPU can be reserved, so realtime bottom halves and fair threads
+// still get to run when every reservation is used up.
+#define SCHEDULER_BANDWIDTH_SHIFT 20
+#define SCHEDULER_BANDWIDTH_ONE (1ULL << SCHEDULER_BANDWIDTH_SHIFT)
+#define SCHEDULER_MAX_DEADLINE_BANDWIDTH (SCHEDULER_BANDWIDTH_ONE * 90 / 100)
+
+// Weight of a THREAD_CLASS_FAIR thread, indexed by priority. Each priority
+// level gets ~25% more CPU time than the one below it, and priority 16 has
+// SCHEDULER_FAIR_BASE_WEIGHT.
+static const uint32_t fair_weights[32] = {
+    29,   36,   45,   56,   70,   88,    110,   137,   172,   215,   268,
+    336,  419,  524,  655,  819,  1024,  1280,  1600,  2000,  2500,  3125,
+    3906, 4883, 6104, 7629, 9537, 11921, 14901, 18626, 23283, 29104};
+
 struct {
   KernelThread *current_thread;  // This must be the first entry
 
-  List thread_list;  // Sorted list (by priority) used as a priority queue
-  uint64_t apic_timer_frequency;
-} scheduler_data;
+  // THREAD_CLASS_REALTIME run queue, sorted by priority and FIFO within a
+  // priority level.
+  List realtime_threads;
 
-static volatile uint64_t calibration_end = 0;
-static void apic_timer_calibration_isr() { calibration_end = timer_ticks(); }
+  // THREAD_CLASS_DEADLINE run queue, sorted by deadline and FIFO between
+  // equal deadlines.
+  List deadline_threads;
+  uint64_t deadline_bandwidth;  // Sum of the admitted reservations
 
-static void calibrate_apic_timer() {
-  // Setup a one-shot timer
-  apic_setup_local_timer(SCHEDULER_TIMER_DIVIDER, LOCAL_APIC_CALIBRATION_IV,
-                         APIC_TIMER_ONE_SHOT,
-                         SCHEDULER_TIMER_CALIBRATION_PERIOD);
-  interrupt_register_handler(LOCAL_APIC_CALIBRATION_IV,
-                             apic_timer_calibration_isr);
+  // THREAD_CLASS_FAIR run queue, a binary min-heap on vruntime.
+  KernelThread *fair_threads[SCHEDULER_MAX_FAIR_THREADS];
+  uint32_t num_fair_threads;
+  uint64_t min_vruntime;  // Never decreases
 
-  const uint64_t calibration_start = timer_ticks();
-  apic_set_local_timer_masked(false);
+  // Runs when both run queues are empty, never queued.
+  KernelThread *idle_thread;
 
-  // Spin until we get the APIC timer interrupt
-  while (calibration_end == 0)
-    ;
+  // NOTE: The current thread is not in a run queue while it runs.
 
-  // Determine APIC frequency pased on number of PIC ticks that happened
-  scheduler_data.apic_timer_frequency =
-      (uint64_t)SCHEDULER_TIMER_CALIBRATION_PERIOD * TIMER_FREQUENCY /
-      (calibration_end - calibration_start);
-}
+  uint64_t last_switch_tsc;
+  uint64_t apic_timer_frequency;
+
+  // Set when a thread that should preempt the current one is woken up, or
+  // when a time slice ended while preemption was disabled
+  volatile bool need_resched;
+
+  // Preemption is disabled while this is non-zero. It belongs to the current
+  // thread, and is saved and restored on context switches.
+  volatile uint32_t preempt_count;
+
+  // Threads woken by interrupt handlers while preemption was disabled, which
+  // means the run queues may have been in the middle of an update. Only
+  // touched with interrupts disabled.
+  KernelThread *deferred_wakes;
+
+  // Statistics
+  uint64_t num_wakeup_preemptions;
+  uint64_t num_deferred_preemptions, num_deferred_wakes;
+  uint64_t num_deadline_misses, num_deadline_throttles;
+  uint64_t num_deadline_rejections;
+  SchedulerHistogram wake_latency, run_queue_latency, timeslice;
+} scheduler_data;
 
 static void setup_scheduler_timer() {
   const uint32_t period =
@@ -60,81 +103,602 @@ void *idle_thread_main(void *p UNUSED) {
 void scheduler_init() {
   REQUIRE_MODULE("virtual_memory");
   REQUIRE_MODULE("timer");
+  REQUIRE_MODULE("time");
 
-  list_init(&scheduler_data.thread_list);
+  list_init(&scheduler_data.realtime_threads);
+  list_init(&scheduler_data.deadline_threads);
+  scheduler_data.deadline_bandwidth = 0;
+  scheduler_data.num_fair_threads = 0;
+  scheduler_data.min_vruntime = 0;
 
   scheduler_data.current_thread = NULL;
 
   // The idle thread is the thread that runs if we have nothing else to do
-  KernelThread *idle_thread = thread_create(idle_thread_main, NULL, 0, 1);
-  thread_start(idle_thread);
+  scheduler_data.idle_thread = thread_create(idle_thread_main, NULL, 0, 1);
+  scheduler_data.idle_thread->status = THREAD_RUNNING;
 
-  calibrate_apic_timer();
+  // Calibrated by the time module
+  scheduler_data.apic_timer_frequency =
+      time_apic_timer_frequency() /
+      apic_timer_divider_value(SCHEDULER_TIMER_DIVIDER);
 
   REGISTER_MODULE("scheduler");
 }
 
+// Fair run queue (min-heap) helpers
+
+static void fair_heap_set(uint32_t index, KernelThread *thread) {
+  scheduler_data.fair_threads[index] = thread;
+  thread->heap_index = index;
+}
+
+static void fair_heap_sift_up(uint32_t index) {
+  KernelThread *thread = scheduler_data.fair_threads[index];
+  while (index > 0) {
+    const uint32_t parent = (index - 1) / 2;
+    KernelThread *parent_thread = scheduler_data.fair_threads[parent];
+    if (parent_thread->vruntime <= thread->vruntime) break;
+
+    fair_heap_set(index, parent_thread);
+    index = parent;
+  }
+  fair_heap_set(index, thread);
+}
+
+static void fair_heap_sift_down(uint32_t index) {
+  KernelThread *thread = scheduler_data.fair_threads[index];
+  const uint32_t size = scheduler_data.num_fair_threads;
+  while (true) {
+    uint32_t smallest = index * 2 + 1;
+    if (smallest >= size) break;
+
+    KernelThread *child = scheduler_data.fair_threads[smallest];
+    if (smallest + 1 < size &&
+        scheduler_data.fair_threads[smallest + 1]->vruntime < child->vruntime) {
+      child = scheduler_data.fair_threads[++smallest];
+    }
+    if (thread->vruntime <= child->vruntime) break;
+
+    fair_heap_set(index, child);
+    index = smallest;
+  }
+  fair_heap_set(index, thread);
+}
+
+static void fair_heap_push(KernelThread *thread) {
+  assert(scheduler_data.num_fair_threads < SCHEDULER_MAX_FAIR_THREADS);
+  fair_heap_set(scheduler_data.num_fair_threads++, thread);
+  fair_heap_sift_up(thread->heap_index);
+}
+
+static void fair_heap_remove(KernelThread *thread) {
+  const uint32_t index = thread->heap_index;
+  KernelThread *last =
+      scheduler_data.fair_threads[--scheduler_data.num_fair_threads];
+  if (last == thread) return;
+
+  fair_heap_set(index, last);
+  fair_heap_sift_down(index);
+  fair_heap_sift_up(last->heap_index);
+}
+
+static void update_min_vruntime() {
+  uint64_t min_vruntime = UINT64_MAX;
+
+  KernelThread *current = scheduler_data.current_thread;
+  if (current && current->scheduling_class == THREAD_CLASS_FAIR &&
+      current->status == THREAD_RUNNING) {
+    min_vruntime = current->vruntime;
+  }
+
+  if (scheduler_data.num_fair_threads > 0 &&
+      scheduler_data.fair_threads[0]->vruntime < min_vruntime) {
+    min_vruntime = scheduler_data.fair_threads[0]->vruntime;
+  }
+
+  if (min_vruntime != UINT64_MAX && min_vruntime > scheduler_data.min_vruntime) {
+    scheduler_data.min_vruntime = min_vruntime;
+  }
+}
+
+// Charges the time since the last context switch to `thread`
+static void account_runtime(KernelThread *thread) {
+  const uint64_t now = read_tsc();
+  const uint64_t delta = now - scheduler_data.last_switch_tsc;
+  scheduler_data.last_switch_tsc = now;
+
+  if (!thread) return;
+
+  thread->runtime += delta;
+  if (thread != scheduler_data.idle_thread) {
+    scheduler_histogram_record(&scheduler_data.timeslice, delta);
+  }
+
+  if (thread->scheduling_class == THREAD_CLASS_FAIR) {
+    thread->vruntime +=
+        delta * SCHEDULER_FAIR_BASE_WEIGHT / fair_weights[thread->priority];
+    update_min_vruntime();
+  } else if (thread->scheduling_class == THREAD_CLASS_DEADLINE) {
+    thread->dl_budget -= delta;
+  }
+}
+
+static void enqueue_thread(KernelThread *thread) {
+  assert(!thread->queued);
+  thread->queued = 1;
+  thread->enqueue_tsc = read_tsc();
+
+  if (thread->scheduling_class == THREAD_CLASS_FAIR) {
+    fair_heap_push(thread);
+    return;
+  }
+
+  List *queue;
+  ListEntry *current;
+  if (thread->scheduling_class == THREAD_CLASS_DEADLINE) {
+    // Put the thread after all threads with the same or an earlier deadline
+    queue = &scheduler_data.deadline_threads;
+    current = list_head(queue);
+    while (current) {
+      KernelThread *t = thread_from_list_entry(current);
+      if (thread->dl_deadline < t->dl_deadline) break;
+      current = list_next(current);
+    }
+  } else {
+    // Put the thread after all threads of the same or higher priority, so
+    // threads of equal priority are round-robin scheduled
+    queue = &scheduler_data.realtime_threads;
+    current = list_head(queue);
+    while (current) {
+      KernelThread *t = thread_from_list_entry(current);
+      if (thread_priority(thread) > thread_priority(t)) break;
+      current = list_next(current);
+    }
+  }
+
+  // If we couldn't find a place to put it, put it at the end
+  if (current) {
+    list_insert_before(queue, current, thread_list_entry(thread));
+  } else {
+    list_push_back(queue, thread_list_entry(thread));
+  }
+}
+
+static void dequeue_thread(KernelThread *thread) {
+  assert(thread->queued);
+  thread->queued = 0;
+
+  if (thread->scheduling_class == THREAD_CLASS_FAIR) {
+    fair_heap_remove(thread);
+  } else if (thread->scheduling_class == THREAD_CLASS_DEADLINE) {
+    list_remove(&scheduler_data.deadline_threads, thread_list_entry(thread));
+  } else {
+    list_remove(&scheduler_data.realtime_threads, thread_list_entry(thread));
+  }
+}
+
+// Returns the thread that would run next without dequeueing it, or NULL
+static KernelThread *peek_next_thread() {
+  ListEntry *realtime_head = list_head(&scheduler_data.realtime_threads);
+  if (realtime_head) return thread_from_list_entry(realtime_head);
+
+  ListEntry *deadline_head = list_head(&scheduler_data.deadline_threads);
+  if (deadline_head) return thread_from_list_entry(deadline_head);
+
+  if (scheduler_data.num_fair_threads > 0) {
+    return scheduler_data.fair_threads[0];
+  }
+
+  return NULL;
+}
+
+static KernelThread *pick_next_thread() {
+  KernelThread *next = peek_next_thread();
+  if (!next) return scheduler_data.idle_thread;
+
+  dequeue_thread(next);
+  return next;
+}
+
+// Deadline threads (a constant bandwidth server each)
+
+// Starts a new job for `thread` at `now`, with a full budget
+static void deadline_new_job(KernelThread *thread, uint64_t now) {
+  thread->dl_deadline = now + thread->dl_relative_deadline;
+  thread->dl_budget = thread->dl_runtime;
+  thread->dl_missed = false;
+}
+
+// Counts a miss if `thread` is still working on a job past its deadline
+static void deadline_check_miss(KernelThread *thread, uint64_t now) {
+  if (thread->dl_missed || now <= thread->dl_deadline) return;
+  thread->dl_missed = true;
+  scheduler_data.num_deadline_misses++;
+}
+
+// Wakeup rule: the thread keeps its deadline and budget only if using up the
+// budget before the deadline stays within its bandwidth, otherwise waking up
+// late would let it take more than its share.
+static void deadline_wakeup(KernelThread *thread, uint64_t now) {
+  if (thread->dl_budget > 0 && thread->dl_deadline > now &&
+      (unsigned __int128)thread->dl_budget * thread->dl_period <=
+          (unsigned __int128)(thread->dl_deadline - now) * thread->dl_runtime) {
+    return;
+  }
+
+  deadline_new_job(thread, now);
+}
+
+static void deadline_replenish(TimerNode *node) {
+  thread_wake(container_of(node, KernelThread, dl_replenish_timer));
+}
+
+// Called when the running `thread` has used up its budget. The budget is
+// refilled and the deadline postponed by a period, and the thread sleeps
+// until the start of that period unless it has already begun. Returns true
+// if the thread was throttled.
+static bool deadline_throttle(KernelThread *thread, uint64_t now) {
+  deadline_check_miss(thread, now);
+  scheduler_data.num_deadline_throttles++;
+
+  while (thread->dl_budget <= 0) {
+    thread->dl_deadline += thread->dl_period;
+    thread->dl_budget += thread->dl_runtime;
+  }
+  thread->dl_missed = false;
+
+  const uint64_t replenish = thread->dl_deadline - thread->dl_period;
+  if (replenish <= now) return false;
+
+  // Same as thread_sleep(), the replenish timer wakes it back up
+  thread->status = THREAD_SLEEPING;
+  thread->waiting_on++;
+
+  const uint64_t ns = time_cycles_to_ns(replenish - now);
+  timer_add(&thread->dl_replenish_timer, (ns + NS_PER_MS - 1) / NS_PER_MS);
+  return true;
+}
+
+// Wakes the threads queued by scheduler_defer_wake(). Interrupts must be
+// disabled and preemption enabled.
+static void scheduler_run_deferred_wakes() {
+  while (scheduler_data.deferred_wakes) {
+    KernelThread *thread = scheduler_data.deferred_wakes;
+    scheduler_data.deferred_wakes = thread->next_deferred_wake;
+
+    const uint32_t num_wakes = thread->num_deferred_wakes;
+    thread->num_deferred_wakes = 0;
+    for (uint32_t i = 0; i < num_wakes; ++i) thread_wake_now(thread);
+  }
+}
+
+// Called by scheduler_timer_isr() (scheduler.s) on every time slice and yield
 void scheduler_set_next() {
-  // Attempt to use next thread in list to round-robin schedule all top priority
-  // threads
-  KernelThread *next = NULL;
-  ListEntry *first_thread_entry = list_head(&scheduler_data.thread_list);
-  KernelThread *first_thread = thread_from_list_entry(first_thread_entry);
-
-  // Schedule the next thread in line if there isn't a higher priority thread
-  // waiting
-  if (scheduler_data.current_thread &&
-      thread_priority(scheduler_data.current_thread) >=
-          thread_priority(first_thread)) {
-    ListEntry *current_thread_entry =
-        thread_list_entry(scheduler_data.current_thread);
-    ListEntry *next_thread_entry = list_next(current_thread_entry);
-
-    if (next_thread_entry) next = thread_from_list_entry(next_thread_entry);
-  }
-
-  // If we can't use the next one, pull highest priority ready thread off
-  if (!next ||
-      thread_priority(next) < thread_priority(scheduler_data.current_thread)) {
-    ListEntry *entry = list_head(&scheduler_data.thread_list);
-
-    while (entry) {
-      next = thread_from_list_entry(entry);
-      if (thread_can_run(next)) break;
-
-      entry = list_next(entry);
+  KernelThread *current = scheduler_data.current_thread;
+
+  // With preemption disabled the current thread keeps running, unless it is
+  // giving up the CPU itself (thread_sleep()). Nothing else can be touched:
+  // the thread may be in the middle of updating the run queues.
+  if (scheduler_data.preempt_count > 0 && current &&
+      current->status == THREAD_RUNNING && thread_can_run(current)) {
+    scheduler_data.need_resched = true;
+    scheduler_data.num_deferred_preemptions++;
+    return;
+  }
+
+  account_runtime(current);
+  rcu_note_context_switch();
+
+  // Put the current thread back in line if it can still run
+  if (current && current != scheduler_data.idle_thread) {
+    const uint64_t now = scheduler_data.last_switch_tsc;
+    bool runnable =
+        current->status == THREAD_RUNNING && thread_can_run(current);
+    bool throttled = false;
+
+    if (current->scheduling_class == THREAD_CLASS_DEADLINE) {
+      if (!runnable) {
+        // Blocking ends the job, for threads that don't wait for their next
+        // period
+        deadline_check_miss(current, now);
+      } else if (current->dl_budget <= 0) {
+        throttled = deadline_throttle(current, now);
+        runnable = !throttled;
+      }
+    }
+
+    if (runnable) enqueue_thread(current);
+
+    if (runnable || throttled) {
+      current->num_involuntary_switches++;
+    } else {
+      current->num_voluntary_switches++;
     }
   }
 
-  // Set the next thread
+  if (current) current->preempt_count = scheduler_data.preempt_count;
+
+  // Only once the current thread has been dealt with: a deferred wake of a
+  // thread that just went to sleep has to queue it like any other thread
+  scheduler_data.current_thread = NULL;
+  scheduler_run_deferred_wakes();
+
+  KernelThread *next = pick_next_thread();
   scheduler_data.current_thread = next;
+  scheduler_data.need_resched = false;
+  scheduler_data.preempt_count = next->preempt_count;
+
+  // Interrupts and system calls from ring 3 land on the thread's own kernel
+  // stack
+  if (next->user_stack) {
+    gdt_set_kernel_stack((uint64_t)next + next->stack_num_pages * VM_PAGE_SIZE);
+  }
+
+  // Threads without an address space of their own keep the loaded one, so
+  // switching to a kernel thread and back doesn't cost a CR3 write
+  if (next->address_space) address_space_switch(next->address_space);
+
+  if (next == scheduler_data.idle_thread) return;
+
+  const uint64_t now = scheduler_data.last_switch_tsc;
+  scheduler_histogram_record(&scheduler_data.run_queue_latency,
+                             now - next->enqueue_tsc);
+
+  if (next->wake_tsc != 0) {
+    const uint64_t latency = now - next->wake_tsc;
+    next->wake_tsc = 0;
+    next->last_wake_latency = latency;
+    if (latency > next->max_wake_latency) next->max_wake_latency = latency;
+
+    scheduler_histogram_record(&scheduler_data.wake_latency, latency);
+  }
+}
+
+// Order in which the run queues are served
+static uint32_t class_rank(KernelThreadSchedulingClass scheduling_class) {
+  switch (scheduling_class) {
+    case THREAD_CLASS_REALTIME:
+      return 2;
+    case THREAD_CLASS_DEADLINE:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+// Whether a newly runnable `thread` should run before the current thread
+static bool should_preempt_current(KernelThread *thread) {
+  KernelThread *current = scheduler_data.current_thread;
+  if (!current || current == scheduler_data.idle_thread) return true;
+
+  if (thread->scheduling_class != current->scheduling_class) {
+    return class_rank(thread->scheduling_class) >
+           class_rank(current->scheduling_class);
+  }
+
+  if (thread->scheduling_class == THREAD_CLASS_REALTIME) {
+    return thread_priority(thread) > thread_priority(current);
+  }
+
+  if (thread->scheduling_class == THREAD_CLASS_DEADLINE) {
+    return thread->dl_deadline < current->dl_deadline;
+  }
+
+  return thread->vruntime + SCHEDULER_FAIR_WAKEUP_GRANULARITY <
+         current->vruntime;
+}
+
+void scheduler_preempt_if_needed() {
+  if (!scheduler_data.need_resched || scheduler_data.preempt_count > 0 ||
+      interrupt_in_handler() || !interrupts_status()) {
+    return;
+  }
+
+  scheduler_data.num_wakeup_preemptions++;
+  scheduler_yield();
+}
+
+void scheduler_interrupt_exit() {
+  // Hardware interrupts can only arrive while interrupts are enabled, so the
+  // interrupted thread can be switched away from here. The switch saves the
+  // state of the interrupt handler, which finishes returning once the thread
+  // runs again.
+  if (!scheduler_data.need_resched || scheduler_data.preempt_count > 0 ||
+      interrupt_in_handler()) {
+    return;
+  }
+
+  scheduler_data.num_wakeup_preemptions++;
+  scheduler_yield();
+}
+
+void preempt_disable() {
+  scheduler_data.preempt_count++;
+  __asm__ volatile("" ::: "memory");
+}
+
+void preempt_enable() {
+  __asm__ volatile("" ::: "memory");
+  assert(scheduler_data.preempt_count > 0);
+  if (--scheduler_data.preempt_count > 0) return;
+
+  if (scheduler_data.deferred_wakes) {
+    bool interrupts_enabled = interrupts_status();
+    cli();
+
+    // Check again, an interrupt may have taken care of them
+    if (scheduler_data.preempt_count == 0) scheduler_run_deferred_wakes();
+
+    // Only re-enable interrupts if they were enabled before
+    if (interrupts_enabled) sti();
+  }
+
+  scheduler_preempt_if_needed();
+}
+
+bool preemptible() {
+  return scheduler_data.preempt_count == 0 && interrupts_status() &&
+         !interrupt_in_handler();
+}
+
+bool scheduler_defer_wake(KernelThread *thread) {
+  if (!interrupt_in_handler() || scheduler_data.preempt_count == 0) {
+    return false;
+  }
+
+  if (thread->num_deferred_wakes++ == 0) {
+    thread->next_deferred_wake = scheduler_data.deferred_wakes;
+    scheduler_data.deferred_wakes = thread;
+  }
+  scheduler_data.num_deferred_wakes++;
+  return true;
 }
 
 void scheduler_start_scheduling() {
   // This function should only be called before scheduling has started.
   assert(scheduler_data.current_thread == NULL);
 
+  scheduler_data.last_switch_tsc = read_tsc();
+
   setup_scheduler_timer();
   scheduler_yield();
 }
 
-void scheduler_register_thread(KernelThread *thread) {
-  // Put the new thread in the priority queue
-  ListEntry *current = list_head(&scheduler_data.thread_list);
+void scheduler_stop_timer() { apic_set_local_timer_masked(true); }
+
+void scheduler_start_timer() { setup_scheduler_timer(); }
 
-  // Try to find a place to put the new thread
-  while (current) {
-    KernelThread *t = thread_from_list_entry(current);
-    if (thread_priority(thread) >= thread_priority(t)) break;
-    current = list_next(current);
+void scheduler_timer_tick() {
+  // Time slices are too coarse to enforce deadline budgets
+  KernelThread *current = scheduler_data.current_thread;
+  if (current && current->scheduling_class == THREAD_CLASS_DEADLINE &&
+      (int64_t)(read_tsc() - scheduler_data.last_switch_tsc) >=
+          current->dl_budget) {
+    scheduler_data.need_resched = true;
   }
+}
 
-  // If we couldn't find a place to put it, put it at the end
-  if (current) {
-    list_insert_before(&scheduler_data.thread_list, current,
-                       thread_list_entry(thread));
+bool scheduler_set_deadline(KernelThread *thread, uint64_t runtime_ns,
+                            uint64_t deadline_ns, uint64_t period_ns) {
+  assert(!thread->queued && thread->status == THREAD_SLEEPING);
+  if (runtime_ns == 0 || runtime_ns > deadline_ns || deadline_ns > period_ns) {
+    return false;
+  }
+
+  const uint64_t bandwidth =
+      ((unsigned __int128)runtime_ns << SCHEDULER_BANDWIDTH_SHIFT) / period_ns;
+
+  preempt_disable();
+
+  uint64_t total = scheduler_data.deadline_bandwidth;
+  if (thread->base_scheduling_class == THREAD_CLASS_DEADLINE) {
+    total -= thread->dl_bandwidth;
+  }
+
+  const bool admitted = total + bandwidth <= SCHEDULER_MAX_DEADLINE_BANDWIDTH;
+  if (admitted) {
+    scheduler_data.deadline_bandwidth = total + bandwidth;
+
+    thread->scheduling_class = thread->base_scheduling_class =
+        THREAD_CLASS_DEADLINE;
+    thread->dl_runtime = time_ns_to_cycles(runtime_ns);
+    thread->dl_relative_deadline = time_ns_to_cycles(deadline_ns);
+    thread->dl_period = time_ns_to_cycles(period_ns);
+    thread->dl_bandwidth = bandwidth;
+
+    // The first job starts when the thread does
+    thread->dl_deadline = 0;
+    thread->dl_budget = 0;
+    thread->dl_missed = false;
+    timer_node_init(&thread->dl_replenish_timer, deadline_replenish);
   } else {
-    list_push_back(&scheduler_data.thread_list, thread_list_entry(thread));
+    scheduler_data.num_deadline_rejections++;
+  }
+
+  preempt_enable();
+  return admitted;
+}
+
+void scheduler_wait_next_period() {
+  KernelThread *current = scheduler_data.current_thread;
+  assert(current->scheduling_class == THREAD_CLASS_DEADLINE);
+
+  preempt_disable();
+  uint64_t now = read_tsc();
+  deadline_check_miss(current, now);
+
+  const uint64_t release =
+      current->dl_deadline - current->dl_relative_deadline + current->dl_period;
+  if (now < release) {
+    preempt_enable();
+    timer_thread_sleep_ns(time_cycles_to_ns(release - now));
+    preempt_disable();
+    now = read_tsc();
+  }
+
+  // The job starts at its release time, not whenever the timer woke us up,
+  // unless it's late
+  deadline_new_job(current, now > release ? now : release);
+
+  KernelThread *next = peek_next_thread();
+  if (next && should_preempt_current(next)) scheduler_data.need_resched = true;
+  preempt_enable();
+}
+
+void scheduler_register_thread(KernelThread *thread) {
+  // NOTE: This modifies the run queues, so it should not be called when it
+  // could be interrupted by the scheduler.
+
+  // A thread that is woken up before it has switched away is still current,
+  // it will be put back in line on the next context switch.
+  if (thread == scheduler_data.current_thread || thread->queued) return;
+
+  if (thread->scheduling_class == THREAD_CLASS_FAIR &&
+      thread->vruntime < scheduler_data.min_vruntime) {
+    // Don't let threads that have been sleeping (or are new) monopolize the
+    // CPU until they catch up with everyone else
+    thread->vruntime = scheduler_data.min_vruntime;
+  }
+
+  thread->wake_tsc = read_tsc();
+  if (thread->scheduling_class == THREAD_CLASS_DEADLINE) {
+    deadline_wakeup(thread, thread->wake_tsc);
+  }
+  enqueue_thread(thread);
+
+  if (scheduler_data.current_thread && should_preempt_current(thread)) {
+    scheduler_data.need_resched = true;
+  }
+}
+
+void scheduler_set_effective_priority(
+    KernelThread *thread, KernelThreadSchedulingClass scheduling_class,
+    uint8_t priority) {
+  assert(!preemptible());
+
+  const bool queued = thread->queued;
+  if (queued) dequeue_thread(thread);
+
+  if (thread->scheduling_class != scheduling_class &&
+      scheduling_class == THREAD_CLASS_FAIR &&
+      thread->vruntime < scheduler_data.min_vruntime) {
+    // Same as in scheduler_register_thread(), the time spent as a realtime
+    // thread didn't advance vruntime
+    thread->vruntime = scheduler_data.min_vruntime;
+  }
+
+  thread->scheduling_class = scheduling_class;
+  thread->priority = priority;
+
+  if (queued) {
+    enqueue_thread(thread);
+    if (should_preempt_current(thread)) scheduler_data.need_resched = true;
+  } else if (thread == scheduler_data.current_thread) {
+    // The current thread may have been lowered below a queued thread
+    KernelThread *next = peek_next_thread();
+    if (next && should_preempt_current(next)) {
+      scheduler_data.need_resched = true;
+    }
   }
 }
 
@@ -149,17 +713,63 @@ void scheduler_yield() {
 }
 
 void scheduler_unschedule_thread(KernelThread *thread) {
-  // NOTE: This modifies the thread list, so it should not be called when it
+  // NOTE: This modifies the run queues, so it should not be called when it
   // could be interrupted by the scheduler.
 
-  ListEntry *current_entry = thread_list_entry(thread);
-  list_remove(&scheduler_data.thread_list, current_entry);
+  // The current thread isn't queued, scheduler_set_next() won't put it back
+  // in line once it stops being runnable.
+  if (thread->queued) dequeue_thread(thread);
 }
 
 KernelThread *scheduler_remove_current_thread() {
   KernelThread *current_thread = scheduler_data.current_thread;
+  account_runtime(current_thread);
   scheduler_data.current_thread = NULL;
 
+  // The thread is exiting, give back its reservation. It's running, so the
+  // replenish timer can't be pending.
+  if (current_thread->base_scheduling_class == THREAD_CLASS_DEADLINE) {
+    scheduler_data.deadline_bandwidth -= current_thread->dl_bandwidth;
+  }
+
   scheduler_unschedule_thread(current_thread);
   return current_thread;
 }
+
+void scheduler_snapshot(SchedulerSnapshot *snapshot) {
+  bool interrupts_enabled = interrupts_status();
+  cli();
+
+  snapshot->tsc = read_tsc();
+  snapshot->wake_latency = scheduler_data.wake_latency;
+  snapshot->run_queue_latency = scheduler_data.run_queue_latency;
+  snapshot->timeslice = scheduler_data.timeslice;
+  snapshot->num_wakeup_preemptions = scheduler_data.num_wakeup_preemptions;
+  snapshot->num_threads =
+      thread_sample_all(snapshot->threads, SCHEDULER_SNAPSHOT_MAX_THREADS);
+
+  // Only re-enable interrupts if they were enabled before
+  if (interrupts_enabled) sti();
+}
+
+void scheduler_print_statistics() {
+  const SchedulerHistogram *wake_latency = &scheduler_data.wake_latency;
+  const uint64_t average_latency =
+      wake_latency->count ? wake_latency->total / wake_latency->count : 0;
+
+  text_output_printf("Scheduler: %lu wakeups, wake-to-run avg %lu max %lu "
+                     "cycles, %lu wakeup preemptions\n",
+                     wake_latency->count, average_latency, wake_latency->max,
+                     scheduler_data.num_wakeup_preemptions);
+  text_output_printf("  Preemption disabled: %lu preemptions and %lu "
+                     "interrupt wakes deferred\n",
+                     scheduler_data.num_deferred_preemptions,
+                     scheduler_data.num_deferred_wakes);
+  text_output_printf("  Deadline: %lu%% of the CPU reserved, %lu misses, %lu "
+                     "throttles, %lu reservations rejected\n",
+                     scheduler_data.deadline_bandwidth * 100 /
+                         SCHEDULER_BANDWIDTH_ONE,
+                     scheduler_data.num_deadline_misses,
+                     scheduler_data.num_deadline_throttles,
+                     scheduler_data.num_deadline_rejections);
+}
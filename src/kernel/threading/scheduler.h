@@ -12,7 +12,63 @@ void scheduler_unschedule_thread(KernelThread *thread);
 KernelThread *scheduler_remove_current_thread();
 void scheduler_start_scheduling();
 
+// Let the benchmarks borrow the local APIC timer. There are no time slices
+// while the scheduler timer is stopped, wakeups still preempt.
+void scheduler_stop_timer();
+void scheduler_start_timer();
+
+// Called on every timer tick
+void scheduler_timer_tick();
+
+// Turns `thread` into a THREAD_CLASS_DEADLINE thread that may run for
+// `runtime_ns` within `deadline_ns` of the start of every `period_ns`
+// (runtime <= deadline <= period). Deadline threads run earliest deadline
+// first after realtime threads. Each one is a constant bandwidth server: a
+// thread that uses up its runtime is throttled until its next period, so it
+// can't take more than runtime / period of the CPU.
+// Returns false if the parameters are invalid or the reservation doesn't fit
+// in what's left of the CPU. Must be called before thread_start().
+bool scheduler_set_deadline(KernelThread *thread, uint64_t runtime_ns,
+                            uint64_t deadline_ns, uint64_t period_ns);
+
+// Ends the current job of the current (deadline) thread and sleeps until the
+// next period. A job that ends after its deadline is counted as a miss, as is
+// blocking after the deadline for threads that don't use this.
+void scheduler_wait_next_period();
+
 KernelThread *scheduler_current_thread();
 void scheduler_yield();
 
+// Switches to a thread that was woken up with a higher priority than the
+// current one, instead of waiting for the next time slice. Inside an interrupt
+// handler or with interrupts disabled the switch is left for later (the end of
+// the interrupt, or the next check/time slice).
+void scheduler_preempt_if_needed();
+void scheduler_interrupt_exit();  // Only called by isr_common()
+
+// Preemption can be disabled instead of interrupts to keep other threads off
+// the CPU, e.g. while updating data that only threads use. Sections nest, and
+// a preemption that was due happens when the outermost one ends.
+// Interrupt handlers still run, but the run queues are only changed by them
+// once preemption is enabled again. A thread may sleep with preemption
+// disabled; the count is per thread.
+// Interrupts still have to be disabled for data shared with interrupt
+// handlers.
+void preempt_disable();
+void preempt_enable();
+bool preemptible();  // Neither preemption nor interrupts disabled
+
+// Called by thread_wake(). Inside an interrupt handler that interrupted a
+// section with preemption disabled, queues `thread` to be woken when the
+// section ends and returns true. Returns false otherwise.
+bool scheduler_defer_wake(KernelThread *thread);
+
+// Changes the scheduling class and priority `thread` runs with, moving it in
+// the run queues if needed. Interrupts or preemption must be disabled.
+void scheduler_set_effective_priority(
+    KernelThread *thread, KernelThreadSchedulingClass scheduling_class,
+    uint8_t priority);
+
+void scheduler_print_statistics();
+
 #endif
@@ -1,5 +1,11 @@
 .include "../macros.s"
 
+# SCHEDULER_TIMER_IV (interrupt.h), which the assembler can't include.
+# Exported so interrupt_init() can check that the two match.
+.set SCHEDULER_TIMER_IV, 33
+.globl scheduler_timer_iv
+.set scheduler_timer_iv, SCHEDULER_TIMER_IV
+
 # NOTE: Should be called from inside an interrupt handler
 # Assumes ss, rsp, rflags, cs, and rip are pushed on the
 # stack. WILL remove these values (must be restored with
@@ -53,6 +59,7 @@
 .endm
 
 .extern scheduler_data
+.extern interrupt_account
 
 .globl scheduler_timer_isr
 scheduler_timer_isr:
@@ -71,10 +78,24 @@ scheduler_timer_isr:
   # NOTE: We can do whatever we want to registers now, they are all saved
   # NOTE 2: Theoretically this is true, but empirically it is false
 
+  # Start of the handler for interrupt_account(), kept on the stack (twice,
+  # for alignment)
+  rdtsc
+  shlq  $32, %rdx
+  orq   %rdx, %rax
+  pushq %rax
+  pushq %rax
+
   call  apic_send_eoi
 
   call  scheduler_set_next # Set current thread to next thread
 
+  # interrupt_account(SCHEDULER_TIMER_IV, start)
+  popq  %rsi
+  popq  %rsi
+  movq  $SCHEDULER_TIMER_IV, %rdi
+  call  interrupt_account
+
   # Load new thread
   mov   (scheduler_data), %rdi
 
@@ -0,0 +1,196 @@
+#include <kernel/threading/scheduler.h>
+#include <kernel/threading/scheduler_statistics.h>
+#include <kernel/threading/thread.h>
+#include <kernel/util.h>
+
+#include <kernel/drivers/serial_port.h>
+#include <kernel/drivers/text_output.h>
+#include <kernel/drivers/time.h>
+#include <kernel/drivers/timer.h>
+
+#define SCHEDULER_TOP_PRIORITY 2  // If it doesn't get a reservation
+#define SCHEDULER_TOP_RUNTIME_PERCENT 5
+#define SCHEDULER_TOP_STACK_PAGES 2
+#define SCHEDULER_TOP_WIDTH 56
+#define SCHEDULER_TOP_MAX_THREADS 16
+#define SCHEDULER_TOP_LINE_SPACING 2  // Same spacing as text_output_putchar()
+
+static const char *const class_names[] = {"RT", "FAIR", "DL"};
+static const char *const status_names[] = {"RUN", "SLP", "EXT"};
+
+static struct {
+  uint64_t refresh_ms;
+  KernelThread *thread;
+
+  // The top thread compares each snapshot with the previous one
+  SchedulerSnapshot snapshots[2];
+} scheduler_top_data;
+
+static SchedulerSnapshot dump_snapshot;
+
+void scheduler_histogram_record(SchedulerHistogram *histogram,
+                                uint64_t cycles) {
+  uint32_t bucket = cycles ? 63 - __builtin_clzll(cycles) : 0;
+  if (bucket >= SCHEDULER_HISTOGRAM_BUCKETS) {
+    bucket = SCHEDULER_HISTOGRAM_BUCKETS - 1;
+  }
+
+  histogram->buckets[bucket]++;
+  histogram->count++;
+  histogram->total += cycles;
+  if (cycles > histogram->max) histogram->max = cycles;
+}
+
+// Upper bound of the bucket that contains the `percent`th percentile
+static uint64_t histogram_percentile(const SchedulerHistogram *histogram,
+                                     uint32_t percent) {
+  if (histogram->count == 0) return 0;
+
+  const uint64_t target = (histogram->count * percent + 99) / 100;
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < SCHEDULER_HISTOGRAM_BUCKETS; ++i) {
+    seen += histogram->buckets[i];
+    if (seen >= target) return (2ULL << i) - 1;
+  }
+
+  return histogram->max;
+}
+
+static uint64_t histogram_average(const SchedulerHistogram *histogram) {
+  return histogram->count ? histogram->total / histogram->count : 0;
+}
+
+static void dump_histogram(const char *name,
+                           const SchedulerHistogram *histogram) {
+  serial_port_printf("%s: count %lu, avg %lu, p50 < %lu, p99 < %lu, max %lu\n",
+                     name, histogram->count, histogram_average(histogram),
+                     histogram_percentile(histogram, 50),
+                     histogram_percentile(histogram, 99), histogram->max);
+
+  for (uint32_t i = 0; i < SCHEDULER_HISTOGRAM_BUCKETS; ++i) {
+    if (histogram->buckets[i] == 0) continue;
+    serial_port_printf("  [2^%u, 2^%u): %lu\n", i, i + 1,
+                       histogram->buckets[i]);
+  }
+}
+
+void scheduler_statistics_dump_serial() {
+  SchedulerSnapshot *snapshot = &dump_snapshot;
+  scheduler_snapshot(snapshot);
+
+  serial_port_printf("\nScheduler statistics (cycles) at TSC %lu:\n",
+                     snapshot->tsc);
+  dump_histogram("Wake-to-run latency", &snapshot->wake_latency);
+  dump_histogram("Run queue latency", &snapshot->run_queue_latency);
+  dump_histogram("Timeslice", &snapshot->timeslice);
+  serial_port_printf("Wakeup preemptions: %lu\n",
+                     snapshot->num_wakeup_preemptions);
+
+  serial_port_printf("Threads:\n");
+  for (uint32_t i = 0; i < snapshot->num_threads; ++i) {
+    const ThreadSample *thread = &snapshot->threads[i];
+    serial_port_printf(
+        "  [%u] %s pri %u %s: runtime %lu, switches %lu vol / %lu invol, "
+        "wake-to-run last %lu max %lu\n",
+        thread->tid, class_names[thread->scheduling_class], thread->priority,
+        status_names[thread->status], thread->runtime,
+        thread->num_voluntary_switches, thread->num_involuntary_switches,
+        thread->last_wake_latency, thread->max_wake_latency);
+  }
+}
+
+// Runtime of `tid` in `snapshot`, or 0 if it didn't exist yet
+static uint64_t previous_runtime(const SchedulerSnapshot *snapshot,
+                                 uint32_t tid) {
+  for (uint32_t i = 0; i < snapshot->num_threads; ++i) {
+    if (snapshot->threads[i].tid == tid) return snapshot->threads[i].runtime;
+  }
+  return 0;
+}
+
+static void draw_top(const SchedulerSnapshot *previous,
+                     const SchedulerSnapshot *current) {
+  int col = text_output_num_columns() - SCHEDULER_TOP_WIDTH;
+  if (col < 0) col = 0;
+  int row = 1;
+
+  const uint64_t elapsed = current->tsc - previous->tsc;
+
+  text_output_printf_at(col, row, "%-*s", SCHEDULER_TOP_WIDTH,
+                        " TID CLS  PRI ST   CPU%    VOL  INVOL  WAKE MAX");
+  row += SCHEDULER_TOP_LINE_SPACING;
+
+  for (uint32_t i = 0; i < SCHEDULER_TOP_MAX_THREADS; ++i) {
+    if (i >= current->num_threads) {
+      text_output_printf_at(col, row, "%*s", SCHEDULER_TOP_WIDTH, "");
+      row += SCHEDULER_TOP_LINE_SPACING;
+      continue;
+    }
+
+    const ThreadSample *thread = &current->threads[i];
+    const uint64_t runtime =
+        thread->runtime - previous_runtime(previous, thread->tid);
+    const uint64_t cpu_percent = elapsed ? runtime * 100 / elapsed : 0;
+
+    text_output_printf_at(
+        col, row, "%4u %-4s %3u %-3s %4lu%% %6lu %6lu %9lu   ", thread->tid,
+        class_names[thread->scheduling_class], thread->priority,
+        status_names[thread->status], cpu_percent,
+        thread->num_voluntary_switches, thread->num_involuntary_switches,
+        thread->max_wake_latency);
+    row += SCHEDULER_TOP_LINE_SPACING;
+  }
+
+  text_output_printf_at(
+      col, row, " runq p50 < %lu p99 < %lu, slice avg %lu      ",
+      histogram_percentile(&current->run_queue_latency, 50),
+      histogram_percentile(&current->run_queue_latency, 99),
+      histogram_average(&current->timeslice));
+}
+
+static void *scheduler_top_thread_main(void *parameter UNUSED) {
+  uint32_t current = 0;
+  scheduler_snapshot(&scheduler_top_data.snapshots[current]);
+
+  const bool periodic =
+      thread_scheduling_class(scheduler_top_data.thread) ==
+      THREAD_CLASS_DEADLINE;
+
+  while (true) {
+    if (periodic) {
+      scheduler_wait_next_period();
+    } else {
+      timer_thread_sleep(scheduler_top_data.refresh_ms);
+    }
+
+    const uint32_t previous = current;
+    current ^= 1;
+    scheduler_snapshot(&scheduler_top_data.snapshots[current]);
+
+    draw_top(&scheduler_top_data.snapshots[previous],
+             &scheduler_top_data.snapshots[current]);
+  }
+
+  return NULL;
+}
+
+void scheduler_statistics_start_top(uint64_t refresh_ms) {
+  assert(scheduler_top_data.thread == NULL);
+
+  scheduler_top_data.refresh_ms = refresh_ms;
+  scheduler_top_data.thread =
+      thread_create(scheduler_top_thread_main, NULL, SCHEDULER_TOP_PRIORITY,
+                    SCHEDULER_TOP_STACK_PAGES);
+  assert(scheduler_top_data.thread);
+
+  // Redraw on time even when fair threads keep the CPU busy, without ever
+  // taking more than a small share of it
+  const uint64_t period_ns = refresh_ms * NS_PER_MS;
+  if (!scheduler_set_deadline(scheduler_top_data.thread,
+                              period_ns * SCHEDULER_TOP_RUNTIME_PERCENT / 100,
+                              period_ns, period_ns)) {
+    thread_set_scheduling_class(scheduler_top_data.thread, THREAD_CLASS_FAIR);
+  }
+
+  thread_start(scheduler_top_data.thread);
+}
@@ -0,0 +1,43 @@
+#include <kernel/kernel_common.h>
+#include <kernel/threading/thread.h>
+
+#ifndef _SCHEDULER_STATISTICS_H
+#define _SCHEDULER_STATISTICS_H
+
+// Log2 histograms of TSC cycle counts: bucket i counts values in
+// [2^i, 2^(i+1)), bucket 0 also counts 0.
+#define SCHEDULER_HISTOGRAM_BUCKETS 40
+
+#define SCHEDULER_SNAPSHOT_MAX_THREADS 64
+
+typedef struct {
+  uint64_t buckets[SCHEDULER_HISTOGRAM_BUCKETS];
+  uint64_t count, total, max;
+} SchedulerHistogram;
+
+// A consistent copy of the scheduler statistics, taken with interrupts
+// disabled.
+typedef struct {
+  uint64_t tsc;  // When the snapshot was taken
+
+  SchedulerHistogram wake_latency;       // Woken up -> running
+  SchedulerHistogram run_queue_latency;  // Any time spent in a run queue
+  SchedulerHistogram timeslice;          // Time run before switching away
+  uint64_t num_wakeup_preemptions;
+
+  uint32_t num_threads;  // Capped at SCHEDULER_SNAPSHOT_MAX_THREADS
+  ThreadSample threads[SCHEDULER_SNAPSHOT_MAX_THREADS];
+} SchedulerSnapshot;
+
+void scheduler_histogram_record(SchedulerHistogram *histogram, uint64_t cycles);
+
+void scheduler_snapshot(SchedulerSnapshot *snapshot);
+
+// Writes the current statistics to the serial port only.
+void scheduler_statistics_dump_serial();
+
+// Starts a thread that redraws a top-style summary of the threads in the
+// top-right corner of the screen every `refresh_ms` milliseconds.
+void scheduler_statistics_start_top(uint64_t refresh_ms);
+
+#endif
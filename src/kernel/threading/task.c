@@ -0,0 +1,110 @@
+#include <kernel/threading/scheduler.h>
+#include <kernel/threading/task.h>
+#include <kernel/util.h>
+
+// Below the system queue, so bottom halves aren't held up by tasks
+#define TASK_EXECUTOR_PRIORITY 20
+
+// There is only one CPU for now, so there is only one executor
+static struct { WorkQueue *executor; } task_data;
+
+static void task_run(void *context) {
+  Task *task = (Task *)context;
+
+  // A wakeup that was already queued when the task finished
+  if (task->done) return;
+
+  if (task->function(task) == TASK_DONE) {
+    task->done = true;
+    completion_complete_all(&task->finished);
+  }
+}
+
+static void task_timer_fired(TimerNode *node) {
+  task_wake(container_of(node, Task, timer));
+}
+
+static void task_completion_signalled(CompletionAsyncWait *wait) {
+  task_wake(container_of(wait, Task, completion_wait));
+}
+
+void task_executor_init() {
+  REQUIRE_MODULE("work_queue");
+
+  // Tasks are ordinary background work, not interrupt bottom halves
+  task_data.executor = work_queue_create("tasks", TASK_EXECUTOR_PRIORITY,
+                                         THREAD_CLASS_FAIR);
+
+  REGISTER_MODULE("task");
+}
+
+void task_init(Task *task, TaskFunction function) {
+  task->function = function;
+  task->resume_line = 0;
+  task->done = false;
+  task->timed_out = task->completion_timeout = false;
+  work_item_init(&task->work, task_run, task);
+  timer_node_init(&task->timer, task_timer_fired);
+  completion_init(&task->finished);
+}
+
+void task_spawn(Task *task) {
+  assert(!task->work.pending);
+
+  task->resume_line = 0;
+  task->done = false;
+  completion_reinit(&task->finished);
+
+  task_wake(task);
+}
+
+void task_wake(Task *task) {
+  work_queue_enqueue(task_data.executor, &task->work);
+}
+
+bool task_join(Task *task, int64_t timeout) {
+  return completion_wait(&task->finished, timeout);
+}
+
+void task_sleep_start(Task *task, uint64_t milliseconds) {
+  timer_add(&task->timer, milliseconds);
+}
+
+bool task_completion_start(Task *task, Completion *completion,
+                           int64_t timeout) {
+  task->timed_out = false;
+
+  // The wait is ordered like the executor thread would be
+  if (completion_wait_async(completion, &task->completion_wait,
+                            scheduler_current_thread(),
+                            task_completion_signalled)) {
+    return true;
+  }
+
+  if (timeout == 0) {
+    // Can't have been signalled, nothing ran in between
+    completion_cancel_async(&task->completion_wait);
+    task->timed_out = true;
+    return true;
+  }
+
+  task->completion_timeout = timeout > 0;
+  if (task->completion_timeout) timer_add(&task->timer, timeout);
+  return false;
+}
+
+bool task_completion_finished(Task *task) {
+  if (task->completion_wait.queued &&
+      (!task->completion_timeout || timer_pending(&task->timer))) {
+    return false;
+  }
+
+  // Whichever of the two didn't happen has to be undone. If both did, the
+  // completion wins.
+  if (completion_cancel_async(&task->completion_wait)) {
+    task->timed_out = true;
+  } else if (task->completion_timeout) {
+    timer_cancel(&task->timer);
+  }
+  return true;
+}
@@ -0,0 +1,118 @@
+#include <kernel/kernel_common.h>
+#include <kernel/drivers/timer.h>
+#include <kernel/threading/completion.h>
+#include <kernel/threading/work_queue.h>
+
+#ifndef _TASK_H
+#define _TASK_H
+
+// Stackless async tasks, for operations that spend most of their time waiting
+// (e.g. driver state machines with many requests in flight). A task is a
+// function that runs until it has to wait, returns TASK_PENDING, and is called
+// again from where it left off once it is woken up. Tasks run on the executor
+// (a work queue thread) and share its stack, so a task costs the size of its
+// struct instead of a thread and its stack pages.
+//
+// Locals don't survive an await, everything a task needs across one has to
+// live in the struct that embeds the Task:
+//
+//   typedef struct {
+//     Task task;
+//     Completion *io_done;
+//   } Request;
+//
+//   static TaskStatus request_run(Task *task) {
+//     Request *request = container_of(task, Request, task);
+//     TASK_BEGIN(task);
+//     TASK_SLEEP(task, 10);
+//     TASK_AWAIT_COMPLETION(task, request->io_done, 100);
+//     if (task->timed_out) ...
+//     TASK_END(task);
+//   }
+//
+// Tasks can be woken up at any time, every await checks what it waits for
+// again when the task runs. There can only be one TASK_* await per line.
+// A task must not finish while one of its awaits is still pending.
+
+typedef enum { TASK_PENDING, TASK_DONE } TaskStatus;
+
+typedef struct Task Task;
+typedef TaskStatus (*TaskFunction)(Task *task);
+
+struct Task {
+  TaskFunction function;
+  uint32_t resume_line;  // Where `function` continues, 0 to start over
+  volatile bool done;
+
+  WorkItem work;  // Queued on the executor while the task is runnable
+
+  // What the task is waiting on
+  TimerNode timer;
+  CompletionAsyncWait completion_wait;
+  bool completion_timeout;  // The completion wait also has the timer running
+  bool timed_out;           // Result of the last TASK_AWAIT_COMPLETION()
+
+  Completion finished;  // Completed for everyone once the task is done
+};
+
+void task_executor_init();
+
+void task_init(Task *task, TaskFunction function);
+
+// Starts `task` from the beginning on the executor
+void task_spawn(Task *task);
+
+// Makes `task` run again. Can be called from interrupt handlers.
+void task_wake(Task *task);
+
+// Waits for `task` to finish, from a thread. Tasks can await `finished`.
+bool task_join(Task *task, int64_t timeout);
+
+// Used by the macros below
+void task_sleep_start(Task *task, uint64_t milliseconds);
+bool task_completion_start(Task *task, Completion *completion,
+                           int64_t timeout);
+bool task_completion_finished(Task *task);
+
+#define TASK_BEGIN(task)         \
+  switch ((task)->resume_line) { \
+    case 0:
+
+#define TASK_END(task) \
+  }                    \
+  return TASK_DONE
+
+// Returns TASK_PENDING until `condition` is true when the task runs
+#define TASK_AWAIT(task, condition)          \
+  do {                                       \
+    (task)->resume_line = __LINE__;          \
+    __attribute__((fallthrough));            \
+    case __LINE__:                           \
+      if (!(condition)) return TASK_PENDING; \
+  } while (0)
+
+// Lets the other runnable tasks run
+#define TASK_YIELD(task)            \
+  do {                              \
+    (task)->resume_line = __LINE__; \
+    task_wake(task);                \
+    return TASK_PENDING;            \
+    case __LINE__:;                 \
+  } while (0)
+
+#define TASK_SLEEP(task, milliseconds)                  \
+  do {                                                  \
+    task_sleep_start((task), (milliseconds));           \
+    TASK_AWAIT((task), !timer_pending(&(task)->timer)); \
+  } while (0)
+
+// Consumes one completion from `completion`. Sets `timed_out` if none came
+// within `timeout` milliseconds (-1 means wait forever).
+#define TASK_AWAIT_COMPLETION(task, completion, timeout)           \
+  do {                                                             \
+    if (!task_completion_start((task), (completion), (timeout))) { \
+      TASK_AWAIT((task), task_completion_finished(task));          \
+    }                                                              \
+  } while (0)
+
+#endif
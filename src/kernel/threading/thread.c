@@ -1,64 +1,148 @@
 #include <kernel/threading/scheduler.h>
 #include <kernel/threading/thread.h>
+#include <kernel/threading/thread_internal.h>
+#include <kernel/threading/work_queue.h>
 #include <kernel/util.h>
 
 #include <kernel/memory/kmalloc.h>
 #include <kernel/memory/virtual_memory.h>
 
 #include <kernel/drivers/gdt.h>
+#include <kernel/drivers/syscall.h>
 #include <kernel/drivers/text_output.h>
 #include <kernel/drivers/timer.h>
 
-struct KernelThread {
-  // NOTE: If the following fields are changed, scheduler.s
-  // MUST be updated.
-  // DO NOT ADD FIELDS BEFORE THESE ONES
+// Exited threads are kept around so that their stacks (which the
+// KernelThread struct sits at the bottom of) can be reused. Only stacks of up to
+// THREAD_CACHE_MAX_PAGES are cached, and at most THREAD_CACHE_MAX_ENTRIES of
+// each size.
+#define THREAD_CACHE_MAX_PAGES 8
+#define THREAD_CACHE_MAX_ENTRIES 16
+
+// Only used for interrupts and system calls
+#define THREAD_USER_KERNEL_STACK_PAGES 2
+
+static void thread_reap_work(void *context);
+
+static struct {
+  uint32_t next_tid;
+
+  // Threads that have called thread_exit(). They can't be freed by
+  // thread_exit() itself, since it is still running on the thread's stack.
+  List exited_threads;
+  WorkItem reap_work;
+
+  List cache[THREAD_CACHE_MAX_PAGES + 1];  // Indexed by stack_num_pages
+  uint32_t cache_size[THREAD_CACHE_MAX_PAGES + 1];
+
+  List all_threads;
+} thread_data = {.next_tid = 1,
+                 .reap_work = {.function = thread_reap_work}};
+
+// Moves every exited thread into the cache, or frees it if the cache is full.
+// NOTE: Every thread on `exited_threads` has already been switched away from
+// for good: thread_exit() adds the current thread with interrupts disabled and
+// keeps them disabled until the context switch, and nothing else runs while
+// preemption is disabled here.
+static void thread_reap() {
+  preempt_disable();
+
+  ListEntry *current = list_head(&thread_data.exited_threads);
+  list_init(&thread_data.exited_threads);
+
+  while (current) {
+    KernelThread *thread = thread_from_list_entry(current);
+    current = list_next(current);
+
+    if (thread->user_stack) {
+      vm_clear_user_accessible(thread->user_stack,
+                               thread->user_stack_num_pages * VM_PAGE_SIZE);
+      vm_pfree(thread->user_stack, thread->user_stack_num_pages);
+      thread->user_stack = NULL;
+    }
+
+    const uint64_t num_pages = thread->stack_num_pages;
+    if (num_pages <= THREAD_CACHE_MAX_PAGES &&
+        thread_data.cache_size[num_pages] < THREAD_CACHE_MAX_ENTRIES) {
+      list_push_front(&thread_data.cache[num_pages], &thread->entry);
+      thread_data.cache_size[num_pages]++;
+    } else {
+      vm_pfree(thread, num_pages);
+    }
+  }
 
-  // Registers popped off by iret
-  uint64_t ss, rsp, rflags, cs, rip;
+  preempt_enable();
+}
 
-  // Other registers
-  uint64_t rax, rbx, rcx, rdx, rsi, rdi, rbp;
-  uint64_t r8, r9, r10, r11, r12, r13, r14, r15;
-  uint64_t ds, es, fs, gs;
+static void thread_reap_work(void *context UNUSED) { thread_reap(); }
 
-  // These fields can be modified at will
+// Returns a cached thread with a `stack_num_pages` sized stack, or NULL
+static KernelThread *thread_cache_take(uint64_t stack_num_pages) {
+  if (stack_num_pages > THREAD_CACHE_MAX_PAGES) return NULL;
 
-  ListEntry entry;
-  uint32_t tid;
-  uint32_t
-      waiting_on : 8;  // Number of mutexes, IOs, etc. this thread is waiting on
-  uint32_t priority : 5;  // Thread priority, higher priority threads will
-                          // preempt lower priority threads
-  uint32_t status : 8;
-  uint32_t reserved : 11;
+  preempt_disable();
 
-  uint64_t stack_num_pages;
-};
+  KernelThread *thread = NULL;
+  ListEntry *entry = list_head(&thread_data.cache[stack_num_pages]);
+  if (entry) {
+    list_remove(&thread_data.cache[stack_num_pages], entry);
+    thread_data.cache_size[stack_num_pages]--;
+    thread = thread_from_list_entry(entry);
+  }
 
-static struct { uint32_t next_tid; } thread_data = {.next_tid = 1};
+  preempt_enable();
+
+  return thread;
+}
 
 // Wrapper function that calls thread_exit() when the main_func returns.
 static void thread_wrapper(KernelThreadMain main_func, void *parameter) {
-  // TODO: Use the return value;
-  main_func(parameter);
-  thread_exit();
+  thread_exit_with_value(main_func(parameter));
+}
+
+// Hands an exited thread to the reaper. Interrupts or preemption must be
+// disabled.
+static void thread_queue_reap(KernelThread *thread) {
+  list_push_back(&thread_data.exited_threads, &thread->entry);
+  work_queue_enqueue(work_queue_system(), &thread_data.reap_work);
 }
 
 KernelThread *thread_create(KernelThreadMain main_func, void *parameter,
                             uint8_t priority, uint64_t stack_num_pages) {
   assert(sizeof(KernelThread) < stack_num_pages * VM_PAGE_SIZE);
 
-  // Allocate large region for thread struct and stack
-  KernelThread *new_thread = vm_palloc(stack_num_pages);
+  // Reuse the region of an exited thread if we can, otherwise allocate a large
+  // region for thread struct and stack
+  thread_reap();
+  KernelThread *new_thread = thread_cache_take(stack_num_pages);
+  if (!new_thread) new_thread = vm_palloc(stack_num_pages);
+  if (!new_thread) return NULL;
 
   assert(priority < 32);  // We only have 5 bits
 
   new_thread->tid = thread_data.next_tid++;
-  new_thread->priority = priority;
+  new_thread->priority = new_thread->base_priority = priority;
   new_thread->waiting_on = 0;
   new_thread->stack_num_pages = stack_num_pages;
+  new_thread->user_stack = NULL;
+  new_thread->user_stack_num_pages = 0;
+  new_thread->address_space = NULL;
   new_thread->status = THREAD_SLEEPING;
+  new_thread->scheduling_class = new_thread->base_scheduling_class =
+      THREAD_CLASS_REALTIME;
+  list_init(&new_thread->held_locks);
+  new_thread->blocked_on = NULL;
+  new_thread->queued = 0;
+  new_thread->runtime = new_thread->vruntime = 0;
+  new_thread->wake_tsc = 0;
+  new_thread->last_wake_latency = new_thread->max_wake_latency = 0;
+  new_thread->num_voluntary_switches = new_thread->num_involuntary_switches = 0;
+  new_thread->preempt_count = 0;
+  new_thread->num_deferred_wakes = 0;
+  new_thread->next_deferred_wake = NULL;
+  new_thread->return_value = NULL;
+  completion_init(&new_thread->exited);
+  new_thread->joinable = new_thread->joined = false;
 
   // Setup entry point
   new_thread->rip = (uint64_t)thread_wrapper;
@@ -82,9 +166,83 @@ KernelThread *thread_create(KernelThreadMain main_func, void *parameter,
   new_thread->r8 = new_thread->r9 = new_thread->r10 = new_thread->r11 = 0;
   new_thread->r12 = new_thread->r13 = new_thread->r14 = new_thread->r15 = 0;
 
+  preempt_disable();
+  list_push_back(&thread_data.all_threads, &new_thread->all_threads_entry);
+  preempt_enable();
+
   return new_thread;
 }
 
+KernelThread *thread_create_user(KernelThreadMain main_func, void *parameter,
+                                 uint8_t priority,
+                                 uint64_t user_stack_num_pages) {
+  void *user_stack = vm_palloc(user_stack_num_pages);
+  if (!user_stack) return NULL;
+
+  KernelThread *thread = thread_create(main_func, parameter, priority,
+                                       THREAD_USER_KERNEL_STACK_PAGES);
+  if (!thread) {
+    vm_pfree(user_stack, user_stack_num_pages);
+    return NULL;
+  }
+
+  const uint64_t user_stack_size = user_stack_num_pages * VM_PAGE_SIZE;
+  vm_set_user_accessible(user_stack, user_stack_size);
+  thread->user_stack = user_stack;
+  thread->user_stack_num_pages = user_stack_num_pages;
+
+  // Start straight in `main_func`, which returns to a stub that makes the
+  // exit system call
+  uint64_t *return_address =
+      (uint64_t *)((uint8_t *)user_stack + user_stack_size) - 1;
+  *return_address = (uint64_t)syscall_user_thread_exit;
+  thread->rip = (uint64_t)main_func;
+  thread->rdi = (uint64_t)parameter;
+  thread->rsp = thread->rbp = (uint64_t)return_address;
+
+  thread->cs = GDT_USER_CS;
+  thread->ss = thread->ds = thread->es = thread->fs = thread->gs = GDT_USER_DS;
+
+  return thread;
+}
+
+void thread_set_scheduling_class(KernelThread *thread,
+                                 KernelThreadSchedulingClass scheduling_class) {
+  assert(!thread->queued && thread->status == THREAD_SLEEPING);
+  assert(scheduling_class != THREAD_CLASS_DEADLINE);
+  assert(thread->base_scheduling_class != THREAD_CLASS_DEADLINE);
+  thread->scheduling_class = thread->base_scheduling_class = scheduling_class;
+}
+
+void thread_set_joinable(KernelThread *thread) {
+  assert(!thread->queued && thread->status == THREAD_SLEEPING);
+  thread->joinable = true;
+}
+
+void thread_set_address_space(KernelThread *thread,
+                              AddressSpace *address_space) {
+  assert(!thread->queued && thread->status == THREAD_SLEEPING);
+  thread->address_space = address_space;
+}
+
+bool thread_join(KernelThread *thread, void **result, int64_t timeout) {
+  assert(thread->joinable && !thread->joined);
+  assert(thread != scheduler_current_thread());
+
+  if (!completion_wait(&thread->exited, timeout)) return false;
+  if (result) *result = thread->return_value;
+
+  // The thread may not have switched away for the last time yet, in which
+  // case thread_exit() hands it to the reaper itself. It can't get there
+  // while preemption is disabled, and it disables interrupts before looking.
+  preempt_disable();
+  thread->joined = true;
+  if (thread->status == THREAD_EXITED) thread_queue_reap(thread);
+  preempt_enable();
+
+  return true;
+}
+
 uint32_t thread_id(KernelThread *thread) { return thread->tid; }
 
 uint8_t thread_priority(KernelThread *thread) { return thread->priority; }
@@ -93,6 +251,12 @@ bool thread_can_run(KernelThread *thread) { return thread->waiting_on == 0; }
 
 uint8_t thread_status(KernelThread *thread) { return thread->status; }
 
+KernelThreadSchedulingClass thread_scheduling_class(KernelThread *thread) {
+  return thread->scheduling_class;
+}
+
+uint64_t thread_runtime(KernelThread *thread) { return thread->runtime; }
+
 ListEntry *thread_list_entry(KernelThread *thread) { return &thread->entry; }
 
 KernelThread *thread_from_list_entry(ListEntry *entry) {
@@ -103,18 +267,39 @@ uint64_t *thread_register_list_pointer(KernelThread *thread) {
   return &thread->ss;
 }
 
-void thread_exit() {
+void thread_exit() { thread_exit_with_value(NULL); }
+
+void thread_exit_with_value(void *return_value) {
+  KernelThread *current_thread = scheduler_current_thread();
+  current_thread->return_value = return_value;
+  if (current_thread->joinable) {
+    completion_complete_all(&current_thread->exited);
+  }
+
   cli();
-  KernelThread *current_thread = scheduler_remove_current_thread();
-  vm_pfree(current_thread, current_thread->stack_num_pages);
-  sti();
+  current_thread = scheduler_remove_current_thread();
+  assert(list_head(&current_thread->held_locks) == NULL);  // Leaked a Lock
+  current_thread->status = THREAD_EXITED;
+  list_remove(&thread_data.all_threads, &current_thread->all_threads_entry);
+
+  // We are still running on this thread's stack, so leave freeing it to the
+  // reaper. A joinable thread that hasn't been joined yet is handed over by
+  // thread_join().
+  if (!current_thread->joinable || current_thread->joined) {
+    thread_queue_reap(current_thread);
+  }
 
+  // Interrupts stay disabled until we have switched to another thread
   scheduler_yield();
+  assert(false);  // We should never get here
 }
 
 void thread_sleep(KernelThread *thread) {
-  // NOTE: This function must be called with interrupts disabled
-  assert(!interrupts_status());
+  // NOTE: This function must be called with interrupts or preemption disabled
+  assert(!preemptible());
+  bool interrupts_enabled = interrupts_status();
+  cli();
+
   thread->status = THREAD_SLEEPING;
 
   ++thread->waiting_on;
@@ -125,7 +310,9 @@ void thread_sleep(KernelThread *thread) {
 
   sti();              // We need interrupts to get scheduling
   scheduler_yield();  // This doesn't return until we wake up
-  cli();              // Leave interrupts off (like we found them)
+
+  // Leave interrupts off if that's how we found them
+  if (!interrupts_enabled) cli();
 }
 
 void thread_start(KernelThread *thread) {
@@ -135,8 +322,17 @@ void thread_start(KernelThread *thread) {
 }
 
 void thread_wake(KernelThread *thread) {
-  // NOTE: This function must be called with interrupts disabled
-  assert(!interrupts_status());
+  // NOTE: This function must be called with interrupts or preemption disabled
+  assert(!preemptible());
+
+  // An interrupt handler can't touch the run queues while the thread it
+  // interrupted has preemption disabled
+  if (scheduler_defer_wake(thread)) return;
+
+  thread_wake_now(thread);
+}
+
+void thread_wake_now(KernelThread *thread) {
   if (thread->status == THREAD_RUNNING) return;
 
   assert(thread->waiting_on > 0);
@@ -148,3 +344,52 @@ void thread_wake(KernelThread *thread) {
     scheduler_register_thread(thread);
   }
 }
+
+void thread_print_statistics() {
+  static const char *const class_names[] = {"RT", "FAIR", "DL"};
+
+  preempt_disable();
+
+  text_output_printf("Threads:\n");
+  ListEntry *current = list_head(&thread_data.all_threads);
+  while (current) {
+    KernelThread *thread =
+        container_of(current, KernelThread, all_threads_entry);
+    text_output_printf(
+        "  [%u] %s pri %u, status %u, runtime %lu cycles, max wake-to-run "
+        "%lu cycles\n",
+        thread->tid, class_names[thread->scheduling_class], thread->priority,
+        thread->status, thread->runtime, thread->max_wake_latency);
+    current = list_next(current);
+  }
+
+  preempt_enable();
+}
+
+uint32_t thread_sample_all(ThreadSample *samples, uint32_t max_samples) {
+  preempt_disable();
+
+  uint32_t num_samples = 0;
+  ListEntry *current = list_head(&thread_data.all_threads);
+  while (current && num_samples < max_samples) {
+    KernelThread *thread =
+        container_of(current, KernelThread, all_threads_entry);
+    ThreadSample *sample = &samples[num_samples++];
+
+    sample->tid = thread->tid;
+    sample->priority = thread->priority;
+    sample->status = thread->status;
+    sample->scheduling_class = thread->scheduling_class;
+    sample->runtime = thread->runtime;
+    sample->num_voluntary_switches = thread->num_voluntary_switches;
+    sample->num_involuntary_switches = thread->num_involuntary_switches;
+    sample->last_wake_latency = thread->last_wake_latency;
+    sample->max_wake_latency = thread->max_wake_latency;
+
+    current = list_next(current);
+  }
+
+  preempt_enable();
+
+  return num_samples;
+}
@@ -1,5 +1,6 @@
 #include <kernel/datastructures/list.h>
 #include <kernel/kernel_common.h>
+#include <kernel/memory/address_space.h>
 
 #ifndef _THREAD_H
 #define _THREAD_H
@@ -13,16 +14,75 @@ typedef enum {
   THREAD_EXITED
 } KernelThreadStatus;
 
+// Realtime threads are scheduled strictly by priority (round-robin between
+// threads of equal priority) and always run before the other classes.
+// Deadline threads run earliest deadline first, within a reserved share of the
+// CPU (see scheduler_set_deadline()), and run before fair threads. Fair
+// threads share the CPU in proportion to a weight derived from their priority.
+typedef enum {
+  THREAD_CLASS_REALTIME,
+  THREAD_CLASS_FAIR,
+  THREAD_CLASS_DEADLINE
+} KernelThreadSchedulingClass;
+
 // Priority is in the range [0, 31]. Higher priority threads run before lower
 // priority threads. The idle thread runs at priority (0), so any thread that
-// does work should be priority > 0.
+// does work should be priority > 0. Threads are created in
+// THREAD_CLASS_REALTIME.
 KernelThread *thread_create(KernelThreadMain main_func, void *parameter,
                             uint8_t priority, uint64_t stack_num_pages);
 
+// Creates a thread that runs `main_func` in ring 3, on a user stack of
+// `user_stack_num_pages`. Returning from `main_func` exits the thread. Every
+// other page the thread touches, including its code, has to be made
+// accessible with vm_set_user_accessible(), and it can only get into the
+// kernel through system calls (see syscall.h).
+KernelThread *thread_create_user(KernelThreadMain main_func, void *parameter,
+                                 uint8_t priority,
+                                 uint64_t user_stack_num_pages);
+
+// Must be called before thread_start(). THREAD_CLASS_DEADLINE needs
+// parameters, use scheduler_set_deadline() for it.
+void thread_set_scheduling_class(KernelThread *thread,
+                                 KernelThreadSchedulingClass scheduling_class);
+
+// Must be called before thread_start(). The thread is kept around after it
+// exits until thread_join() is called for it, exactly once.
+void thread_set_joinable(KernelThread *thread);
+
+// Must be called before thread_start(). The scheduler loads `address_space`
+// whenever the thread runs, it must outlive the thread.
+void thread_set_address_space(KernelThread *thread,
+                              AddressSpace *address_space);
+
+// Waits for a joinable `thread` to exit and stores what its main function
+// returned in `result` (if not NULL). Returns false on timeout (in
+// milliseconds, -1 means wait forever), the thread can be joined again then.
+bool thread_join(KernelThread *thread, void **result, int64_t timeout);
+
 uint32_t thread_id(KernelThread *thread);
 uint8_t thread_priority(KernelThread *thread);
 uint8_t thread_status(KernelThread *thread);
 bool thread_can_run(KernelThread *thread);
+KernelThreadSchedulingClass thread_scheduling_class(KernelThread *thread);
+uint64_t thread_runtime(KernelThread *thread);  // In TSC cycles
+
+void thread_print_statistics();
+
+// Point-in-time copy of a thread's scheduling statistics. Times are in TSC
+// cycles.
+typedef struct {
+  uint32_t tid;
+  uint8_t priority, status, scheduling_class;
+  uint64_t runtime;
+  uint64_t num_voluntary_switches;    // Switched away because it blocked
+  uint64_t num_involuntary_switches;  // Preempted while it could still run
+  uint64_t last_wake_latency, max_wake_latency;
+} ThreadSample;
+
+// Fills `samples` with up to `max_samples` live threads, returns the number of
+// samples written.
+uint32_t thread_sample_all(ThreadSample *samples, uint32_t max_samples);
 
 ListEntry *thread_list_entry(KernelThread *thread);
 KernelThread *thread_from_list_entry(ListEntry *entry);
@@ -30,6 +90,7 @@ uint64_t *thread_register_list_pointer(KernelThread *thread);
 
 // Functions that can be called by threads
 void thread_exit();
+void thread_exit_with_value(void *return_value);  // For thread_join()
 
 // Functions that should not be called by threads
 void thread_start(KernelThread *thread);
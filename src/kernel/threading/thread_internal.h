@@ -0,0 +1,105 @@
+#include <kernel/datastructures/list.h>
+#include <kernel/drivers/timer.h>
+#include <kernel/kernel_common.h>
+#include <kernel/threading/completion.h>
+#include <kernel/threading/thread.h>
+
+// Only the threading code should include this file, everything else should go
+// through the functions in thread.h.
+
+#ifndef _THREAD_INTERNAL_H
+#define _THREAD_INTERNAL_H
+
+struct AddressSpace;
+struct LockWaiter;
+
+struct KernelThread {
+  // NOTE: If the following fields are changed, scheduler.s
+  // MUST be updated.
+  // DO NOT ADD FIELDS BEFORE THESE ONES
+
+  // Registers popped off by iret
+  uint64_t ss, rsp, rflags, cs, rip;
+
+  // Other registers
+  uint64_t rax, rbx, rcx, rdx, rsi, rdi, rbp;
+  uint64_t r8, r9, r10, r11, r12, r13, r14, r15;
+  uint64_t ds, es, fs, gs;
+
+  // These fields can be modified at will
+
+  ListEntry entry;              // Run queue, exited list or cache
+  ListEntry all_threads_entry;  // List of every live thread
+  uint32_t tid;
+  uint32_t
+      waiting_on : 8;  // Number of mutexes, IOs, etc. this thread is waiting on
+  uint32_t priority : 5;  // Thread priority, higher priority threads will
+                          // preempt lower priority threads
+  uint32_t status : 8;
+  uint32_t scheduling_class : 2;
+  uint32_t queued : 1;  // In one of the scheduler's run queues
+
+  // `priority` and `scheduling_class` can be temporarily raised by priority
+  // inheritance, these are the values they go back to.
+  uint32_t base_priority : 5;
+  uint32_t base_scheduling_class : 2;
+  uint32_t reserved : 1;
+
+  uint64_t stack_num_pages;
+
+  // Ring 3 threads (see thread_create_user()), NULL for kernel threads. The
+  // stack above is their kernel stack then.
+  void *user_stack;
+  uint64_t user_stack_num_pages;
+
+  // Loaded while the thread runs (see thread_set_address_space()), NULL to
+  // run in whatever address space is loaded
+  struct AddressSpace *address_space;
+
+  // thread_join() (see thread_set_joinable()). A joinable thread is only
+  // reaped once it has exited and been joined.
+  void *return_value;  // Of the main function, NULL for thread_exit()
+  Completion exited;
+  bool joinable, joined;
+
+  // Priority inheritance (see lock.c)
+  List held_locks;                // Locks owned by this thread
+  struct LockWaiter *blocked_on;  // Set while waiting for a Lock
+
+  // Scheduler accounting, in TSC cycles
+  uint64_t runtime;
+  uint64_t vruntime;     // Weighted runtime (THREAD_CLASS_FAIR only)
+  uint32_t heap_index;   // Position in the fair run queue
+
+  // Wake-to-run latency, in TSC cycles
+  uint64_t wake_tsc;  // When the thread was last made runnable, 0 once it runs
+  uint64_t last_wake_latency, max_wake_latency;
+
+  uint64_t enqueue_tsc;  // When the thread was last put in a run queue
+  uint64_t num_voluntary_switches, num_involuntary_switches;
+
+  // THREAD_CLASS_DEADLINE reservation (see scheduler_set_deadline()), in TSC
+  // cycles. The parameters are relative, `deadline` and `budget` belong to
+  // the current job.
+  uint64_t dl_runtime, dl_relative_deadline, dl_period;
+  uint64_t dl_bandwidth;  // Fraction of the CPU, SCHEDULER_BANDWIDTH_SHIFT
+  uint64_t dl_deadline;
+  int64_t dl_budget;  // Negative after an overrun
+  bool dl_missed;     // The current deadline was already counted as missed
+  TimerNode dl_replenish_timer;  // Ends throttling
+
+  // The scheduler's preempt count while this thread isn't running
+  uint32_t preempt_count;
+
+  // Wakes from interrupt handlers that had to wait until preemption was
+  // enabled again (see thread_wake()). Kept out of the bitfields above, which
+  // the interrupted code may be in the middle of updating.
+  uint32_t num_deferred_wakes;
+  struct KernelThread *next_deferred_wake;
+};
+
+// thread_wake() without the check for a wake that has to be deferred, for the
+// scheduler to run the deferred ones
+void thread_wake_now(KernelThread *thread);
+
+#endif
@@ -0,0 +1,132 @@
+#include <kernel/threading/scheduler.h>
+#include <kernel/threading/thread_internal.h>
+#include <kernel/threading/wait_queue.h>
+#include <kernel/util.h>
+
+#include <kernel/drivers/timer.h>
+
+// Same ordering as the scheduler: realtime threads, then deadline threads,
+// then fair threads. Realtime and fair threads are then ordered by priority.
+static uint32_t wait_queue_rank(KernelThread *thread) {
+  switch (thread->scheduling_class) {
+    case THREAD_CLASS_REALTIME:
+      return 33 + thread->priority;
+    case THREAD_CLASS_DEADLINE:
+      return 32;
+    default:
+      return thread->priority;
+  }
+}
+
+void wait_queue_init(WaitQueue *queue) { list_init(&queue->waiters); }
+
+void wait_queue_entry_init(WaitQueueEntry *entry, KernelThread *thread,
+                           uint64_t value) {
+  entry->thread = thread;
+  entry->value = value;
+  entry->woken = false;
+}
+
+bool wait_queue_empty(WaitQueue *queue) {
+  return list_head(&queue->waiters) == NULL;
+}
+
+WaitQueueEntry *wait_queue_head(WaitQueue *queue) {
+  ListEntry *head = list_head(&queue->waiters);
+  return head ? container_of(head, WaitQueueEntry, entry) : NULL;
+}
+
+void wait_queue_add(WaitQueue *queue, WaitQueueEntry *entry) {
+  assert(!preemptible());
+  const uint32_t rank = wait_queue_rank(entry->thread);
+
+  // Put the entry after every entry that ranks at least as high
+  ListEntry *current = list_head(&queue->waiters);
+  while (current) {
+    WaitQueueEntry *to_compare = container_of(current, WaitQueueEntry, entry);
+    if (rank > wait_queue_rank(to_compare->thread)) break;
+    current = list_next(current);
+  }
+
+  // If we couldn't find a place to put it, put it at the end
+  if (current) {
+    list_insert_before(&queue->waiters, current, &entry->entry);
+  } else {
+    list_push_back(&queue->waiters, &entry->entry);
+  }
+}
+
+void wait_queue_remove(WaitQueue *queue, WaitQueueEntry *entry) {
+  assert(!preemptible());
+  list_remove(&queue->waiters, &entry->entry);
+}
+
+void wait_queue_reposition(WaitQueue *queue, WaitQueueEntry *entry) {
+  wait_queue_remove(queue, entry);
+  wait_queue_add(queue, entry);
+}
+
+bool wait_queue_sleep(WaitQueue *queue, WaitQueueEntry *entry,
+                      int64_t timeout) {
+  assert(!preemptible());
+  assert(entry->thread == scheduler_current_thread());
+
+  if (timeout == -1) {
+    while (!entry->woken) thread_sleep(entry->thread);
+    return true;
+  }
+
+  // We are woken up either by the timer or by a wake function.
+  // timer_thread_sleep() returns with interrupts or preemption disabled, like
+  // we are now.
+  if (!entry->woken) timer_thread_sleep(timeout);
+
+  if (!entry->woken) wait_queue_remove(queue, entry);
+  return entry->woken;
+}
+
+bool wait_queue_wait(WaitQueue *queue, WaitQueueEntry *entry, int64_t timeout) {
+  wait_queue_add(queue, entry);
+  return wait_queue_sleep(queue, entry, timeout);
+}
+
+bool wait_queue_wait_on_value(WaitQueue *queue, volatile uint32_t *address,
+                              uint32_t expected, int64_t timeout) {
+  preempt_disable();
+
+  bool woken = false;
+  if (*address == expected && timeout != 0) {
+    WaitQueueEntry entry;
+    wait_queue_entry_init(&entry, scheduler_current_thread(), 0);
+    woken = wait_queue_wait(queue, &entry, timeout);
+  }
+
+  preempt_enable();
+
+  return woken;
+}
+
+void wait_queue_wake_entry(WaitQueue *queue, WaitQueueEntry *entry) {
+  wait_queue_remove(queue, entry);
+  entry->woken = true;
+  thread_wake(entry->thread);
+}
+
+uint32_t wait_queue_wake_one(WaitQueue *queue) {
+  return wait_queue_wake_n(queue, 1);
+}
+
+uint32_t wait_queue_wake_n(WaitQueue *queue, uint32_t n) {
+  uint32_t num_woken = 0;
+  WaitQueueEntry *entry;
+  while (num_woken < n && (entry = wait_queue_head(queue))) {
+    wait_queue_wake_entry(queue, entry);
+    num_woken++;
+  }
+
+  return num_woken;
+}
+
+uint32_t wait_queue_wake_all(WaitQueue *queue) {
+  return wait_queue_wake_n(queue, UINT32_MAX);
+}
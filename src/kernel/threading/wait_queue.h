@@ -0,0 +1,63 @@
+#include <kernel/datastructures/list.h>
+#include <kernel/kernel_common.h>
+#include <kernel/threading/thread.h>
+
+#ifndef _WAIT_QUEUE_H
+#define _WAIT_QUEUE_H
+
+// A list of sleeping threads, ordered by priority (FIFO among equal
+// priorities). Entries are intrusive and owned by the waiter, usually on its
+// stack, so waiting never allocates.
+//
+// NOTE: Every function here must be called with preemption disabled, or with
+// interrupts disabled if the queue is also used by an interrupt handler.
+
+typedef struct {
+  ListEntry entry;
+  KernelThread *thread;
+  uint64_t value;       // For the owner of the queue, e.g. units wanted
+  volatile bool woken;  // Set when the entry is removed by a wake function
+} WaitQueueEntry;
+
+typedef struct {
+  List waiters;
+} WaitQueue;
+
+void wait_queue_init(WaitQueue *queue);
+void wait_queue_entry_init(WaitQueueEntry *entry, KernelThread *thread,
+                           uint64_t value);
+
+bool wait_queue_empty(WaitQueue *queue);
+WaitQueueEntry *wait_queue_head(WaitQueue *queue);  // NULL if empty
+
+void wait_queue_add(WaitQueue *queue, WaitQueueEntry *entry);
+void wait_queue_remove(WaitQueue *queue, WaitQueueEntry *entry);
+
+// Moves `entry` to the right place after its thread's priority changed
+void wait_queue_reposition(WaitQueue *queue, WaitQueueEntry *entry);
+
+// Sleeps until `entry` (which must already be in `queue`) is woken, or for at
+// most `timeout` milliseconds (-1 means forever). On timeout the entry is
+// removed from the queue. Returns true if the entry was woken.
+bool wait_queue_sleep(WaitQueue *queue, WaitQueueEntry *entry,
+                      int64_t timeout);
+
+// wait_queue_add() followed by wait_queue_sleep()
+bool wait_queue_wait(WaitQueue *queue, WaitQueueEntry *entry, int64_t timeout);
+
+// Futex-style wait: sleeps on `queue` only if `*address == expected`, which is
+// checked with preemption disabled so a waker that changes the value and then
+// wakes the queue can't be missed. Returns true if woken, false if the value
+// didn't match or the wait timed out.
+bool wait_queue_wait_on_value(WaitQueue *queue, volatile uint32_t *address,
+                              uint32_t expected, int64_t timeout);
+
+// Removes `entry` from `queue` and wakes its thread
+void wait_queue_wake_entry(WaitQueue *queue, WaitQueueEntry *entry);
+
+// Wake the highest priority waiter(s), return the number of threads woken
+uint32_t wait_queue_wake_one(WaitQueue *queue);
+uint32_t wait_queue_wake_n(WaitQueue *queue, uint32_t n);
+uint32_t wait_queue_wake_all(WaitQueue *queue);
+
+#endif
@@ -0,0 +1,174 @@
+#include <kernel/threading/scheduler.h>
+#include <kernel/threading/thread.h>
+#include <kernel/threading/work_queue.h>
+#include <kernel/util.h>
+
+#include <kernel/drivers/text_output.h>
+
+#define WORK_QUEUE_MAX_QUEUES 8
+#define WORK_QUEUE_STACK_PAGES 2
+#define WORK_QUEUE_SYSTEM_PRIORITY 30
+#define WORK_QUEUE_HIGH_PRIORITY 31  // Nothing else runs at it
+
+struct WorkQueue {
+  const char *name;
+
+  // Items are pushed onto the front of this list with a compare-and-swap, and
+  // the worker takes the whole list at once. There is only one CPU for now, so
+  // there is only one list per queue.
+  WorkItem *volatile head;
+
+  KernelThread *worker;
+  bool worker_sleeping;
+
+  // Statistics
+  uint64_t num_batches, num_items;
+  uint64_t total_cycles, max_batch_cycles;
+};
+
+static struct {
+  WorkQueue queues[WORK_QUEUE_MAX_QUEUES];
+  size_t num_queues;
+
+  WorkQueue *system_queue;
+  WorkQueue *high_priority_queue;
+} work_queue_data;
+
+// Runs every item in `items` (which is in LIFO order) in the order they were
+// queued.
+static void work_queue_run_batch(WorkQueue *queue, WorkItem *items) {
+  const uint64_t start = read_tsc();
+
+  WorkItem *ordered = NULL;
+  while (items) {
+    WorkItem *next = items->next;
+    items->next = ordered;
+    ordered = items;
+    items = next;
+  }
+
+  uint64_t num_items = 0;
+  while (ordered) {
+    WorkItem *item = ordered;
+    ordered = item->next;
+
+    // Clear `pending` before running so the item can be queued again
+    // (possibly by its own function).
+    __sync_lock_release(&item->pending);
+    item->function(item->context);
+
+    num_items++;
+  }
+
+  const uint64_t cycles = read_tsc() - start;
+  queue->num_batches++;
+  queue->num_items += num_items;
+  queue->total_cycles += cycles;
+  if (cycles > queue->max_batch_cycles) queue->max_batch_cycles = cycles;
+}
+
+static void *work_queue_thread_main(void *parameter) {
+  WorkQueue *queue = (WorkQueue *)parameter;
+
+  while (true) {
+    cli();
+    while (queue->head == NULL) {
+      queue->worker_sleeping = true;
+      thread_sleep(queue->worker);  // Returns with interrupts disabled
+      queue->worker_sleeping = false;
+    }
+
+    WorkItem *items = __sync_lock_test_and_set(&queue->head, NULL);
+    sti();
+
+    work_queue_run_batch(queue, items);
+  }
+
+  return NULL;
+}
+
+void work_queue_init() {
+  REQUIRE_MODULE("scheduler");
+
+  work_queue_data.num_queues = 0;
+  work_queue_data.system_queue =
+      work_queue_create("system", WORK_QUEUE_SYSTEM_PRIORITY,
+                        THREAD_CLASS_REALTIME);
+  work_queue_data.high_priority_queue =
+      work_queue_create("high_priority", WORK_QUEUE_HIGH_PRIORITY,
+                        THREAD_CLASS_REALTIME);
+
+  REGISTER_MODULE("work_queue");
+}
+
+void work_item_init(WorkItem *item, WorkFunction function, void *context) {
+  item->next = NULL;
+  item->function = function;
+  item->context = context;
+  item->pending = 0;
+}
+
+WorkQueue *work_queue_create(const char *name, uint8_t priority,
+                             KernelThreadSchedulingClass scheduling_class) {
+  assert(work_queue_data.num_queues < WORK_QUEUE_MAX_QUEUES);
+
+  WorkQueue *queue = &work_queue_data.queues[work_queue_data.num_queues++];
+  queue->name = name;
+  queue->head = NULL;
+  queue->worker_sleeping = false;
+  queue->num_batches = queue->num_items = 0;
+  queue->total_cycles = queue->max_batch_cycles = 0;
+
+  queue->worker = thread_create(work_queue_thread_main, queue, priority,
+                                WORK_QUEUE_STACK_PAGES);
+  assert(queue->worker);
+  thread_set_scheduling_class(queue->worker, scheduling_class);
+  thread_start(queue->worker);
+
+  return queue;
+}
+
+WorkQueue *work_queue_system() { return work_queue_data.system_queue; }
+
+WorkQueue *work_queue_high_priority() {
+  return work_queue_data.high_priority_queue;
+}
+
+bool work_queue_enqueue(WorkQueue *queue, WorkItem *item) {
+  if (__sync_lock_test_and_set(&item->pending, 1)) return false;
+
+  WorkItem *head;
+  do {
+    head = queue->head;
+    item->next = head;
+  } while (!__sync_bool_compare_and_swap(&queue->head, head, item));
+
+  // If the list wasn't empty the worker has already been woken up
+  if (head == NULL) {
+    bool interrupts_enabled = interrupts_status();
+    cli();
+
+    if (queue->worker_sleeping) thread_wake(queue->worker);
+
+    // Only re-enable interrupts if they were enabled before
+    if (interrupts_enabled) sti();
+
+    scheduler_preempt_if_needed();
+  }
+
+  return true;
+}
+
+void work_queue_print_statistics() {
+  text_output_printf("Work queue statistics:\n");
+  for (size_t i = 0; i < work_queue_data.num_queues; ++i) {
+    const WorkQueue *queue = &work_queue_data.queues[i];
+    const uint64_t average_cycles =
+        queue->num_batches ? queue->total_cycles / queue->num_batches : 0;
+
+    text_output_printf(
+        "  %s: batches %lu, items %lu, avg batch cycles %lu, max %lu\n",
+        queue->name, queue->num_batches, queue->num_items, average_cycles,
+        queue->max_batch_cycles);
+  }
+}
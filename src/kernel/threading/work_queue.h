@@ -0,0 +1,49 @@
+#include <kernel/kernel_common.h>
+#include <kernel/threading/thread.h>
+
+#ifndef _WORK_QUEUE_H
+#define _WORK_QUEUE_H
+
+// Work queues let interrupt handlers defer work (bottom halves) to a kernel
+// thread so that the handler itself can return as quickly as possible.
+//
+// A WorkItem is owned by the caller (usually embedded in a driver struct) and
+// can only be queued once at a time; queueing an item that is already pending
+// is a no-op. Items are pushed onto a lock-free list, so work_queue_enqueue()
+// is safe to call from an ISR. The worker thread drains the list in batches.
+
+typedef struct WorkItem WorkItem;
+typedef void (*WorkFunction)(void *context);
+
+struct WorkItem {
+  WorkItem *next;
+  WorkFunction function;
+  void *context;
+  volatile uint8_t pending;
+};
+
+typedef struct WorkQueue WorkQueue;
+
+void work_queue_init();
+
+void work_item_init(WorkItem *item, WorkFunction function, void *context);
+
+// Creates a new work queue with a worker thread that runs at `priority` in
+// `scheduling_class`. Interrupt bottom halves should stay realtime.
+WorkQueue *work_queue_create(const char *name, uint8_t priority,
+                             KernelThreadSchedulingClass scheduling_class);
+
+// The default queue used for interrupt bottom halves.
+WorkQueue *work_queue_system();
+
+// Runs above every other thread, for bottom halves that wake threads up and
+// must not wait behind them (timer expiry). Threads must stay below priority
+// 31 for this to hold.
+WorkQueue *work_queue_high_priority();
+
+// Returns false if `item` was already pending.
+bool work_queue_enqueue(WorkQueue *queue, WorkItem *item);
+
+void work_queue_print_statistics();
+
+#endif
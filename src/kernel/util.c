@@ -78,12 +78,111 @@ int abs(int i) {
   return i;
 }
 
+// Interrupts-off tracking: cli() remembers when and where interrupts went
+// off, sti() charges the time to that call site. Only the worst sites are
+// kept. Interrupt handlers (which run with interrupts off) and context
+// switches that restore the flag aren't counted.
+#define INTERRUPTS_OFF_MAX_SITES 16
+
+typedef struct {
+  uint64_t site;  // Return address of the cli() call
+  uint64_t count;
+  uint64_t total_cycles, max_cycles;
+} InterruptsOffSite;
+
+static struct {
+  uint64_t start_tsc;  // 0 when no section is being tracked
+  uint64_t start_site;
+
+  InterruptsOffSite sites[INTERRUPTS_OFF_MAX_SITES];
+  uint32_t num_sites;
+  uint64_t num_dropped;  // Sections from sites that didn't make the table
+} interrupts_off_data;
+
+void interrupts_off_record(uint64_t site, uint64_t cycles) {
+  InterruptsOffSite *entry = NULL;
+  for (uint32_t i = 0; i < interrupts_off_data.num_sites; ++i) {
+    if (interrupts_off_data.sites[i].site == site) {
+      entry = &interrupts_off_data.sites[i];
+      break;
+    }
+  }
+
+  if (!entry) {
+    if (interrupts_off_data.num_sites < INTERRUPTS_OFF_MAX_SITES) {
+      entry = &interrupts_off_data.sites[interrupts_off_data.num_sites++];
+    } else {
+      // Evict the site with the shortest worst case if this one is worse
+      entry = &interrupts_off_data.sites[0];
+      for (uint32_t i = 1; i < INTERRUPTS_OFF_MAX_SITES; ++i) {
+        if (interrupts_off_data.sites[i].max_cycles < entry->max_cycles) {
+          entry = &interrupts_off_data.sites[i];
+        }
+      }
+
+      if (entry->max_cycles >= cycles) {
+        interrupts_off_data.num_dropped++;
+        return;
+      }
+      interrupts_off_data.num_dropped += entry->count;
+    }
+
+    entry->site = site;
+    entry->count = 0;
+    entry->total_cycles = entry->max_cycles = 0;
+  }
+
+  entry->count++;
+  entry->total_cycles += cycles;
+  if (cycles > entry->max_cycles) entry->max_cycles = cycles;
+}
+
 void sti() {
+  if (interrupts_off_data.start_tsc != 0 && !interrupts_status()) {
+    const uint64_t cycles = read_tsc() - interrupts_off_data.start_tsc;
+    interrupts_off_data.start_tsc = 0;
+    interrupts_off_record(interrupts_off_data.start_site, cycles);
+  }
+
   __asm__ ("sti");
 }
 
 void cli() {
+  const bool interrupts_enabled = interrupts_status();
   __asm__ ("cli");
+
+  if (interrupts_enabled) {
+    interrupts_off_data.start_site = (uint64_t)__builtin_return_address(0);
+    interrupts_off_data.start_tsc = read_tsc();
+  }
+}
+
+void interrupts_off_print_statistics() {
+  // Worst first, the table is small enough for a selection sort
+  bool printed[INTERRUPTS_OFF_MAX_SITES] = {false};
+
+  text_output_printf("Interrupts off (worst call sites of cli()):\n");
+  for (uint32_t n = 0; n < interrupts_off_data.num_sites; ++n) {
+    int32_t worst = -1;
+    for (uint32_t i = 0; i < interrupts_off_data.num_sites; ++i) {
+      if (printed[i]) continue;
+      if (worst == -1 || interrupts_off_data.sites[i].max_cycles >
+                             interrupts_off_data.sites[worst].max_cycles) {
+        worst = i;
+      }
+    }
+    printed[worst] = true;
+
+    const InterruptsOffSite *entry = &interrupts_off_data.sites[worst];
+    text_output_printf("  0x%x: %lu times, avg %lu max %lu cycles\n",
+                       entry->site, entry->count,
+                       entry->total_cycles / entry->count, entry->max_cycles);
+  }
+
+  if (interrupts_off_data.num_dropped > 0) {
+    text_output_printf("  %lu sections from other sites not shown\n",
+                       interrupts_off_data.num_dropped);
+  }
 }
 
 bool interrupts_status() {
@@ -130,12 +229,19 @@ void io_write_32(unsigned port, uint32_t val) {
 void write_msr(uint64_t index, uint64_t value) {
   uint64_t high = value >> 32;
   uint64_t low  = (value & 0x0000000000000000ffffffffffffffff);
-  __asm__ ("rdmsr" : : "a" (low), "d" (high), "c" (index));
+  __asm__ volatile ("wrmsr" : : "a" (low), "d" (high), "c" (index));
 }
 
 uint64_t read_msr(uint64_t index) {
   uint64_t high, low;
-  __asm__ ("rdmsr" : "=a" (low), "=d" (high) : "c" (index));
+  __asm__ volatile ("rdmsr" : "=a" (low), "=d" (high) : "c" (index));
+
+  return high << 32 | low;
+}
+
+uint64_t read_tsc() {
+  uint64_t high, low;
+  __asm__ volatile ("rdtsc" : "=a" (low), "=d" (high));
 
   return high << 32 | low;
 }
\ No newline at end of file
@@ -71,8 +71,18 @@ void io_write_32(unsigned port, uint32_t val);
 void write_msr(uint64_t index, uint64_t value);
 uint64_t read_msr(uint64_t index);
 
+uint64_t read_tsc();
+
 void sti();
 void cli();
 bool interrupts_status();
 
+// Interrupt handlers run with interrupts disabled without calling cli(), they
+// record themselves with this
+void interrupts_off_record(uint64_t site, uint64_t cycles);
+
+// Prints how long interrupts were kept disabled, by cli() call site or
+// interrupt handler
+void interrupts_off_print_statistics();
+
 #endif